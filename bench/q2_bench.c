@@ -0,0 +1,286 @@
+/*
+ * Copyright 2020-2021 Riccardo Vacirca
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//! Microbenchmarks of libq2: JSON encoding, string escaping and the
+//! authentication digest, each compared with the code it replaced. The
+//! module is compiled in, see README.
+
+#include "../libq2.c"
+
+//! The apr_psprintf based encoder replaced by q2_json_t
+static const char* q2_bench_json_value(apr_pool_t *mp, const char *s)
+{
+    if (s == NULL) return NULL;
+    switch (*s)
+    {
+    case '\0':
+        return NULL;
+    case '-':
+    case '0':
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9':
+        return q2_is_float(s)
+            ? s
+            : apr_psprintf(mp, "\"%s\"", apr_pescape_echo(mp, s, 1));
+    case 't':
+    case 'T':
+        if (!strncmp(s, "true", 4))
+            return apr_pstrdup(mp, "true");
+    case 'f':
+    case 'F':
+        if (!strncmp(s, "false", 5))
+            return apr_pstrdup(mp, "false");
+    case 'n':
+    case 'N':
+        if (!strncmp(s, "null", 4) || !strncmp(s, "NULL", 4))
+            return apr_pstrdup(mp, "null");
+    default:
+        return apr_psprintf(mp, "\"%s\"", apr_pescape_echo(mp, s, 1));
+    }
+    return NULL;
+}
+
+static const char* q2_bench_json_table(apr_pool_t *mp, apr_table_t *t)
+{
+    int len;
+    apr_array_header_t *arr;
+    if (t == NULL) return NULL;
+    if ((len = (apr_table_elts(t))->nelts) <= 0) return NULL;
+    if ((arr = apr_array_make(mp, len, sizeof(const char*))) == NULL)
+        return NULL;
+    for (int i = 0; i < len; i++) {
+        apr_table_entry_t *e =
+            &((apr_table_entry_t*)((apr_table_elts(t))->elts))[i];
+        APR_ARRAY_PUSH(arr, const char*) =
+            apr_psprintf(mp, "\"%s\":%s", (const char*)e->key,
+                         q2_bench_json_value(mp, (const char*)e->val));
+    }
+    return apr_pstrcat(mp, "{", apr_array_pstrcat(mp, arr, ','), "}", NULL);
+}
+
+static const char* q2_bench_json_array(apr_pool_t *mp,
+                                       apr_array_header_t *a,
+                                       int tp)
+{
+    apr_array_header_t *arr = NULL;
+    void *v = NULL;
+    if (a == NULL || a->nelts <= 0) return NULL;
+    arr = apr_array_make(mp, a->nelts, sizeof(const char*));
+    for (int i = 0; i < a->nelts; i++) {
+        v = APR_ARRAY_IDX(a, i, void*);
+        switch (tp)
+        {
+        case Q2_TABLE:
+            APR_ARRAY_PUSH(arr, const char*) =
+                q2_bench_json_table(mp, (apr_table_t*)v);
+            break;
+        default:
+            APR_ARRAY_PUSH(arr, const char*) =
+                q2_bench_json_value(mp, (const char*)v);
+            break;
+        }
+    }
+    return apr_pstrcat(mp, "[", apr_array_pstrcat(mp, arr, ','), "]", NULL);
+}
+
+static apr_array_header_t* q2_bench_rows(apr_pool_t *mp, int n)
+{
+    apr_table_t *t;
+    apr_array_header_t *rows = apr_array_make(mp, n, sizeof(apr_table_t*));
+    for (int i = 0; i < n; i++) {
+        t = apr_table_make(mp, 6);
+        apr_table_setn(t, "id", apr_itoa(mp, i + 1));
+        apr_table_setn(t, "name", apr_psprintf(mp, "customer %d", i));
+        apr_table_setn(t, "email", apr_psprintf(mp, "c%d@example.com", i));
+        apr_table_setn(t, "amount", apr_psprintf(mp, "%d.%02d", i, i % 100));
+        apr_table_setn(t, "created", "2021-03-01 12:00:00");
+        apr_table_setn(t, "note", "Lorem ipsum dolor sit amet, consectetur "
+                                  "adipiscing elit, sed do eiusmod tempor");
+        APR_ARRAY_PUSH(rows, apr_table_t*) = t;
+    }
+    return rows;
+}
+
+static apr_array_header_t* q2_bench_columns(apr_pool_t *mp)
+{
+    static const char *names[] = {"id", "name", "email", "amount",
+                                  "created", "note"};
+    static const unsigned char types[] = {Q2_CT_NUMERIC, Q2_CT_STRING,
+                                          Q2_CT_STRING, Q2_CT_NUMERIC,
+                                          Q2_CT_DATE, Q2_CT_STRING};
+    q2_column_t *c;
+    apr_array_header_t *cols = apr_array_make(mp, 6, sizeof(q2_column_t));
+    for (int i = 0; i < 6; i++) {
+        c = (q2_column_t*)apr_array_push(cols);
+        memset(c, 0, sizeof(q2_column_t));
+        c->table = "customers";
+        c->name = names[i];
+        c->type = types[i];
+    }
+    return cols;
+}
+
+static void q2_bench_json(apr_pool_t *mp, int n_rows, int iters)
+{
+    apr_pool_t *tp;
+    apr_time_t t0, t_old, t_new, t_typed;
+    apr_array_header_t *rows, *cols;
+    const char *old_s = NULL, *new_s = NULL;
+    q2_json_t *w = NULL;
+    rows = q2_bench_rows(mp, n_rows);
+    cols = q2_bench_columns(mp);
+    apr_pool_create(&tp, mp);
+    t0 = apr_time_now();
+    for (int i = 0; i < iters; i++) {
+        apr_pool_clear(tp);
+        old_s = q2_bench_json_array(tp, rows, Q2_TABLE);
+    }
+    t_old = apr_time_now() - t0;
+    old_s = apr_pstrdup(mp, old_s);
+    t0 = apr_time_now();
+    for (int i = 0; i < iters; i++) {
+        apr_pool_clear(tp);
+        w = q2_json_make(tp, Q2_JSON_BUFSIZE);
+        q2_json_array(w, rows, Q2_TABLE);
+    }
+    t_new = apr_time_now() - t0;
+    new_s = apr_pstrdup(mp, q2_json_get(w));
+    t0 = apr_time_now();
+    for (int i = 0; i < iters; i++) {
+        apr_pool_clear(tp);
+        w = q2_json_make(tp, Q2_JSON_BUFSIZE);
+        q2_json_rows(w, rows, cols, "customers");
+    }
+    t_typed = apr_time_now() - t0;
+    printf("json %d rows x %d: psprintf %" APR_TIME_T_FMT " us, "
+           "writer %" APR_TIME_T_FMT " us, typed %" APR_TIME_T_FMT " us, "
+           "output %s\n", n_rows, iters, t_old, t_new, t_typed,
+           strcmp(old_s, new_s) || strcmp(old_s, q2_json_get(w))
+               ? "differs"
+               : "equal");
+    apr_pool_destroy(tp);
+}
+
+static void q2_bench_escape(apr_pool_t *mp, int iters)
+{
+    char *text;
+    apr_size_t len = 16384;
+    apr_time_t t0;
+    q2_json_t *w;
+    //! long text columns, one character in 64 needs escaping
+    text = (char*)apr_palloc(mp, len);
+    for (apr_size_t i = 0; i < len; i++)
+        text[i] = (char)(i % 64 == 63 ? (i % 128 == 127 ? '\n' : '"')
+                                      : 'a' + i % 26);
+    w = q2_json_make(mp, len * 2);
+    t0 = apr_time_now();
+    for (int i = 0; i < iters * 100; i++) {
+        w->len = 0;
+        q2_json_escape(w, text, len);
+    }
+    printf("json escape %" APR_SIZE_T_FMT " bytes x %d (%s): "
+           "%" APR_TIME_T_FMT " us\n", len, iters * 100, Q2_JSON_SIMD,
+           apr_time_now() - t0);
+}
+
+//! Authentication digest as computed before the fixed buffer implementation
+static char* q2_bench_base64_encode(apr_pool_t *mp, const char *s)
+{
+    int s_l, b64_l;
+    char *b64_s;
+    if (s == NULL) return NULL;
+    s_l = (int)strlen(s);
+    b64_l = apr_base64_encode_len(s_l);
+    b64_s = (char*)apr_palloc(mp, sizeof(char)*b64_l);
+    if (b64_s == NULL) return NULL;
+    apr_base64_encode(b64_s, s, s_l);
+    return b64_s;
+}
+
+static const char* q2_bench_hmac(apr_pool_t *mp,
+                                 const uint8_t *k,
+                                 uint32_t k_len,
+                                 const uint8_t *s,
+                                 uint32_t s_len)
+{
+    apr_array_header_t *hash_ar;
+    uint32_t hash_len = SHA256_DIGEST_SIZE;
+    uint8_t hash[hash_len];
+    unsigned char* res;
+    res = HMAC(EVP_sha256(), k, k_len, s, s_len, hash, &hash_len);
+    hash_ar = apr_array_make(mp, SHA256_DIGEST_SIZE, sizeof(const char*));
+    for (int i = 0; i < hash_len; i++) {
+        APR_ARRAY_PUSH(hash_ar, const char*) = apr_psprintf(mp, "%02x", res[i]);
+    }
+    return q2_join(mp, hash_ar, "");
+}
+
+static void q2_bench_auth(apr_pool_t *mp, int iters)
+{
+    apr_pool_t *tp;
+    apr_time_t t0, t_old, t_new;
+    const char *key = "secret", *uri = "/q2/v1/customers?name=bob";
+    const char *date = "20apr201312:59:24", *nonce = "123456";
+    const char *s, *old_d = NULL;
+    char new_d[Q2_REST_DIGEST_LEN];
+    int valid = 0;
+    apr_pool_create(&tp, mp);
+    s = apr_psprintf(mp, "GET+%s+%s+%s", uri, date, nonce);
+    q2_rest_hmac_digest(key, "GET", uri, date, nonce, new_d);
+    t0 = apr_time_now();
+    for (int i = 0; i < iters * 100; i++) {
+        apr_pool_clear(tp);
+        old_d = q2_bench_base64_encode(tp,
+                                       q2_bench_hmac(tp, (const uint8_t*)key,
+                                                     strlen(key),
+                                                     (const uint8_t*)s,
+                                                     strlen(s)));
+        valid = strcmp(old_d, new_d) == 0;
+    }
+    t_old = apr_time_now() - t0;
+    old_d = apr_pstrdup(mp, old_d);
+    t0 = apr_time_now();
+    for (int i = 0; i < iters * 100; i++)
+        valid = q2_rest_hmac_verify(key, "GET", uri, date, nonce, old_d);
+    t_new = apr_time_now() - t0;
+    printf("auth digest x %d: psprintf %" APR_TIME_T_FMT " us, "
+           "fixed %" APR_TIME_T_FMT " us, output %s\n", iters * 100,
+           t_old, t_new, valid && strcmp(old_d, new_d) == 0
+                             ? "equal"
+                             : "differs");
+    apr_pool_destroy(tp);
+}
+
+int main(int argc, char **argv)
+{
+    apr_pool_t *mp;
+    int iters = argc > 1 ? atoi(argv[1]) : 100;
+    apr_initialize();
+    apr_pool_create(&mp, NULL);
+    q2_bench_json(mp, 1000, iters);
+    q2_bench_escape(mp, iters);
+    q2_bench_auth(mp, iters);
+    apr_pool_destroy(mp);
+    apr_terminate();
+    return 0;
+}
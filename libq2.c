@@ -20,6 +20,7 @@
 #include "ctype.h"
 #include "time.h"
 #include "pthread.h"
+#include "fcntl.h"
 
 #include "apr.h"
 #include "apr_general.h"
@@ -33,6 +34,13 @@
 #include "apr_base64.h"
 #include "apr_strmatch.h"
 #include "apr_network_io.h"
+#include "apr_hash.h"
+#include "apr_shm.h"
+#include "apr_global_mutex.h"
+#include "apr_thread_mutex.h"
+#include "apr_atomic.h"
+#include "apr_thread_pool.h"
+#include "apr_portable.h"
 
 #include "httpd.h"
 #include "http_config.h"
@@ -45,14 +53,40 @@
 #include "openssl/engine.h"
 #include "openssl/hmac.h"
 #include "openssl/evp.h"
+#include "openssl/crypto.h"
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include "openssl/core_names.h"
+#include "openssl/params.h"
+typedef EVP_MAC_CTX q2_hmac_ctx_t;
+#else
+typedef HMAC_CTX q2_hmac_ctx_t;
+#endif
 
 #include "util_script.h"
 
+#if !defined (Q2_NO_SIMD) && defined (__AVX2__)
+#include "immintrin.h"
+#define Q2_JSON_SIMD              "avx2"
+#elif !defined (Q2_NO_SIMD) && defined (__SSE2__)
+#include "emmintrin.h"
+#define Q2_JSON_SIMD              "sse2"
+#else
+#define Q2_JSON_SIMD              "scalar"
+#endif
+
+#if !defined (Q2_NO_INOTIFY) && defined (__linux__)
+#include "unistd.h"
+#include "poll.h"
+#include "sys/inotify.h"
+#define Q2_REST_INOTIFY
+#endif
+
 #define Q2_HT_METHOD_GET          0x01
 #define Q2_HT_METHOD_POST         0x02
 #define Q2_HT_METHOD_PUT          0x03
 #define Q2_HT_METHOD_PATCH        0x04
 #define Q2_HT_METHOD_DELETE       0x05
+#define Q2_HT_METHOD_OPTIONS      0x06
 
 #define Q2_DBD_MYSQL              0x01
 #define Q2_DBD_PGSQL              0x02
@@ -68,25 +102,43 @@
 #define Q2_ARRAY                  0x03
 #define Q2_TABLE                  0x04
 
-#define Q2_OUTPUT_S               "{"                                          \
-                                  "\"err\":%d,"                                \
-                                  "\"log\":%s,"                                \
-                                  "\"http_method\":%s,"                        \
-                                  "\"dbd_driver_name\":%s,"                    \
-                                  "\"db_server_vers\":%s,"                     \
-                                  "\"table\":%s,"                              \
-                                  "\"column\":%s,"                             \
-                                  "\"sql\":%s,"                                \
-                                  "\"attributes\":%s,"                         \
-                                  "\"results\":%s,"                            \
-                                  "\"pagination\":{"                           \
-                                  "\"total_rows\":%d,"                         \
-                                  "\"prev\":%s,"                               \
-                                  "\"next\":%s"                                \
-                                  "},"                                         \
-                                  "\"affected_rows\":%d,"                      \
-                                  "\"last_insert_id\":%s"                      \
-                                  "}"
+#define Q2_COL_PK                 0x0001
+#define Q2_COL_FK                 0x0002
+#define Q2_COL_NUMERIC            0x0004
+#define Q2_COL_DATE               0x0008
+#define Q2_COL_NULLABLE           0x0010
+#define Q2_COL_AUTO_INCREMENT     0x0020
+#define Q2_COL_UNSIGNED           0x0040
+#define Q2_COL_BOOLEAN            0x0080
+#define Q2_COL_REF_PK_MULTI       0x0100
+
+#define Q2_CT_STRING              0x01
+#define Q2_CT_NUMERIC             0x02
+#define Q2_CT_DATE                0x03
+#define Q2_CT_BOOLEAN             0x04
+
+#define Q2_SHM_KEY_LEN            128
+#define Q2_SCHEMA_CACHE_SLOTS     64
+#define Q2_SCHEMA_CACHE_SLOT_SIZE (32*1024)
+
+#define Q2_COUNT_EXACT            0x01
+#define Q2_COUNT_WINDOW           0x02
+#define Q2_COUNT_ESTIMATED        0x03
+#define Q2_COUNT_NONE             0x04
+#define Q2_COUNT_COLUMN           "q2_total_rows"
+#define Q2_COUNT_SELECT           "*, COUNT(*) OVER() AS " Q2_COUNT_COLUMN
+
+#define Q2_PAGINATE_OFFSET        0x01
+#define Q2_PAGINATE_CURSOR        0x02
+#define Q2_PAGINATE_AFTER         "after"
+
+#define Q2_SQL_ARG_MARK           '\x1a'
+#define Q2_STMT_CACHE_MAX         256
+#define Q2_STMT_LABEL             "q2_stmt_%u"
+#define Q2_INSERT_BATCH_ROWS      100
+#define Q2_INSERT_BATCH_ARGS      2000
+
+#define Q2_JSON_BUFSIZE           8192
 
 #define Q2_REST_CSET_UTF8         "charset=UTF-8"
 #define Q2_REST_ACCEPT_JSON       "application/json"
@@ -94,17 +146,21 @@
 #define Q2_REST_CTYPE_TEXT        "text/plain"
 #define Q2_REST_CTYPE_JSON        "application/json"
 #define Q2_REST_CTYPE_FORM        "application/x-www-form-urlencoded"
+#define Q2_REST_CTYPE_EVENTS      "text/event-stream"
 #define Q2_REST_CTYPE_TEXT_UTF8   Q2_REST_CTYPE_TEXT ";" Q2_REST_CSET_UTF8
 #define Q2_REST_CTYPE_JSON_UTF8   Q2_REST_CTYPE_JSON ";" Q2_REST_CSET_UTF8
 #define Q2_REST_CTYPE_FORM_UTF8   Q2_REST_CTYPE_FORM ";" Q2_REST_CSET_UTF8
 
 #define SHA256_DIGEST_SIZE        (256/8)
+#define Q2_REST_DIGEST_LEN        ((SHA256_DIGEST_SIZE * 2 + 2) / 3 * 4 + 1)
 
 #define Q2_REST_ASYNC_HEADER      "Q2-Async"
 #define Q2_REST_ASYNC_URI         "/q2/v1/async/%s"
-#define Q2_REST_ASYNC_FSTATUS     "%s/_%s"
-#define Q2_REST_ASYNC_STATUS      "{\"status\":\"%s\"}"
+#define Q2_REST_ASYNC_FSTATUS     "%s/%.2s/_%s"
 #define Q2_REST_ASYNC_FREQUEST    "%s/%s"
+#define Q2_REST_ASYNC_FRESULT     "%s/%.2s/_%s.json"
+#define Q2_REST_ASYNC_FSHARD      "%s/%.2s"
+#define Q2_REST_ASYNC_ID_LEN      32
 #define Q2_REST_ASYNC_PROGRESS    "1"
 #define Q2_REST_ASYNC_DONE        "2"
 #define Q2_REST_ASYNC_REQUEST     "%s\r\n"\
@@ -116,12 +172,55 @@
                                   "Date: %s\r\n\r\n"\
                                   "%s"
 
-#define Q2_REST_WD_PORT           80
+#define Q2_REST_QUEUE_FILE        0
+#define Q2_REST_QUEUE_SHM         1
+#define Q2_REST_QUEUE_JOURNAL     2
+#define Q2_REST_QUEUE_SLOTS       1024
+#define Q2_REST_QUEUE_SLOT_SIZE   (16*1024)
+#define Q2_REST_JOURNAL_QUEUED    "Q %" APR_SIZE_T_FMT "\n%s\n"
+#define Q2_REST_JOURNAL_DONE      "D %s\n"
+#define Q2_REST_SEGMENT_FILE      "%s/_journal"
+#define Q2_REST_SEGMENT_SIZE      64
+#define Q2_REST_SEGMENT_HEAD      32
+#define Q2_REST_SYNC_WINDOW       2
+#define Q2_REST_ASYNC_BACKLOG     1000
+#define Q2_REST_ASYNC_BATCH       100
+#define Q2_REST_RESULT_TTL        300
+#define Q2_REST_RESULT_SLOTS      256
+#define Q2_REST_RESULT_SLOT_SIZE  (4*1024)
+#define Q2_REST_ASYNC_RETRY       "1"
+
+#define Q2_REST_SCHEMA_HEADER     "Q2-Schema"
+#define Q2_REST_SCHEMA_RELOAD     "reload"
+#define Q2_REST_STMT_CACHE        "q2_stmt_cache"
+#define Q2_REST_STREAM_FLUSH      64
+#define Q2_REST_ATTRS_PARAM       "_attributes"
+#define Q2_REST_ALLOW             "GET, POST, PUT, PATCH, DELETE, OPTIONS"
+#define Q2_REST_RCACHE_SLOTS      256
+#define Q2_REST_RCACHE_SLOT_SIZE  (64*1024)
+#define Q2_REST_RCACHE_GENS       1024
+#define Q2_REST_AUTH_SLOTS        256
+#define Q2_REST_AUTH_SLOT_SIZE    256
+#define Q2_REST_AUTH_NEG_TTL      5
+#define Q2_REST_AUTH_RELOAD       5
+#define Q2_REST_GRAPH_RETRY       60
+#define Q2_REST_HMAC_SCHEME       "hmac"
+#define Q2_REST_TOKEN_SCHEME      "token"
+#define Q2_REST_TOKEN_URI         "/q2/v1/token"
+#define Q2_REST_TOKEN_KEY_LEN     32
+
 #define Q2_REST_WD_MAX_THREADS    10
 #define Q2_REST_WD_DIROPT         APR_FINFO_DIRENT|APR_FINFO_TYPE|APR_FINFO_NAME
-#define Q2_REST_WD_SOCK_TIMEOUT   (APR_USEC_PER_SEC * 30)
 #define Q2_REST_WD_BUFSIZE        4096
 #define Q2_REST_WD_SECOND         1000000
+#define Q2_REST_WATCH_POLL_MS     1000
+#define Q2_REST_WAIT_MAX          30
+#define Q2_REST_WAIT_POLL_MS      20
+#define Q2_REST_WAIT_PING         15
+#define Q2_REST_GC_SHARDS         256
+#define Q2_REST_GC_PERIOD         256
+#define Q2_REST_STATUS_TTL        86400
+#define Q2_REST_MAX_ENTRIES       100000
 
 #ifdef _DEBUG
 #ifndef _APMOD
@@ -150,6 +249,12 @@ typedef apr_array_header_t*
                        const char*,
                        int*);
 
+typedef apr_array_header_t*
+    (*q2_tb_list_fn_t)(apr_pool_t*,
+                       const apr_dbd_driver_t*,
+                       apr_dbd_t*,
+                       int*);
+
 typedef apr_array_header_t*
     (*q2_cl_name_fn_t)(apr_pool_t*,
                        const apr_dbd_driver_t*,
@@ -206,6 +311,76 @@ typedef const char*
                        apr_dbd_t*,
                        int*);
 
+typedef struct q2_shm_slot_t {
+    char key[Q2_SHM_KEY_LEN];
+    apr_time_t expires;
+    apr_size_t len;
+} q2_shm_slot_t;
+
+typedef struct q2_shm_ring_head_t {
+    volatile apr_uint32_t tail;   //! next slot claimed by a producer
+    char pad[64 - sizeof(apr_uint32_t)];
+    volatile apr_uint32_t head;   //! next slot read by the consumer
+} q2_shm_ring_head_t;
+
+typedef struct q2_shm_ring_slot_t {
+    volatile apr_uint32_t seq;
+    apr_uint32_t len;
+} q2_shm_ring_slot_t;
+
+typedef struct q2_shm_ring_t {
+    apr_shm_t *shm;
+    char *base;
+    apr_uint32_t nslots;          //! power of two
+    apr_size_t slot_size;
+} q2_shm_ring_t;
+
+typedef struct q2_shm_cache_t {
+    apr_shm_t *shm;
+    apr_global_mutex_t *mutex;
+    char *base;
+    int nslots;
+    apr_size_t slot_size;
+} q2_shm_cache_t;
+
+typedef struct q2_graph_fk_t {
+    const char *column;
+    const char *ref_table;
+    const char *ref_column;
+} q2_graph_fk_t;
+
+typedef struct q2_graph_node_t {
+    const char *name;
+    int is_11;                    //! PK columns are all FK columns
+    apr_array_header_t *pks;      //! const char*
+    apr_array_header_t *fks;      //! q2_graph_fk_t*
+    apr_array_header_t *refd_by;  //! const char*, tables referencing this one
+    apr_hash_t *columns;
+} q2_graph_node_t;
+
+typedef struct q2_graph_t {
+    apr_pool_t *pool;
+    apr_hash_t *nodes;            //! table name -> q2_graph_node_t*
+} q2_graph_t;
+
+//! Packed column descriptor, built once per table from the cl_attr_fn()
+//! rows. Strings point into the attribute recordset, they are not copied.
+typedef struct q2_column_t {
+    const char *table;
+    const char *name;
+    const char *charset;          //! NULL for numeric and date columns
+    const char *ref_table;        //! NULL unless the column is a FK
+    const char *ref_column;
+    unsigned short flags;         //! Q2_COL_*
+    unsigned char type;           //! Q2_CT_*
+} q2_column_t;
+
+#define q2_column(a, i) (&APR_ARRAY_IDX((a), (i), q2_column_t))
+
+//! Receives the streamed rows one at a time, row and mp are cleared soon
+//! after the call. A non-zero return stops the delivery.
+typedef int (*q2_row_fn_t)(void *ctx, apr_pool_t *mp, apr_table_t *row);
+
 typedef struct q2_t {
     int error;
     const char *log;
@@ -219,6 +394,7 @@ typedef struct q2_t {
     int affected_rows;
     const char* last_insert_id;
     q2_tb_name_fn_t tb_name_fn;
+    q2_tb_list_fn_t tb_list_fn;
     q2_cl_name_fn_t cl_name_fn;
     q2_cl_attr_fn_t cl_attr_fn;
     q2_pk_attr_fn_t pk_attr_fn;
@@ -237,6 +413,7 @@ typedef struct q2_t {
     apr_array_header_t *uri_tables;
     apr_array_header_t *uri_keys;
     const char *table;
+    const char *rows_table;       //! the rows come from, NULL for table
     const char* request_uri;
     int tab_relation;
     const char *column;
@@ -253,7 +430,30 @@ typedef struct q2_t {
     const char *request_method_name;
     int pagination_ppg;
     int query_num_rows;
+    int count_mode;               //! Q2_COUNT_*, as requested
+    int pagination_count;         //! Q2_COUNT_* applied to the list query
+    int pagination_more;
+    int pagination_mode;          //! Q2_PAGINATE_*
+    const char *pagination_cursor;
+    apr_array_header_t *pagination_keys;
+    apr_array_header_t *pagination_after;
+    int pagination_keyset;
     int single_entity;
+    int with_attributes;          //! attributes block in GET payloads
+    int resolved;                 //! target table already resolved
+    const char *version_column;   //! DB-side row version, e.g. updated_at
+    q2_shm_cache_t *schema_cache;
+    int schema_ttl;
+    int schema_reload;
+    q2_graph_t *graph;
+    apr_array_header_t *columns;
+    apr_array_header_t *sql_binds;
+    apr_array_header_t *sql_args;
+    apr_hash_t *stmt_cache;
+    apr_pool_t *stmt_pool;
+    q2_row_fn_t row_fn;
+    void *row_ctx;
+    apr_dbd_results_t *stream_res;
 #ifdef _APMOD
     request_rec *r_rec;
 #endif
@@ -421,13 +621,187 @@ static char* q2_array_pstrcat(apr_pool_t *mp,
     return apr_array_pstrcat(mp, tmp, 0);
 }
 
-static const char* q2_json_value(apr_pool_t *mp, const char *s)
+//! Append-only JSON output buffer. Without a flush function it grows in
+//! its pool, with one it hands each full buffer to it and keeps its size.
+typedef int (*q2_json_flush_fn_t)(void *ctx, const char *buf, apr_size_t len);
+
+typedef struct q2_json_t {
+    apr_pool_t *pool;
+    char *buf;
+    apr_size_t len;
+    apr_size_t size;
+    int error;
+    q2_json_flush_fn_t flush;
+    void *flush_ctx;
+} q2_json_t;
+
+static q2_json_t* q2_json_make(apr_pool_t *mp, apr_size_t size)
+{
+    q2_json_t *w = (q2_json_t*)apr_palloc(mp, sizeof(q2_json_t));
+    if (w == NULL) return NULL;
+    w->pool = mp;
+    w->size = size < 64 ? 64 : size;
+    w->buf = (char*)apr_palloc(mp, w->size);
+    w->len = 0;
+    w->error = (int)(w->buf == NULL);
+    w->flush = NULL;
+    w->flush_ctx = NULL;
+    return w;
+}
+
+static void q2_json_set_flush(q2_json_t *w, q2_json_flush_fn_t fn, void *ctx)
+{
+    w->flush = fn;
+    w->flush_ctx = ctx;
+}
+
+static int q2_json_flush(q2_json_t *w)
+{
+    if (w->error) return 1;
+    if (w->flush == NULL || w->len == 0) return 0;
+    if (w->flush(w->flush_ctx, w->buf, w->len)) w->error = 1;
+    w->len = 0;
+    return w->error;
+}
+
+//! Makes room for n more bytes plus the terminating NUL
+static int q2_json_reserve(q2_json_t *w, apr_size_t n)
+{
+    char *buf;
+    apr_size_t size;
+    if (w->error) return 1;
+    if (w->len + n < w->size) return 0;
+    if (w->flush != NULL) {
+        if (q2_json_flush(w)) return 1;
+        if (n < w->size) return 0;
+    }
+    for (size = w->size * 2; w->len + n >= size; size *= 2);
+    if ((buf = (char*)apr_palloc(w->pool, size)) == NULL) {
+        w->error = 1;
+        return 1;
+    }
+    memcpy(buf, w->buf, w->len);
+    w->buf = buf;
+    w->size = size;
+    return 0;
+}
+
+static void q2_json_write(q2_json_t *w, const char *s, apr_size_t n)
+{
+    if (n == 0 || q2_json_reserve(w, n)) return;
+    memcpy(w->buf + w->len, s, n);
+    w->len += n;
+}
+
+static void q2_json_puts(q2_json_t *w, const char *s)
+{
+    q2_json_write(w, s, strlen(s));
+}
+
+static void q2_json_putc(q2_json_t *w, char c)
+{
+    if (q2_json_reserve(w, 1)) return;
+    w->buf[w->len ++] = c;
+}
+
+static void q2_json_int(q2_json_t *w, int v)
+{
+    char tmp[16];
+    q2_json_write(w, tmp, (apr_size_t)apr_snprintf(tmp, sizeof(tmp), "%d", v));
+}
+
+//! JSON escape after the backslash of each byte, 'u' for \u00XX (RFC 8259)
+static const char q2_json_esc[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    ['"'] = '"',
+    ['\\'] = '\\'
+};
+
+//! Length of the leading run of s that needs no escaping. The vector loops
+//! test 32 (AVX2) or 16 (SSE2) bytes at a time for '"', '\\' and < 0x20.
+static apr_size_t q2_json_clean_run(const char *s, apr_size_t n)
+{
+    apr_size_t i = 0;
+    unsigned int bits;
+#if !defined (Q2_NO_SIMD) && defined (__AVX2__)
+    const __m256i q32 = _mm256_set1_epi8('"');
+    const __m256i b32 = _mm256_set1_epi8('\\');
+    const __m256i c32 = _mm256_set1_epi8(0x1f);
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i m = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, q32),
+                            _mm256_cmpeq_epi8(v, b32)),
+            _mm256_cmpeq_epi8(_mm256_max_epu8(v, c32), c32));
+        if ((bits = (unsigned int)_mm256_movemask_epi8(m)) != 0)
+            return i + (apr_size_t)__builtin_ctz(bits);
+    }
+#endif
+#if !defined (Q2_NO_SIMD) && (defined (__AVX2__) || defined (__SSE2__))
+    const __m128i q16 = _mm_set1_epi8('"');
+    const __m128i b16 = _mm_set1_epi8('\\');
+    const __m128i c16 = _mm_set1_epi8(0x1f);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i m = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, q16), _mm_cmpeq_epi8(v, b16)),
+            _mm_cmpeq_epi8(_mm_max_epu8(v, c16), c16));
+        if ((bits = (unsigned int)_mm_movemask_epi8(m)) != 0)
+            return i + (apr_size_t)__builtin_ctz(bits);
+    }
+#endif
+    for (; i < n; i++)
+        if (q2_json_esc[(unsigned char)s[i]]) break;
+    return i;
+}
+
+//! Clean runs are copied with a single memcpy
+static void q2_json_escape(q2_json_t *w, const char *s, apr_size_t n)
+{
+    static const char hex[] = "0123456789abcdef";
+    char esc[6] = {'\\', 'u', '0', '0', '0', '0'};
+    apr_size_t run;
+    unsigned char c;
+    while (n > 0) {
+        run = q2_json_clean_run(s, n);
+        q2_json_write(w, s, run);
+        if (run == n) return;
+        c = (unsigned char)s[run];
+        if (q2_json_esc[c] == 'u') {
+            esc[4] = hex[c >> 4];
+            esc[5] = hex[c & 0x0f];
+            q2_json_write(w, esc, 6);
+        } else {
+            esc[1] = q2_json_esc[c];
+            q2_json_write(w, esc, 2);
+            esc[1] = 'u';
+        }
+        s += run + 1;
+        n -= run + 1;
+    }
+}
+
+static void q2_json_string(q2_json_t *w, const char *s)
+{
+    q2_json_putc(w, '"');
+    q2_json_escape(w, s, strlen(s));
+    q2_json_putc(w, '"');
+}
+
+static void q2_json_value(q2_json_t *w, const char *s)
 {
-    if (s == NULL) return NULL;
+    if (s == NULL) {
+        q2_json_write(w, "null", 4);
+        return;
+    }
     switch (*s)
     {
     case '\0':
-        return NULL;
+        q2_json_write(w, "null", 4);
+        return;
     case '-':
     case '0':
     case '1':
@@ -439,66 +813,206 @@ static const char* q2_json_value(apr_pool_t *mp, const char *s)
     case '7':
     case '8':
     case '9':
-        return q2_is_float(s)
-            ? s
-            : apr_psprintf(mp, "\"%s\"", apr_pescape_echo(mp, s, 1));
+        if (q2_is_float(s)) q2_json_puts(w, s);
+        else q2_json_string(w, s);
+        return;
     case 't':
     case 'T':
-        if (!strncmp(s, "true", 4))
-            return apr_pstrdup(mp, "true");
+        if (!strncmp(s, "true", 4)) {
+            q2_json_write(w, "true", 4);
+            return;
+        }
     case 'f':
     case 'F':
-        if (!strncmp(s, "false", 5))
-            return apr_pstrdup(mp, "false");
+        if (!strncmp(s, "false", 5)) {
+            q2_json_write(w, "false", 5);
+            return;
+        }
     case 'n':
     case 'N':
-        if (!strncmp(s, "null", 4) || !strncmp(s, "NULL", 4))
-            return apr_pstrdup(mp, "null");
+        if (!strncmp(s, "null", 4) || !strncmp(s, "NULL", 4)) {
+            q2_json_write(w, "null", 4);
+            return;
+        }
     default:
-        return apr_psprintf(mp, "\"%s\"", apr_pescape_echo(mp, s, 1));
+        q2_json_string(w, s);
+        return;
     }
-    return NULL;
 }
 
-static const char* q2_json_table(apr_pool_t *mp, apr_table_t *t)
+static void q2_json_table(q2_json_t *w, apr_table_t *t)
 {
-    int len;
-    apr_array_header_t *arr;
-    if (t == NULL) return NULL;
-    if ((len = (apr_table_elts(t))->nelts) <= 0) return NULL;
-    if ((arr = apr_array_make(mp, len, sizeof(const char*))) == NULL)
-        return NULL;
-    for (int i = 0; i < len; i++) {
-        apr_table_entry_t *e =
-            &((apr_table_entry_t*)((apr_table_elts(t))->elts))[i];
-        APR_ARRAY_PUSH(arr, const char*) =
-            apr_psprintf(mp, "\"%s\":%s", (const char*)e->key,
-                         q2_json_value(mp, (const char*)e->val));
+    const apr_array_header_t *elts;
+    apr_table_entry_t *e;
+    if (t == NULL || (elts = apr_table_elts(t))->nelts <= 0) {
+        q2_json_write(w, "null", 4);
+        return;
     }
-    return apr_pstrcat(mp, "{", apr_array_pstrcat(mp, arr, ','), "}", NULL);
+    e = (apr_table_entry_t*)elts->elts;
+    q2_json_putc(w, '{');
+    for (int i = 0; i < elts->nelts; i++) {
+        if (i) q2_json_putc(w, ',');
+        q2_json_putc(w, '"');
+        q2_json_escape(w, e[i].key, strlen(e[i].key));
+        q2_json_write(w, "\":", 2);
+        q2_json_value(w, e[i].val);
+    }
+    q2_json_putc(w, '}');
 }
 
-static const char* q2_json_array(apr_pool_t *mp, apr_array_header_t *a, int tp)
+static void q2_json_array(q2_json_t *w, apr_array_header_t *a, int tp)
 {
-    apr_array_header_t *arr = NULL;
-    void *v = NULL;
-    if (a == NULL || a->nelts <= 0) return NULL;
-    arr = apr_array_make(mp, a->nelts, sizeof(const char*));
+    if (a == NULL || a->nelts <= 0) {
+        q2_json_write(w, "null", 4);
+        return;
+    }
+    q2_json_putc(w, '[');
     for (int i = 0; i < a->nelts; i++) {
-        v = APR_ARRAY_IDX(a, i, void*);
+        if (i) q2_json_putc(w, ',');
         switch (tp)
         {
         case Q2_TABLE:
-            APR_ARRAY_PUSH(arr, const char*) =
-                q2_json_table(mp, (apr_table_t*)v);
+            q2_json_table(w, APR_ARRAY_IDX(a, i, apr_table_t*));
             break;
         default:
-            APR_ARRAY_PUSH(arr, const char*) =
-                q2_json_value(mp, (const char*)v);
+            q2_json_value(w, APR_ARRAY_IDX(a, i, const char*));
             break;
         }
     }
-    return apr_pstrcat(mp, "[", apr_array_pstrcat(mp, arr, ','), "]", NULL);
+    q2_json_putc(w, ']');
+}
+
+//! Writes one result cell, chosen once per column from its metadata
+typedef void (*q2_json_emit_fn_t)(q2_json_t *w, const char *v);
+
+//! q2_dbd_row() stores SQL NULLs as "NULL"
+static int q2_json_null_cell(const char *v)
+{
+    return v == NULL || strcmp(v, "NULL") == 0;
+}
+
+static void q2_json_emit_string(q2_json_t *w, const char *v)
+{
+    if (q2_json_null_cell(v)) q2_json_write(w, "null", 4);
+    else q2_json_string(w, v);
+}
+
+//! Copied as is, NaN or Infinity are not JSON numbers and stay strings
+static void q2_json_emit_number(q2_json_t *w, const char *v)
+{
+    if (q2_json_null_cell(v))
+        q2_json_write(w, "null", 4);
+    else if (isdigit((unsigned char)v[0]) ||
+             (v[0] == '-' && isdigit((unsigned char)v[1])))
+        q2_json_puts(w, v);
+    else
+        q2_json_string(w, v);
+}
+
+static void q2_json_emit_boolean(q2_json_t *w, const char *v)
+{
+    if (q2_json_null_cell(v))
+        q2_json_write(w, "null", 4);
+    else if (*v == '1' || *v == 't' || *v == 'T' || *v == 'y' || *v == 'Y')
+        q2_json_write(w, "true", 4);
+    else
+        q2_json_write(w, "false", 5);
+}
+
+//! One emitter for each field of row, in the same order. A field takes the
+//! type of the column of the same name in table (any table when NULL),
+//! fields without metadata fall back to q2_json_value().
+static apr_array_header_t* q2_json_emitters(apr_pool_t *mp,
+                                            apr_array_header_t *columns,
+                                            const char *table,
+                                            apr_table_t *row)
+{
+    const apr_array_header_t *elts;
+    apr_table_entry_t *e;
+    apr_array_header_t *emit;
+    q2_json_emit_fn_t fn;
+    q2_column_t *c;
+    if (row == NULL) return NULL;
+    elts = apr_table_elts(row);
+    e = (apr_table_entry_t*)elts->elts;
+    emit = apr_array_make(mp, elts->nelts, sizeof(q2_json_emit_fn_t));
+    if (emit == NULL) return NULL;
+    for (int i = 0; i < elts->nelts; i++) {
+        fn = q2_json_value;
+        for (int j = 0; columns != NULL && j < columns->nelts; j++) {
+            c = q2_column(columns, j);
+            if (c->name == NULL || strcasecmp(c->name, e[i].key) != 0)
+                continue;
+            if (table != NULL &&
+                (c->table == NULL || strcasecmp(c->table, table) != 0))
+                continue;
+            switch (c->type)
+            {
+            case Q2_CT_NUMERIC:
+                fn = q2_json_emit_number;
+                break;
+            case Q2_CT_BOOLEAN:
+                fn = q2_json_emit_boolean;
+                break;
+            default:
+                fn = q2_json_emit_string;
+                break;
+            }
+            break;
+        }
+        APR_ARRAY_PUSH(emit, q2_json_emit_fn_t) = fn;
+    }
+    return emit;
+}
+
+static void q2_json_row(q2_json_t *w, apr_table_t *row,
+                        apr_array_header_t *emit)
+{
+    const apr_array_header_t *elts;
+    apr_table_entry_t *e;
+    if (row == NULL || emit == NULL ||
+        (elts = apr_table_elts(row))->nelts != emit->nelts ||
+        elts->nelts <= 0) {
+        q2_json_table(w, row);
+        return;
+    }
+    e = (apr_table_entry_t*)elts->elts;
+    q2_json_putc(w, '{');
+    for (int i = 0; i < elts->nelts; i++) {
+        if (i) q2_json_putc(w, ',');
+        q2_json_putc(w, '"');
+        q2_json_escape(w, e[i].key, strlen(e[i].key));
+        q2_json_write(w, "\":", 2);
+        APR_ARRAY_IDX(emit, i, q2_json_emit_fn_t)(w, e[i].val);
+    }
+    q2_json_putc(w, '}');
+}
+
+//! All the rows of a result set have the fields of the first one
+static void q2_json_rows(q2_json_t *w, apr_array_header_t *rows,
+                         apr_array_header_t *columns, const char *table)
+{
+    apr_array_header_t *emit;
+    if (rows == NULL || rows->nelts <= 0) {
+        q2_json_write(w, "null", 4);
+        return;
+    }
+    emit = q2_json_emitters(w->pool, columns, table,
+                            APR_ARRAY_IDX(rows, 0, apr_table_t*));
+    q2_json_putc(w, '[');
+    for (int i = 0; i < rows->nelts; i++) {
+        if (i) q2_json_putc(w, ',');
+        q2_json_row(w, APR_ARRAY_IDX(rows, i, apr_table_t*), emit);
+    }
+    q2_json_putc(w, ']');
+}
+
+//! NUL terminated content, valid until the next write
+static const char* q2_json_get(q2_json_t *w)
+{
+    if (q2_json_reserve(w, 1)) return NULL;
+    w->buf[w->len] = '\0';
+    return w->buf;
 }
 
 static void q2_table_rprintf(void *ctx, apr_table_t *table)
@@ -553,21 +1067,31 @@ static int q2_dbd_query(apr_pool_t *mp,
     return aff_rows;
 }
 
-static apr_array_header_t* q2_dbd_select(apr_pool_t *mp,
-                                         const apr_dbd_driver_t *drv,
-                                         apr_dbd_t *hd,
-                                         const char *sql,
-                                         int *err)
+static apr_table_t* q2_dbd_row(apr_pool_t *mp,
+                               const apr_dbd_driver_t *drv,
+                               apr_dbd_results_t *res,
+                               apr_dbd_row_t *row,
+                               int num_fields)
+{
+    apr_table_t *rec = apr_table_make(mp, num_fields);
+    for (int i = 0; i < num_fields; i++) {
+        const char *k = apr_dbd_get_name(drv, res, i);
+        const char *v = apr_dbd_get_entry(drv, row, i);
+        apr_table_setn(rec, apr_pstrdup(mp, k),
+                       apr_pstrdup(mp, q2_is_empty_s(v) ? "NULL" : v));
+    }
+    return rec;
+}
+
+static apr_array_header_t* q2_dbd_fetch(apr_pool_t *mp,
+                                        const apr_dbd_driver_t *drv,
+                                        apr_dbd_results_t *res)
 {
     apr_status_t rv;                //! status
-    apr_dbd_results_t *res = NULL;  //! dbd resultset
     apr_dbd_row_t *row = NULL;      //! next row in the resultset
     apr_array_header_t *rset;       //! the recordset returned by the server
-    apr_table_t *rec;               //! a recordset record
     int first_rec;
     int num_fields;
-    const char *error;
-    if (((*err) = apr_dbd_select(drv, mp, hd, &res, sql, 0))) return NULL;
     if (res == NULL) return NULL;
     if ((rv = apr_dbd_get_row(drv, mp, res, &row, -1)) == -1) return NULL;
     rset = NULL;
@@ -578,19 +1102,66 @@ static apr_array_header_t* q2_dbd_select(apr_pool_t *mp,
             rset = apr_array_make(mp, num_fields, sizeof(apr_table_t*));
             first_rec = 0;
         }
-        rec = apr_table_make(mp, num_fields);
-        for (int i = 0; i < num_fields; i++) {
-            const char *k = apr_dbd_get_name(drv, res, i);
-            const char *v = apr_dbd_get_entry(drv, row, i);
-            apr_table_setn(rec, apr_pstrdup(mp, k),
-                           apr_pstrdup(mp, q2_is_empty_s(v) ? "NULL" : v));
-        }
-        APR_ARRAY_PUSH(rset, apr_table_t*) = rec;
+        APR_ARRAY_PUSH(rset, apr_table_t*) =
+            q2_dbd_row(mp, drv, res, row, num_fields);
         rv = apr_dbd_get_row(drv, mp, res, &row, -1);
     }
     return rset;
 }
 
+static apr_array_header_t* q2_dbd_select(apr_pool_t *mp,
+                                         const apr_dbd_driver_t *drv,
+                                         apr_dbd_t *hd,
+                                         const char *sql,
+                                         int *err)
+{
+    apr_dbd_results_t *res = NULL;
+    if (((*err) = apr_dbd_select(drv, mp, hd, &res, sql, 0))) return NULL;
+    return q2_dbd_fetch(mp, drv, res);
+}
+
+//! Sequential results: rows can only be read once, in order
+static apr_dbd_results_t* q2_dbd_presults(apr_pool_t *mp,
+                                          const apr_dbd_driver_t *drv,
+                                          apr_dbd_t *hd,
+                                          apr_dbd_prepared_t *stmt,
+                                          apr_array_header_t *args,
+                                          int *err)
+{
+    apr_dbd_results_t *res = NULL;
+    (*err) = apr_dbd_pselect(drv, mp, hd, &res, stmt, 0,
+                             args == NULL ? 0 : args->nelts,
+                             args == NULL ? NULL : (const char**)args->elts);
+    if (*err) return NULL;
+    return res;
+}
+
+static apr_array_header_t* q2_dbd_pselect(apr_pool_t *mp,
+                                          const apr_dbd_driver_t *drv,
+                                          apr_dbd_t *hd,
+                                          apr_dbd_prepared_t *stmt,
+                                          apr_array_header_t *args,
+                                          int *err)
+{
+    return q2_dbd_fetch(mp, drv,
+                        q2_dbd_presults(mp, drv, hd, stmt, args, err));
+}
+
+static int q2_dbd_pquery(apr_pool_t *mp,
+                         const apr_dbd_driver_t *drv,
+                         apr_dbd_t *hd,
+                         apr_dbd_prepared_t *stmt,
+                         apr_array_header_t *args,
+                         int *err)
+{
+    int aff_rows = 0;
+    (*err) = apr_dbd_pquery(drv, mp, hd, &aff_rows, stmt,
+                            args == NULL ? 0 : args->nelts,
+                            args == NULL ? NULL : (const char**)args->elts);
+    if (*err) return -1;
+    return aff_rows;
+}
+
 static const char* q2_dbd_get_value(apr_array_header_t *rset,
                                     int i,
                                     const char *key)
@@ -616,6 +1187,299 @@ static apr_table_t* q2_dbd_get_entry(apr_array_header_t *rset, int i)
     return APR_ARRAY_IDX(rset, i, apr_table_t*);
 }
 
+//! Flattens a recordset as "k\0v\0...k\0v\0\0" (one trailing \0 per record).
+//! NULL values are stored as empty strings, q2_dbd_select() never returns
+//! empty values so they are restored as NULL by q2_dbd_unserialize().
+static char* q2_dbd_serialize(apr_pool_t *mp,
+                              apr_array_header_t *rset,
+                              apr_size_t *len)
+{
+    char *retv, *p;
+    apr_table_t *t;
+    const apr_array_header_t *elts;
+    apr_table_entry_t *e;
+    *len = 0;
+    if (rset == NULL || rset->nelts <= 0) return NULL;
+    for (int i = 0; i < rset->nelts; i++) {
+        t = APR_ARRAY_IDX(rset, i, apr_table_t*);
+        elts = apr_table_elts(t);
+        for (int j = 0; j < elts->nelts; j++) {
+            e = &((apr_table_entry_t*)(elts->elts))[j];
+            (*len) += strlen(e->key) + 1;
+            (*len) += (e->val == NULL ? 0 : strlen(e->val)) + 1;
+        }
+        (*len) ++;
+    }
+    if ((retv = (char*)apr_palloc(mp, *len)) == NULL) return NULL;
+    p = retv;
+    for (int i = 0; i < rset->nelts; i++) {
+        t = APR_ARRAY_IDX(rset, i, apr_table_t*);
+        elts = apr_table_elts(t);
+        for (int j = 0; j < elts->nelts; j++) {
+            e = &((apr_table_entry_t*)(elts->elts))[j];
+            p = apr_cpystrn(p, e->key, strlen(e->key) + 1) + 1;
+            if (e->val == NULL) *p++ = '\0';
+            else p = apr_cpystrn(p, e->val, strlen(e->val) + 1) + 1;
+        }
+        *p++ = '\0';
+    }
+    return retv;
+}
+
+static apr_array_header_t* q2_dbd_unserialize(apr_pool_t *mp,
+                                              const char *data,
+                                              apr_size_t len)
+{
+    const char *p, *end, *k, *v;
+    apr_table_t *rec;
+    apr_array_header_t *rset;
+    if (data == NULL || len <= 0) return NULL;
+    if ((rset = apr_array_make(mp, 0, sizeof(apr_table_t*))) == NULL)
+        return NULL;
+    p = data;
+    end = data + len;
+    while (p < end) {
+        if ((rec = apr_table_make(mp, 0)) == NULL) return NULL;
+        while (p < end && *p != '\0') {
+            k = p;
+            p += strlen(p) + 1;
+            if (p >= end) return NULL;
+            v = p;
+            p += strlen(p) + 1;
+            apr_table_setn(rec, k, *v == '\0' ? NULL : v);
+        }
+        p ++;
+        APR_ARRAY_PUSH(rset, apr_table_t*) = rec;
+    }
+    return rset;
+}
+
+//! Fixed-size, direct-mapped key/value store in an anonymous apr_shm segment.
+//! Created in post_config so that every child process inherits it, guarded
+//! by a global mutex. A colliding key simply evicts the previous entry.
+#define q2_shm_cache_slot(c, i)                                                \
+    ((q2_shm_slot_t*)((c)->base +                                              \
+                      (apr_size_t)(i) * (sizeof(q2_shm_slot_t) + (c)->slot_size)))
+
+static q2_shm_cache_t* q2_shm_cache_create(apr_pool_t *mp,
+                                           int nslots,
+                                           apr_size_t slot_size)
+{
+    apr_size_t size;
+    q2_shm_cache_t *c;
+    if (nslots <= 0 || slot_size <= 0) return NULL;
+    if ((c = (q2_shm_cache_t*)apr_pcalloc(mp, sizeof(q2_shm_cache_t))) == NULL)
+        return NULL;
+    c->nslots = nslots;
+    c->slot_size = APR_ALIGN_DEFAULT(slot_size);
+    size = (apr_size_t)nslots * (sizeof(q2_shm_slot_t) + c->slot_size);
+    if (apr_shm_create(&c->shm, size, NULL, mp) != APR_SUCCESS) return NULL;
+    if (apr_global_mutex_create(&c->mutex, NULL,
+                                APR_LOCK_DEFAULT, mp) != APR_SUCCESS) {
+        apr_shm_destroy(c->shm);
+        return NULL;
+    }
+    c->base = (char*)apr_shm_baseaddr_get(c->shm);
+    memset(c->base, 0, size);
+    return c;
+}
+
+static int q2_shm_cache_child_init(q2_shm_cache_t *c, apr_pool_t *mp)
+{
+    if (c == NULL) return 1;
+    return apr_global_mutex_child_init(&c->mutex,
+                                       apr_global_mutex_lockfile(c->mutex),
+                                       mp) != APR_SUCCESS;
+}
+
+static q2_shm_slot_t* q2_shm_cache_lookup(q2_shm_cache_t *c, const char *key)
+{
+    apr_ssize_t klen = (apr_ssize_t)strlen(key);
+    unsigned int h = apr_hashfunc_default(key, &klen);
+    return q2_shm_cache_slot(c, h % (unsigned int)c->nslots);
+}
+
+static char* q2_shm_cache_get(q2_shm_cache_t *c,
+                              apr_pool_t *mp,
+                              const char *key,
+                              apr_size_t *len)
+{
+    char *retv = NULL;
+    q2_shm_slot_t *slot;
+    *len = 0;
+    if (c == NULL || key == NULL || strlen(key) >= Q2_SHM_KEY_LEN) return NULL;
+    slot = q2_shm_cache_lookup(c, key);
+    if (apr_global_mutex_lock(c->mutex) != APR_SUCCESS) return NULL;
+    if (strcmp(slot->key, key) == 0) {
+        if (slot->expires == 0 || slot->expires > apr_time_now()) {
+            if ((retv = (char*)apr_palloc(mp, slot->len + 1)) != NULL) {
+                memcpy(retv, (char*)(slot + 1), slot->len);
+                retv[slot->len] = '\0';
+                *len = slot->len;
+            }
+        } else {
+            slot->key[0] = '\0';
+        }
+    }
+    apr_global_mutex_unlock(c->mutex);
+    return retv;
+}
+
+static int q2_shm_cache_set(q2_shm_cache_t *c,
+                            const char *key,
+                            const char *data,
+                            apr_size_t len,
+                            int ttl)
+{
+    q2_shm_slot_t *slot;
+    if (c == NULL || key == NULL || data == NULL) return 1;
+    if (strlen(key) >= Q2_SHM_KEY_LEN || len > c->slot_size) return 1;
+    slot = q2_shm_cache_lookup(c, key);
+    if (apr_global_mutex_lock(c->mutex) != APR_SUCCESS) return 1;
+    memcpy((char*)(slot + 1), data, len);
+    slot->len = len;
+    slot->expires = ttl > 0 ? apr_time_now() + apr_time_from_sec(ttl) : 0;
+    apr_cpystrn(slot->key, key, Q2_SHM_KEY_LEN);
+    apr_global_mutex_unlock(c->mutex);
+    return 0;
+}
+
+//! Like q2_shm_cache_set() but a live entry of another key is not evicted
+static int q2_shm_cache_add(q2_shm_cache_t *c,
+                            const char *key,
+                            const char *data,
+                            apr_size_t len,
+                            int ttl)
+{
+    int busy;
+    q2_shm_slot_t *slot;
+    if (c == NULL || key == NULL || data == NULL) return 1;
+    if (strlen(key) >= Q2_SHM_KEY_LEN || len > c->slot_size) return 1;
+    slot = q2_shm_cache_lookup(c, key);
+    if (apr_global_mutex_lock(c->mutex) != APR_SUCCESS) return 1;
+    busy = slot->key[0] != '\0' && strcmp(slot->key, key) != 0 &&
+           (slot->expires == 0 || slot->expires > apr_time_now());
+    if (!busy) {
+        memcpy((char*)(slot + 1), data, len);
+        slot->len = len;
+        slot->expires = ttl > 0 ? apr_time_now() + apr_time_from_sec(ttl) : 0;
+        apr_cpystrn(slot->key, key, Q2_SHM_KEY_LEN);
+    }
+    apr_global_mutex_unlock(c->mutex);
+    return busy;
+}
+
+static int q2_shm_cache_remove(q2_shm_cache_t *c, const char *key)
+{
+    q2_shm_slot_t *slot;
+    if (c == NULL || key == NULL || strlen(key) >= Q2_SHM_KEY_LEN) return 1;
+    slot = q2_shm_cache_lookup(c, key);
+    if (apr_global_mutex_lock(c->mutex) != APR_SUCCESS) return 1;
+    if (strcmp(slot->key, key) == 0) slot->key[0] = '\0';
+    apr_global_mutex_unlock(c->mutex);
+    return 0;
+}
+
+static int q2_shm_cache_clear(q2_shm_cache_t *c)
+{
+    if (c == NULL) return 1;
+    if (apr_global_mutex_lock(c->mutex) != APR_SUCCESS) return 1;
+    for (int i = 0; i < c->nslots; i++)
+        q2_shm_cache_slot(c, i)->key[0] = '\0';
+    apr_global_mutex_unlock(c->mutex);
+    return 0;
+}
+
+//! Bounded multi-producer single-consumer queue in an anonymous apr_shm
+//! segment, lock free. A producer claims a slot by moving tail with a CAS,
+//! fills it and then publishes it through the slot sequence number; the
+//! consumer frees it by moving the sequence one lap ahead.
+#define q2_shm_ring_head(q) ((q2_shm_ring_head_t*)(q)->base)
+#define q2_shm_ring_slot(q, i)                                                 \
+    ((q2_shm_ring_slot_t*)((q)->base + sizeof(q2_shm_ring_head_t) +            \
+                           (apr_size_t)((i) & ((q)->nslots - 1)) *             \
+                           (sizeof(q2_shm_ring_slot_t) + (q)->slot_size)))
+
+//! Read with a full barrier, the slot content is read after its sequence
+#define q2_shm_ring_load(v) apr_atomic_cas32((v), 0, 0)
+
+static q2_shm_ring_t* q2_shm_ring_create(apr_pool_t *mp,
+                                         int nslots,
+                                         apr_size_t slot_size)
+{
+    apr_size_t size;
+    q2_shm_ring_t *q;
+    if (nslots <= 0 || slot_size <= 0) return NULL;
+    if ((q = (q2_shm_ring_t*)apr_pcalloc(mp, sizeof(q2_shm_ring_t))) == NULL)
+        return NULL;
+    for (q->nslots = 1; q->nslots < (apr_uint32_t)nslots; q->nslots <<= 1);
+    q->slot_size = APR_ALIGN_DEFAULT(slot_size);
+    size = sizeof(q2_shm_ring_head_t) +
+           (apr_size_t)q->nslots * (sizeof(q2_shm_ring_slot_t) + q->slot_size);
+    if (apr_shm_create(&q->shm, size, NULL, mp) != APR_SUCCESS) return NULL;
+    q->base = (char*)apr_shm_baseaddr_get(q->shm);
+    memset(q->base, 0, size);
+    for (apr_uint32_t i = 0; i < q->nslots; i++)
+        q2_shm_ring_slot(q, i)->seq = i;
+    return q;
+}
+
+//! 1 when the ring is full or data does not fit in a slot
+static int q2_shm_ring_push(q2_shm_ring_t *q, const char *data, apr_size_t len)
+{
+    apr_uint32_t pos, seq;
+    q2_shm_ring_slot_t *slot;
+    q2_shm_ring_head_t *h;
+    if (q == NULL || data == NULL || len > q->slot_size) return 1;
+    h = q2_shm_ring_head(q);
+    pos = apr_atomic_read32(&h->tail);
+    for (;;) {
+        slot = q2_shm_ring_slot(q, pos);
+        seq = q2_shm_ring_load(&slot->seq);
+        if (seq == pos) {
+            if (apr_atomic_cas32(&h->tail, pos + 1, pos) == pos) break;
+        } else if ((apr_int32_t)(seq - pos) < 0) {
+            return 1;
+        }
+        pos = apr_atomic_read32(&h->tail);
+    }
+    memcpy((char*)(slot + 1), data, len);
+    slot->len = (apr_uint32_t)len;
+    apr_atomic_xchg32(&slot->seq, pos + 1);
+    return 0;
+}
+
+//! Single consumer only. NULL when the next slot is not published yet.
+static char* q2_shm_ring_pop(q2_shm_ring_t *q, apr_pool_t *mp, apr_size_t *len)
+{
+    char *retv;
+    apr_uint32_t pos;
+    q2_shm_ring_slot_t *slot;
+    q2_shm_ring_head_t *h;
+    *len = 0;
+    if (q == NULL) return NULL;
+    h = q2_shm_ring_head(q);
+    pos = apr_atomic_read32(&h->head);
+    slot = q2_shm_ring_slot(q, pos);
+    if (q2_shm_ring_load(&slot->seq) != pos + 1) return NULL;
+    if ((retv = (char*)apr_palloc(mp, slot->len + 1)) == NULL) return NULL;
+    memcpy(retv, (char*)(slot + 1), slot->len);
+    retv[slot->len] = '\0';
+    *len = slot->len;
+    apr_atomic_set32(&h->head, pos + 1);
+    apr_atomic_xchg32(&slot->seq, pos + q->nslots);
+    return retv;
+}
+
+//! Claimed slots count too, even if not published yet
+static apr_uint32_t q2_shm_ring_count(q2_shm_ring_t *q)
+{
+    q2_shm_ring_head_t *h;
+    if (q == NULL) return 0;
+    h = q2_shm_ring_head(q);
+    return apr_atomic_read32(&h->tail) - apr_atomic_read32(&h->head);
+}
+
 
 #if !defined (Q2DBD) || defined (MYSQL)
 static apr_array_header_t* q2_mysql_tb_name(apr_pool_t *mp,
@@ -632,6 +1496,19 @@ static apr_array_header_t* q2_mysql_tb_name(apr_pool_t *mp,
 }
 #endif
 
+#if !defined (Q2DBD) || defined (MYSQL)
+static apr_array_header_t* q2_mysql_tb_list(apr_pool_t *mp,
+                                            const apr_dbd_driver_t *dbd_drv,
+                                            apr_dbd_t *dbd_hd,
+                                            int *er)
+{
+    const char *pt =
+    "SELECT table_name AS table_name FROM INFORMATION_SCHEMA.tables "
+    "WHERE table_schema=database() AND table_type='BASE TABLE'";
+    return q2_dbd_select(mp, dbd_drv, dbd_hd, pt, er);
+}
+#endif
+
 #if !defined (Q2DBD) || defined (MSSQL)
 static apr_array_header_t* q2_mssql_tb_name(apr_pool_t *mp,
                                             const apr_dbd_driver_t *dbd_drv,
@@ -647,6 +1524,19 @@ static apr_array_header_t* q2_mssql_tb_name(apr_pool_t *mp,
 }
 #endif
 
+#if !defined (Q2DBD) || defined (MSSQL)
+static apr_array_header_t* q2_mssql_tb_list(apr_pool_t *mp,
+                                            const apr_dbd_driver_t *dbd_drv,
+                                            apr_dbd_t *dbd_hd,
+                                            int *er)
+{
+    const char *pt =
+    "SELECT table_name FROM INFORMATION_SCHEMA.tables "
+    "WHERE table_catalog=DB_NAME() AND table_type='BASE TABLE'";
+    return q2_dbd_select(mp, dbd_drv, dbd_hd, pt, er);
+}
+#endif
+
 #if !defined (Q2DBD) || defined (MSSQL)
 static apr_array_header_t* q2_mssql_cl_name(apr_pool_t *mp,
                                             const apr_dbd_driver_t *dbd_drv,
@@ -985,6 +1875,19 @@ static apr_array_header_t* q2_pgsql_tb_name(apr_pool_t *mp,
 }
 #endif
 
+#if !defined (Q2DBD) || defined (PGSQL)
+static apr_array_header_t* q2_pgsql_tb_list(apr_pool_t *mp,
+                                            const apr_dbd_driver_t *dbd_drv,
+                                            apr_dbd_t *dbd_hd,
+                                            int *er)
+{
+    const char *pt =
+    "SELECT table_name FROM INFORMATION_SCHEMA.tables "
+    "WHERE table_schema=current_schema() AND table_type='BASE TABLE'";
+    return q2_dbd_select(mp, dbd_drv, dbd_hd, pt, er);
+}
+#endif
+
 #if !defined (Q2DBD) || defined (PGSQL)
 static apr_array_header_t* q2_pgsql_cl_name(apr_pool_t *mp,
                                             const apr_dbd_driver_t *dbd_drv,
@@ -1149,6 +2052,19 @@ static apr_array_header_t* q2_sqlt3_tb_name(apr_pool_t *mp,
 }
 #endif
 
+#if !defined (Q2DBD) || defined (SQLITE3)
+static apr_array_header_t* q2_sqlt3_tb_list(apr_pool_t *mp,
+                                            const apr_dbd_driver_t *dbd_drv,
+                                            apr_dbd_t *dbd_hd,
+                                            int *er)
+{
+    const char *pt =
+    "SELECT name AS table_name FROM sqlite_master "
+    "WHERE type='table' AND name NOT LIKE 'sqlite_%'";
+    return q2_dbd_select(mp, dbd_drv, dbd_hd, pt, er);
+}
+#endif
+
 #if !defined (Q2DBD) || defined (SQLITE3)
 static apr_array_header_t* q2_sqlt3_cl_name(apr_pool_t *mp,
                                             const apr_dbd_driver_t *dbd_drv,
@@ -1354,23 +2270,91 @@ static int q2_uri_get_pag_offset(apr_pool_t *mp, apr_array_header_t *apr_uri_t)
     return 0;
 }
 
-static apr_array_header_t* q2_uri_get_tabs(apr_pool_t *mp,
-                                           apr_array_header_t *apr_uri_t)
+//! Pops a trailing "/after/<cursor>" from the path and returns the cursor
+static const char* q2_uri_get_pag_cursor(apr_pool_t *mp,
+                                         apr_array_header_t *apr_uri_t)
 {
-    const char *path_i = NULL;
-    apr_array_header_t *retv = NULL;
-    if (apr_uri_t == NULL || apr_uri_t->nelts < 3) return NULL;
-    for (int i = 2; i < apr_uri_t->nelts; i++) {
-        path_i = APR_ARRAY_IDX(apr_uri_t, i, const char*);
-        if (path_i == NULL) continue;
-        if (q2_is_integer(path_i)) continue;
-        if ((i-1) % 2 == 0) continue;
-        if (retv == NULL) {
-            if ((retv = apr_array_make(mp, 0, sizeof(const char*))) == NULL)
-                return NULL;
-        }
-        APR_ARRAY_PUSH(retv, const char*) = path_i;
-    }
+    const char *after_s, *cursor_s;
+    if (apr_uri_t == NULL || apr_uri_t->nelts < 5) return NULL;
+    cursor_s = APR_ARRAY_IDX(apr_uri_t, apr_uri_t->nelts-1, const char*);
+    after_s = APR_ARRAY_IDX(apr_uri_t, apr_uri_t->nelts-2, const char*);
+    if (cursor_s == NULL || after_s == NULL) return NULL;
+    if (strcasecmp(after_s, Q2_PAGINATE_AFTER) != 0) return NULL;
+    apr_array_pop(apr_uri_t);  //! remove the cursor
+    apr_array_pop(apr_uri_t);  //! remove 'after'
+    return cursor_s;
+}
+
+//! Cursor: the key values separated by NUL, in URL-safe unpadded base64
+static const char* q2_cursor_encode(apr_pool_t *mp, apr_array_header_t *vals)
+{
+    int len = 0;
+    char *buf, *p, *out;
+    const char *v;
+    if (vals == NULL || vals->nelts <= 0) return NULL;
+    for (int i = 0; i < vals->nelts; i++) {
+        v = APR_ARRAY_IDX(vals, i, const char*);
+        len += (int)strlen(v == NULL ? "" : v) + 1;
+    }
+    if ((buf = (char*)apr_palloc(mp, len)) == NULL) return NULL;
+    for (int i = 0, n = 0; i < vals->nelts; i++) {
+        v = APR_ARRAY_IDX(vals, i, const char*);
+        n += apr_cpystrn(buf + n, v == NULL ? "" : v, len - n) - (buf + n) + 1;
+    }
+    if ((out = (char*)apr_palloc(mp, apr_base64_encode_len(len-1))) == NULL)
+        return NULL;
+    apr_base64_encode(out, buf, len-1);
+    for (p = out; *p; p++) {
+        if (*p == '+') *p = '-';
+        else if (*p == '/') *p = '_';
+        else if (*p == '=') *p = '\0';
+    }
+    return out;
+}
+
+static apr_array_header_t* q2_cursor_decode(apr_pool_t *mp, const char *s)
+{
+    int len;
+    char *tmp, *buf, *p;
+    apr_array_header_t *vals;
+    if (s == NULL || *s == '\0') return NULL;
+    len = (int)strlen(s);
+    if ((tmp = (char*)apr_pcalloc(mp, len + 4)) == NULL) return NULL;
+    for (int i = 0; i < len; i++) {
+        if (s[i] == '-') tmp[i] = '+';
+        else if (s[i] == '_') tmp[i] = '/';
+        else if (isalnum((unsigned char)s[i])) tmp[i] = s[i];
+        else return NULL;
+    }
+    while (len % 4) tmp[len++] = '=';
+    if ((buf = (char*)apr_palloc(mp, apr_base64_decode_len(tmp) + 1)) == NULL)
+        return NULL;
+    len = apr_base64_decode(buf, tmp);
+    buf[len] = '\0';
+    if ((vals = apr_array_make(mp, 1, sizeof(const char*))) == NULL)
+        return NULL;
+    for (p = buf; p <= buf + len; p += strlen(p) + 1)
+        APR_ARRAY_PUSH(vals, const char*) = p;
+    return vals;
+}
+
+static apr_array_header_t* q2_uri_get_tabs(apr_pool_t *mp,
+                                           apr_array_header_t *apr_uri_t)
+{
+    const char *path_i = NULL;
+    apr_array_header_t *retv = NULL;
+    if (apr_uri_t == NULL || apr_uri_t->nelts < 3) return NULL;
+    for (int i = 2; i < apr_uri_t->nelts; i++) {
+        path_i = APR_ARRAY_IDX(apr_uri_t, i, const char*);
+        if (path_i == NULL) continue;
+        if (q2_is_integer(path_i)) continue;
+        if ((i-1) % 2 == 0) continue;
+        if (retv == NULL) {
+            if ((retv = apr_array_make(mp, 0, sizeof(const char*))) == NULL)
+                return NULL;
+        }
+        APR_ARRAY_PUSH(retv, const char*) = path_i;
+    }
     return retv;
 }
 
@@ -1583,6 +2567,163 @@ static const char* q2_ischema_get_target_table(q2_t *q2, int rel)
     }
     return NULL;
 }
+static q2_graph_node_t* q2_graph_get_node(q2_graph_t *g, const char *tab)
+{
+    if (g == NULL || tab == NULL) return NULL;
+    return (q2_graph_node_t*)apr_hash_get(g->nodes, tab, APR_HASH_KEY_STRING);
+}
+
+//! Loads tables, columns, primary and foreign keys in one pass: q2->pool
+//! holds the catalog recordsets, the graph itself is allocated from mp.
+static q2_graph_t* q2_graph_build(q2_t *q2, apr_pool_t *mp)
+{
+    int er = 0;
+    const char *tname, *v;
+    apr_array_header_t *tabs, *rset;
+    q2_graph_t *g;
+    q2_graph_node_t *node, *ref;
+    q2_graph_fk_t *fk;
+    if (q2->tb_list_fn == NULL) return NULL;
+    tabs = q2->tb_list_fn(q2->pool, q2->dbd_driver, q2->dbd_handle, &er);
+    if (er || tabs == NULL) return NULL;
+    if ((g = (q2_graph_t*)apr_palloc(mp, sizeof(q2_graph_t))) == NULL)
+        return NULL;
+    g->pool = mp;
+    g->nodes = apr_hash_make(mp);
+    for (int i = 0; i < tabs->nelts; i++) {
+        if ((tname = q2_dbd_get_value(tabs, i, "table_name")) == NULL) continue;
+        node = (q2_graph_node_t*)apr_pcalloc(mp, sizeof(q2_graph_node_t));
+        if (node == NULL) return NULL;
+        node->name = apr_pstrdup(mp, tname);
+        node->pks = apr_array_make(mp, 1, sizeof(const char*));
+        node->fks = apr_array_make(mp, 0, sizeof(q2_graph_fk_t*));
+        node->refd_by = apr_array_make(mp, 0, sizeof(const char*));
+        node->columns = apr_hash_make(mp);
+        rset = q2->cl_attr_fn(q2->pool, q2->dbd_driver, q2->dbd_handle,
+                              tname, &er);
+        if (er) return NULL;
+        for (int j = 0; rset != NULL && j < rset->nelts; j++) {
+            if ((v = q2_dbd_get_value(rset, j, "column_name")) == NULL)
+                continue;
+            v = apr_pstrdup(mp, v);
+            apr_hash_set(node->columns, v, APR_HASH_KEY_STRING, v);
+        }
+        rset = q2->pk_attr_fn(q2->pool, q2->dbd_driver, q2->dbd_handle,
+                              tname, &er);
+        if (er) return NULL;
+        for (int j = 0; rset != NULL && j < rset->nelts; j++) {
+            if ((v = q2_dbd_get_value(rset, j, "column_name")) == NULL)
+                continue;
+            APR_ARRAY_PUSH(node->pks, const char*) = apr_pstrdup(mp, v);
+        }
+        rset = q2->fk_attr_fn(q2->pool, q2->dbd_driver, q2->dbd_handle,
+                              tname, &er);
+        if (er) return NULL;
+        for (int j = 0; rset != NULL && j < rset->nelts; j++) {
+            v = q2_dbd_get_value(rset, j, "referenced_table");
+            if (v == NULL || q2_dbd_get_value(rset, j, "column_name") == NULL)
+                continue;
+            fk = (q2_graph_fk_t*)apr_palloc(mp, sizeof(q2_graph_fk_t));
+            if (fk == NULL) return NULL;
+            fk->ref_table = apr_pstrdup(mp, v);
+            fk->column = apr_pstrdup(mp,
+                                     q2_dbd_get_value(rset, j, "column_name"));
+            v = q2_dbd_get_value(rset, j, "referenced_column");
+            fk->ref_column = v == NULL ? NULL : apr_pstrdup(mp, v);
+            APR_ARRAY_PUSH(node->fks, q2_graph_fk_t*) = fk;
+        }
+        apr_hash_set(g->nodes, node->name, APR_HASH_KEY_STRING, node);
+    }
+    for (apr_hash_index_t *hi = apr_hash_first(mp, g->nodes);
+         hi != NULL; hi = apr_hash_next(hi)) {
+        node = (q2_graph_node_t*)apr_hash_this_val(hi);
+        for (int i = 0; i < node->fks->nelts; i++) {
+            fk = APR_ARRAY_IDX(node->fks, i, q2_graph_fk_t*);
+            ref = q2_graph_get_node(g, fk->ref_table);
+            if (ref == NULL || ref == node) continue;
+            if (ref->refd_by->nelts > 0 &&
+                strcmp(APR_ARRAY_IDX(ref->refd_by, ref->refd_by->nelts-1,
+                                     const char*), node->name) == 0)
+                continue;
+            APR_ARRAY_PUSH(ref->refd_by, const char*) = node->name;
+        }
+        node->is_11 = node->pks->nelts > 0 &&
+                      node->pks->nelts == node->fks->nelts;
+        for (int i = 0; node->is_11 && i < node->pks->nelts; i++) {
+            int found = 0;
+            v = APR_ARRAY_IDX(node->pks, i, const char*);
+            for (int j = 0; j < node->fks->nelts; j++) {
+                fk = APR_ARRAY_IDX(node->fks, j, q2_graph_fk_t*);
+                if (strcmp(v, fk->column) == 0) found = 1;
+            }
+            node->is_11 = found;
+        }
+    }
+    return g;
+}
+
+static int q2_graph_count_refs(q2_t *q2, q2_graph_node_t *node, int n)
+{
+    int count = 0;
+    q2_graph_fk_t *fk;
+    for (int i = 0; i < node->fks->nelts; i++) {
+        fk = APR_ARRAY_IDX(node->fks, i, q2_graph_fk_t*);
+        if (strcmp(fk->ref_table, node->name) == 0) continue;
+        for (int j = 0; j < n; j ++)
+            if (strcmp(fk->ref_table,
+                       APR_ARRAY_IDX(q2->uri_tables, j, const char*)) == 0)
+                count ++;
+    }
+    return count;
+}
+
+//! In-memory equivalent of the Q2_RL_11REL, Q2_RL_1MREL, Q2_RL_MMREL and
+//! plain q2_ischema_get_target_table() probes, in the same order.
+static const char* q2_graph_get_target_table(q2_t *q2)
+{
+    int n;
+    q2_graph_node_t *last, *node;
+    if (q2->graph == NULL || q2->uri_tables == NULL) return NULL;
+    if ((n = q2->uri_tables->nelts) <= 0) return NULL;
+    if (n <= 1) {
+        node = q2_graph_get_node(q2->graph,
+                                 APR_ARRAY_IDX(q2->uri_tables, 0, const char*));
+        return node == NULL ? NULL : node->name;
+    }
+    last = q2_graph_get_node(q2->graph,
+                             APR_ARRAY_IDX(q2->uri_tables, n-1, const char*));
+    if (last != NULL) {
+        if (last->is_11 &&
+            q2_graph_count_refs(q2, last, n-1) == last->fks->nelts) {
+            q2->tab_relation = Q2_RL_11REL;
+            return last->name;
+        }
+        if (q2_graph_count_refs(q2, last, n) == n-1) {
+            q2->tab_relation = Q2_RL_1MREL;
+            return last->name;
+        }
+        for (int i = 0; i < last->refd_by->nelts; i++) {
+            node = q2_graph_get_node(q2->graph,
+                                     APR_ARRAY_IDX(last->refd_by, i,
+                                                   const char*));
+            if (node == NULL || node->fks->nelts != n) continue;
+            if (q2_graph_count_refs(q2, node, n) != n) continue;
+            q2->tab_relation = Q2_RL_MMREL;
+            return node->name;
+        }
+    }
+    node = q2_graph_get_node(q2->graph,
+                             APR_ARRAY_IDX(q2->uri_tables, 0, const char*));
+    if (node == NULL) return NULL;
+    if (apr_hash_get(node->columns, APR_ARRAY_IDX(q2->uri_tables, 1,
+                                                  const char*),
+                     APR_HASH_KEY_STRING) == NULL) return NULL;
+    q2->column = apr_pstrdup(q2->pool,
+                             APR_ARRAY_IDX(q2->uri_tables, 1, const char*));
+    apr_array_pop(q2->uri_tables);
+    return node->name;
+}
+
 static apr_array_header_t* q2_ischema_get_col_attrs(q2_t *q2, const char *tab)
 {
     int er = 0;
@@ -1633,6 +2774,8 @@ static apr_array_header_t* q2_ischema_get_refs_attrs(q2_t *q2, const char *tab)
 static int q2_ischema_update_attrs(q2_t *q2)
 {
     const char *c_name, *c_pk_name, *c_uns_name, *c_rf_name;
+    //! q2->columns is built from the attributes afterwards
+    if (q2->attributes == NULL) return 1;
     for (int i = 0; i < q2->attributes->nelts; i++) {
         c_name = q2_dbd_get_value(q2->attributes, i, "column_name");
         if (c_name == NULL) continue;
@@ -1695,30 +2838,142 @@ static int q2_ischema_update_attrs(q2_t *q2)
     return 0;
 }
 
+static unsigned short q2_columns_flag(apr_table_t *t, const char *k,
+                                      unsigned short flag)
+{
+    const char *v = apr_table_get(t, k);
+    return (unsigned short)(v != NULL && atoi(v) ? flag : 0);
+}
+
+static const char* q2_columns_ref(apr_table_t *t, const char *k)
+{
+    const char *v = apr_table_get(t, k);
+    if (v == NULL || *v == '\0' || strcasecmp(v, "null") == 0) return NULL;
+    return v;
+}
+
+static apr_array_header_t* q2_columns_make(apr_pool_t *mp,
+                                           apr_array_header_t *attrs)
+{
+    apr_table_t *t;
+    q2_column_t *c;
+    apr_array_header_t *cols;
+    if (attrs == NULL) return NULL;
+    cols = apr_array_make(mp, attrs->nelts, sizeof(q2_column_t));
+    if (cols == NULL) return NULL;
+    for (int i = 0; i < attrs->nelts; i++) {
+        if ((t = APR_ARRAY_IDX(attrs, i, apr_table_t*)) == NULL) continue;
+        c = (q2_column_t*)apr_array_push(cols);
+        c->table = apr_table_get(t, "table_name");
+        c->name = apr_table_get(t, "column_name");
+        c->flags = q2_columns_flag(t, "is_primary_key", Q2_COL_PK) |
+                   q2_columns_flag(t, "is_foreign_key", Q2_COL_FK) |
+                   q2_columns_flag(t, "is_numeric", Q2_COL_NUMERIC) |
+                   q2_columns_flag(t, "is_date", Q2_COL_DATE) |
+                   q2_columns_flag(t, "is_nullable", Q2_COL_NULLABLE) |
+                   q2_columns_flag(t, "is_auto_increment",
+                                   Q2_COL_AUTO_INCREMENT) |
+                   q2_columns_flag(t, "is_unsigned", Q2_COL_UNSIGNED) |
+                   q2_columns_flag(t, "is_boolean", Q2_COL_BOOLEAN) |
+                   q2_columns_flag(t, "is_referenced_pk_multi",
+                                   Q2_COL_REF_PK_MULTI);
+        if (c->flags & Q2_COL_BOOLEAN) c->type = Q2_CT_BOOLEAN;
+        else if (c->flags & Q2_COL_NUMERIC) c->type = Q2_CT_NUMERIC;
+        else if (c->flags & Q2_COL_DATE) c->type = Q2_CT_DATE;
+        else c->type = Q2_CT_STRING;
+        c->charset = c->flags & (Q2_COL_NUMERIC | Q2_COL_DATE)
+            ? NULL
+            : apr_table_get(t, "character_set_name");
+        c->ref_table = q2_columns_ref(t, "referenced_table");
+        c->ref_column = q2_columns_ref(t, "referenced_column");
+    }
+    return cols;
+}
+
+static apr_array_header_t* q2_ischema_cache_get(q2_t *q2, const char *tab)
+{
+    char *data;
+    apr_size_t len;
+    if (q2->schema_cache == NULL || tab == NULL) return NULL;
+    data = q2_shm_cache_get(q2->schema_cache, q2->pool, tab, &len);
+    if (data == NULL) return NULL;
+    return q2_dbd_unserialize(q2->pool, data, len);
+}
+
+static int q2_ischema_cache_set(q2_t *q2, const char *tab)
+{
+    char *data;
+    apr_size_t len;
+    static volatile apr_uint32_t logged = 0;
+    if (q2->schema_cache == NULL || tab == NULL) return 1;
+    data = q2_dbd_serialize(q2->pool, q2->attributes, &len);
+    if (data == NULL) return 1;
+    //! the table is read from the database at every request, said once
+    if (len > q2->schema_cache->slot_size) {
+#ifdef _APMOD
+        if (q2->r_rec != NULL && apr_atomic_cas32(&logged, 1, 0) == 0)
+            ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, q2->r_rec,
+                          "q2: the metadata of %s (%" APR_SIZE_T_FMT
+                          " bytes) exceed Q2SchemaCacheSlotSize, it is not "
+                          "cached", tab, len);
+#endif
+        return 1;
+    }
+    return q2_shm_cache_set(q2->schema_cache, tab, data, len, q2->schema_ttl);
+}
+
+static int q2_ischema_cache_invalidate(q2_t *q2, const char *tab)
+{
+    if (q2->schema_cache == NULL) return 1;
+    if (tab == NULL) return q2_shm_cache_clear(q2->schema_cache);
+    return q2_shm_cache_remove(q2->schema_cache, tab);
+}
+
+//! Rebuilds the pk_attr_fn() recordset from merged (cached) attributes
+static apr_array_header_t* q2_ischema_pk_attrs_from_cache(q2_t *q2)
+{
+    q2_column_t *c;
+    apr_table_t *t;
+    apr_array_header_t *retv = NULL;
+    for (int i = 0; i < q2->columns->nelts; i++) {
+        c = q2_column(q2->columns, i);
+        if (!(c->flags & Q2_COL_PK) || c->name == NULL) continue;
+        if (retv == NULL) {
+            retv = apr_array_make(q2->pool, 1, sizeof(apr_table_t*));
+            if (retv == NULL) return NULL;
+        }
+        if ((t = apr_table_make(q2->pool, 1)) == NULL) return NULL;
+        apr_table_setn(t, "column_name", c->name);
+        APR_ARRAY_PUSH(retv, apr_table_t*) = t;
+    }
+    return retv;
+}
+
 static int q2_ischema_update_options_attr(q2_t*q2)
 {
     int fk, ref_pk_multi, k;
     const char *ref_schema, *ref_table, *ref_column, *ref_pk, *ref_pk_arr_item;
     apr_array_header_t *qs_cmps, *ref_pk_arr;
     char *qs, *col_opt_uri;
+    q2_column_t *c;
     if (q2->attributes == NULL || q2->attributes->nelts <= 0) return 1;
+    if (q2->columns == NULL) return 1;
     qs_cmps = NULL;
-    for (int i = 0; i < q2->attributes->nelts; i++) {
+    for (int i = 0; i < q2->columns->nelts; i++) {
+        c = q2_column(q2->columns, i);
+        fk = c->flags & Q2_COL_FK;
+        if (!fk || c->ref_table == NULL || c->ref_column == NULL) continue;
         ref_schema = q2_dbd_get_value(q2->attributes, i, "referenced_schema");
-        ref_table = q2_dbd_get_value(q2->attributes, i, "referenced_table");
-        ref_column = q2_dbd_get_value(q2->attributes, i, "referenced_column");
         ref_pk = q2_dbd_get_value(q2->attributes, i, "referenced_pk");
-        fk  = atoi(q2_dbd_get_value(q2->attributes, i, "is_foreign_key"));
-        ref_pk_multi = atoi(q2_dbd_get_value(q2->attributes,
-                                             i, "is_referenced_pk_multi"));
+        if (ref_schema == NULL || ref_pk == NULL) continue;
+        ref_table = c->ref_table;
+        ref_column = c->ref_column;
+        ref_pk_multi = c->flags & Q2_COL_REF_PK_MULTI;
         if (q2->r_others != NULL &&
             (apr_table_elts(q2->r_others))->nelts > 0 &&
-            fk &&
             ref_pk_multi &&
             strcmp(ref_pk, "null") &&
-            strcmp(ref_schema, "null") &&
-            strcmp(ref_table, "null") &&
-            strcmp(ref_column, "null")) {
+            strcmp(ref_schema, "null")) {
             qs_cmps = apr_array_make(q2->pool, 0, sizeof(void*));
             ref_pk_arr = q2_split(q2->pool, (char*)ref_pk, ",");
             k = 0;
@@ -1746,10 +3001,7 @@ static int q2_ischema_update_options_attr(q2_t*q2)
                                  "column_options", col_opt_uri);
             }
         } 
-        else if (fk &&
-                 strcmp(ref_schema, "null") &&
-                 strcmp(ref_table, "null") &&
-                 strcmp(ref_column, "null")) {
+        else if (strcmp(ref_schema, "null")) {
             col_opt_uri = apr_pstrcat(q2->pool, "/",
                                       ref_table, "/", ref_column, NULL);
             if (col_opt_uri == NULL) return 1;
@@ -1783,10 +3035,10 @@ static apr_table_t* q2_request_parse_params(q2_t* q2)
     int err;
     const char *ckey, *cval;
     apr_table_t *r_params_merge, *retv;
-    if (q2->attributes == NULL || q2->request_params == NULL) return NULL;
+    if (q2->columns == NULL || q2->request_params == NULL) return NULL;
     if ((retv = apr_table_make(q2->pool, 0)) == NULL) return NULL;
-    for (int i = 0; i < q2->attributes->nelts; i++) {
-        ckey = q2_dbd_get_value(q2->attributes, i, "column_name");
+    for (int i = 0; i < q2->columns->nelts; i++) {
+        ckey = q2_column(q2->columns, i)->name;
         if (ckey == NULL) continue;
         cval = apr_table_get(q2->request_params, ckey);
         if (cval == NULL) continue;
@@ -1817,55 +3069,145 @@ static apr_table_t* q2_request_parse_params(q2_t* q2)
     return retv;
 }
 
+//! Values never reach the SQL text: each one is stored in q2->sql_binds and
+//! replaced by a marker that q2_sql_template() turns into a placeholder.
+static const char* q2_sql_bind(q2_t *q2, const char *val)
+{
+    if (val == NULL) return NULL;
+    if (q2->sql_binds == NULL) {
+        q2->sql_binds = apr_array_make(q2->pool, 4, sizeof(const char*));
+        if (q2->sql_binds == NULL) return NULL;
+    }
+    APR_ARRAY_PUSH(q2->sql_binds, const char*) = val;
+    return apr_psprintf(q2->pool, "%c%d%c", Q2_SQL_ARG_MARK,
+                        q2->sql_binds->nelts-1, Q2_SQL_ARG_MARK);
+}
+
+//! Rewrites the markers in textual order as apr_dbd "%s" placeholders and
+//! collects the matching argument vector into args.
+static const char* q2_sql_template(q2_t *q2, const char *sql,
+                                   apr_array_header_t **args)
+{
+    int idx;
+    const char *p;
+    char *out, *o;
+    if (sql == NULL) return NULL;
+    (*args) = apr_array_make(q2->pool, 4, sizeof(const char*));
+    if ((*args) == NULL) return NULL;
+    if ((out = (char*)apr_palloc(q2->pool, strlen(sql)*2+1)) == NULL)
+        return NULL;
+    for (p = sql, o = out; *p; p++) {
+        if (*p == '%') {
+            *o++ = '%';
+            *o++ = '%';
+        } else if (*p == Q2_SQL_ARG_MARK) {
+            idx = atoi(++p);
+            while (*p && *p != Q2_SQL_ARG_MARK) p++;
+            if (*p == '\0') return NULL;
+            if (q2->sql_binds == NULL || idx < 0 || idx >= q2->sql_binds->nelts)
+                return NULL;
+            APR_ARRAY_PUSH((*args), const char*) =
+                APR_ARRAY_IDX(q2->sql_binds, idx, const char*);
+            *o++ = '%';
+            *o++ = 's';
+        } else {
+            *o++ = *p;
+        }
+    }
+    *o = '\0';
+    return out;
+}
+
+//! Name of the next statement of a per connection cache. Entries are never
+//! removed, so the count is unique within the connection. Named statements
+//! are prepared on the server (pgsql), unnamed ones are parsed again.
+static const char* q2_sql_label(apr_pool_t *mp, apr_hash_t *cache)
+{
+    return apr_psprintf(mp, Q2_STMT_LABEL, apr_hash_count(cache));
+}
+
+//! Prepared statements are kept per connection, keyed by their template,
+//! which already encodes the route shape and the set of filtered columns.
+static apr_dbd_prepared_t* q2_sql_prepare(q2_t *q2, const char *tpl)
+{
+    int cache;
+    apr_dbd_prepared_t *stmt = NULL;
+    if (tpl == NULL) return NULL;
+    cache = q2->stmt_cache != NULL && q2->stmt_pool != NULL;
+    if (cache) {
+        stmt = apr_hash_get(q2->stmt_cache, tpl, APR_HASH_KEY_STRING);
+        if (stmt != NULL) return stmt;
+        cache = apr_hash_count(q2->stmt_cache) < Q2_STMT_CACHE_MAX;
+    }
+    q2->error = apr_dbd_prepare(q2->dbd_driver,
+                                cache ? q2->stmt_pool : q2->pool,
+                                q2->dbd_handle, tpl,
+                                cache
+                                    ? q2_sql_label(q2->pool, q2->stmt_cache)
+                                    : NULL,
+                                &stmt);
+    if (q2->error) return NULL;
+    if (cache)
+        apr_hash_set(q2->stmt_cache, apr_pstrdup(q2->stmt_pool, tpl),
+                     APR_HASH_KEY_STRING, stmt);
+    return stmt;
+}
+
+static apr_array_header_t* q2_sql_exec_select(q2_t *q2, const char *tpl,
+                                              apr_array_header_t *args)
+{
+    apr_dbd_prepared_t *stmt;
+    if ((stmt = q2_sql_prepare(q2, tpl)) == NULL) return NULL;
+    return q2_dbd_pselect(q2->pool, q2->dbd_driver, q2->dbd_handle,
+                          stmt, args, &q2->error);
+}
+
+static apr_dbd_results_t* q2_sql_exec_stream(q2_t *q2, const char *tpl,
+                                             apr_array_header_t *args)
+{
+    apr_dbd_prepared_t *stmt;
+    if ((stmt = q2_sql_prepare(q2, tpl)) == NULL) return NULL;
+    return q2_dbd_presults(q2->pool, q2->dbd_driver, q2->dbd_handle,
+                           stmt, args, &q2->error);
+}
+
+static int q2_sql_exec_query(q2_t *q2, const char *tpl,
+                             apr_array_header_t *args)
+{
+    apr_dbd_prepared_t *stmt;
+    if ((stmt = q2_sql_prepare(q2, tpl)) == NULL) return -1;
+    return q2_dbd_pquery(q2->pool, q2->dbd_driver, q2->dbd_handle,
+                         stmt, args, &q2->error);
+}
+
 static const char* q2_sql_encode_value(q2_t *q2,
-                                       apr_table_t *attrs,
+                                       const q2_column_t *col,
                                        const char *val)
 {
-    unsigned char is_mysql = 0, is_numeric = 0, is_date = 0;
     size_t value_len = 0;
-    const char *dbd_driver_name, *character_set_name;
     char *tmp_v;
-    if (val == NULL) return NULL;
-    is_mysql = q2->dbd_server_type == Q2_DBD_MYSQL;
-    is_numeric = (unsigned char)atoi(apr_table_get(attrs, "is_numeric"));
-    is_date = (unsigned char)atoi(apr_table_get(attrs, "is_date"));
-    character_set_name = NULL;
-    if (!is_numeric && !is_date)
-        character_set_name = apr_table_get(attrs, "character_set_name");
+    if (val == NULL || col == NULL) return NULL;
     tmp_v = apr_pstrdup(q2->pool, val);
     value_len = strlen(val);
     for (int i = 0; i < value_len; i++)
         if (tmp_v[i] == '*') tmp_v[i] = '%';
-    if (is_numeric || q2_is_null_s(tmp_v))
-        return apr_psprintf(q2->pool, "%s", tmp_v);
-    return apr_psprintf(q2->pool,
-                        is_mysql && character_set_name != NULL
-                            ? "_%s'%s'"
-                            : "%s'%s'",
-                        is_mysql
-                            ? (character_set_name == NULL
-                                ? ""
-                                : character_set_name)
-                            : "",
-                        apr_dbd_escape(q2->dbd_driver,
-                                       q2->pool, tmp_v, q2->dbd_handle));
-}
-
-static const char* q2_sql_parse_value(q2_t *q2, apr_table_t *attrs,
+    if (q2_is_null_s(tmp_v)) return apr_pstrdup(q2->pool, "NULL");
+    return q2_sql_bind(q2, tmp_v);
+}
+
+static const char* q2_sql_parse_value(q2_t *q2, const q2_column_t *attrs,
                                       const char *key, const char *val,
                                       apr_array_header_t **order_by)
 {
-    unsigned char is_numeric = 0, is_date = 0;
+    unsigned char is_date = 0;
     size_t value_len = 0;
     const char *value_v = NULL, *parsed_v = NULL, *encoded_v = NULL;
     const char *character_set_name = NULL, *filter = NULL;
     apr_array_header_t *splitted_v = NULL, *range_toks = NULL, *set_toks = NULL;
     char ptt[32] = {0};
     if (attrs == NULL || key == NULL || val == NULL) return NULL;
-    is_numeric = (unsigned char)atoi(apr_table_get(attrs, "is_numeric"));
-    is_date = (unsigned char)atoi(apr_table_get(attrs, "is_date"));
-    if (!is_numeric && !is_date)
-        character_set_name = apr_table_get(attrs, "character_set_name");
+    is_date = (unsigned char)((attrs->flags & Q2_COL_DATE) != 0);
+    character_set_name = attrs->charset;
     splitted_v = q2_split(q2->pool, (char*)val, ":");
     if (splitted_v == NULL) return NULL;
     if (splitted_v->nelts > 1) {
@@ -1962,16 +3304,13 @@ static const char* q2_sql_key_conds(q2_t *q2)
             for (int i = 0; i < q2->uri_tables->nelts-1; i++) {
                 curr_uri_tab = APR_ARRAY_IDX(q2->uri_tables, i, const char*);
                 if (curr_uri_tab == NULL) continue;
-                for (int j = 0; j < q2->attributes->nelts; j ++) {
-                    ref_table = q2_dbd_get_value(q2->attributes,
-                                                 j, "referenced_table");
+                for (int j = 0; j < q2->columns->nelts; j ++) {
+                    ref_table = q2_column(q2->columns, j)->ref_table;
                     if (ref_table == NULL) continue;
                     if (strcmp(curr_uri_tab, ref_table) != 0) continue;
-                    const char *is_pk = q2_dbd_get_value(q2->attributes,
-                                                         j, "is_primary_key");
-                    if (is_pk == NULL || !(unsigned char)atoi(is_pk)) continue;
-                    pk_name = q2_dbd_get_value(q2->attributes,
-                                               j, "column_name");
+                    if (!(q2_column(q2->columns, j)->flags & Q2_COL_PK))
+                        continue;
+                    pk_name = q2_column(q2->columns, j)->name;
                     if (pk_name == NULL) continue;
                     pk_val = APR_ARRAY_IDX(q2->uri_keys, i, const char*);
                     if (pk_val == NULL) continue;
@@ -1979,21 +3318,18 @@ static const char* q2_sql_key_conds(q2_t *q2)
                         pk_conds = apr_array_make(q2->pool,
                                                   1, sizeof(const char*));
                     APR_ARRAY_PUSH(pk_conds, const char*) =
-                        apr_psprintf(q2->pool,
-                                     q2_is_integer(pk_val)
-                                        ? "(%s=%s)"
-                                        : "(%s='%s')",
-                                     pk_name, pk_val);
+                        apr_psprintf(q2->pool, "(%s=%s)",
+                                     pk_name, q2_sql_bind(q2, pk_val));
                 }
             }
         }
         else if (q2->uri_tables->nelts == 1) {
-            for (int i = 0; i < q2->attributes->nelts; i++) {
-                const char *is_pk = q2_dbd_get_value(q2->attributes,
-                                                     0, "is_primary_key");
-                if (is_pk == NULL || !(unsigned char)atoi(is_pk)) continue;
-                pk_name = q2_dbd_get_value(q2->attributes, 0, "column_name");
+            pk_name = NULL;
+            for (int i = 0; i < q2->columns->nelts; i++) {
+                if (!(q2_column(q2->columns, i)->flags & Q2_COL_PK)) continue;
+                pk_name = q2_column(q2->columns, i)->name;
                 if (pk_name == NULL) return NULL;
+                break;
             }
             if(pk_name == NULL) return NULL;
             pk_val = APR_ARRAY_IDX(q2->uri_keys, 0, const char*);
@@ -2002,9 +3338,8 @@ static const char* q2_sql_key_conds(q2_t *q2)
                 pk_conds = apr_array_make(q2->pool, 1, sizeof(const char*));
 
             APR_ARRAY_PUSH(pk_conds, const char*) =
-                apr_psprintf(q2->pool,
-                             q2_is_integer(pk_val) ? "(%s=%s)" : "(%s='%s')",
-                             pk_name, pk_val);
+                apr_psprintf(q2->pool, "(%s=%s)",
+                             pk_name, q2_sql_bind(q2, pk_val));
         }
         if (pk_conds != NULL) {
             pk_conds_s = q2_join(q2->pool, pk_conds, " AND ");
@@ -2015,13 +3350,14 @@ static const char* q2_sql_key_conds(q2_t *q2)
     return NULL;
 }
 
-static int q2_count_rows(q2_t* q2, const char *sql)
+//! A failed count is not an error of the request, nor does it hide one
+static int q2_count_query(q2_t* q2, const char *sql_c)
 {
-    int er;
-    const char *qry = "select count(*) as c from (%s) as t";
-    const char *sql_c = apr_psprintf(q2->pool, qry, sql);
-    apr_array_header_t *res = q2_dbd_select(q2->pool, q2->dbd_driver,
-                                            q2->dbd_handle, sql_c, &er);
+    int error = q2->error;
+    apr_array_header_t *args, *res;
+    if ((sql_c = q2_sql_template(q2, sql_c, &args)) == NULL) return 0;
+    res = q2_sql_exec_select(q2, sql_c, args);
+    q2->error = error;
     if (res != NULL && res->nelts > 0) {
         apr_table_t *tab = APR_ARRAY_IDX(res, 0, apr_table_t*);
         if (tab != NULL) {
@@ -2034,48 +3370,206 @@ static int q2_count_rows(q2_t* q2, const char *sql)
     return 0;
 }
 
-static const char* q2_sql_select_tab(q2_t *q2)
+static int q2_count_rows(q2_t* q2, const char *sql)
 {
-    const char *sql, *limit;
-    unsigned char ok = (unsigned char)(q2->uri_tables != NULL &&
-                                       q2->uri_tables->nelts == 1 &&
-                                       q2->uri_keys == NULL &&
-                                       q2->table != NULL &&
-                                       q2->column == NULL &&
-                                       q2->r_params == NULL);
-    if(!ok) return NULL;
-    limit = NULL;
-    if (q2->dbd_server_type == Q2_DBD_MSSQL) {
-        const char *pk_name = NULL;
-        for (int i = 0; i < q2->attributes->nelts; i++) {
-            int is_pk = (unsigned char)atoi(q2_dbd_get_value(q2->attributes,
-                                                             i,
-                                                             "is_primary_key"));
-            if (is_pk) pk_name = q2_dbd_get_value(q2->attributes,
-                                                  i, "column_name");
+    const char *qry = "select count(*) as c from (%s) as t";
+    return q2_count_query(q2, apr_psprintf(q2->pool, qry, sql));
+}
+
+//! Row count from the planner statistics, only for unfiltered tables
+static int q2_count_estimate(q2_t *q2)
+{
+    int count;
+    const char *qry = NULL;
+    if (q2->dbd_server_type == Q2_DBD_PGSQL)
+        qry = "SELECT CAST(c.reltuples AS bigint) AS c FROM pg_class c "
+              "JOIN pg_namespace n ON n.oid=c.relnamespace "
+              "WHERE n.nspname=current_schema() AND c.relname=%s";
+    if (q2->dbd_server_type == Q2_DBD_MYSQL)
+        qry = "SELECT table_rows AS c FROM INFORMATION_SCHEMA.tables "
+              "WHERE table_schema=database() AND table_name=%s";
+    if (q2->dbd_server_type == Q2_DBD_MSSQL)
+        qry = "SELECT SUM(row_count) AS c FROM sys.dm_db_partition_stats "
+              "WHERE object_id=OBJECT_ID(%s) AND index_id<2";
+    if (qry == NULL) return 0;
+    count = q2_count_query(q2, apr_psprintf(q2->pool, qry,
+                                            q2_sql_bind(q2, q2->table)));
+    return count < 0 ? 0 : count;
+}
+
+//! COUNT(*) OVER() needs MySQL 8, MariaDB 10.2 or SQLite 3.25
+static int q2_count_window_supported(q2_t *q2)
+{
+    int major, minor;
+    const char *v;
+    if (q2->dbd_server_type == Q2_DBD_PGSQL ||
+        q2->dbd_server_type == Q2_DBD_MSSQL) return 1;
+    if ((v = q2->dbd_server_version) == NULL) return 0;
+    major = atoi(v);
+    minor = (v = strchr(v, '.')) == NULL ? 0 : atoi(v + 1);
+    if (q2->dbd_server_type == Q2_DBD_SQLT3)
+        return major > 3 || (major == 3 && minor >= 25);
+    if (q2->dbd_server_type == Q2_DBD_MYSQL)
+        return (major >= 8 && major < 10) || major > 10 ||
+               (major == 10 && minor >= 2);
+    return 0;
+}
+
+//! Resolves the requested count mode against what the server and the
+//! query allow: window falls back to exact, estimated to none.
+static int q2_count_mode(q2_t *q2)
+{
+    switch (q2->count_mode)
+    {
+    case Q2_COUNT_WINDOW:
+        //! the cursor condition would hide the rows of previous pages
+        return q2_count_window_supported(q2) && q2->pagination_after == NULL
+            ? Q2_COUNT_WINDOW
+            : Q2_COUNT_EXACT;
+    case Q2_COUNT_ESTIMATED:
+        return q2->r_params == NULL &&
+               q2->pagination_ppg &&
+               q2->dbd_server_type != Q2_DBD_SQLT3
+            ? Q2_COUNT_ESTIMATED
+            : Q2_COUNT_NONE;
+    case Q2_COUNT_NONE:
+        return Q2_COUNT_NONE;
+    }
+    return Q2_COUNT_EXACT;
+}
+
+//! Enables keyset pagination on the primary key when requested, either by
+//! configuration or by a cursor in the URI. pk_order is 0 for lists with an
+//! explicit ORDER BY, which keep using offsets. Returns 1 on an invalid
+//! cursor, or a cursor the list cannot follow.
+static int q2_sql_keyset(q2_t *q2, int pk_order)
+{
+    q2->pagination_keyset = 0;
+    if (q2->pagination_cursor == NULL &&
+        (!q2->pagination_ppg || !pk_order ||
+         q2->pagination_mode != Q2_PAGINATE_CURSOR))
+        return 0;
+    if (!q2->pagination_ppg || !pk_order) {
+        q2_log_error(q2, "%s", "Invalid pagination cursor");
+        return 1;
+    }
+    q2->pagination_keys = apr_array_make(q2->pool, 1, sizeof(const char*));
+    if (q2->pagination_keys == NULL) return 1;
+    for (int i = 0; i < q2->columns->nelts; i++)
+        if (q2_column(q2->columns, i)->flags & Q2_COL_PK)
+            APR_ARRAY_PUSH(q2->pagination_keys, const char*) =
+                q2_column(q2->columns, i)->name;
+    if (q2->pagination_keys->nelts <= 0) {
+        if (q2->pagination_cursor == NULL) return 0;
+        q2_log_error(q2, "%s", "Invalid pagination cursor");
+        return 1;
+    }
+    if (q2->pagination_cursor != NULL) {
+        q2->pagination_after = q2_cursor_decode(q2->pool,
+                                                q2->pagination_cursor);
+        if (q2->pagination_after == NULL ||
+            q2->pagination_after->nelts != q2->pagination_keys->nelts) {
+            q2_log_error(q2, "%s", "Invalid pagination cursor");
+            return 1;
+        }
+    }
+    q2->pagination_keyset = 1;
+    q2->pagination_offset = 0;
+    return 0;
+}
+
+//! (k1>v1) OR (k1=v1 AND k2>v2) OR ..., the portable form of (k)>(v)
+static const char* q2_sql_cursor_conds(q2_t *q2)
+{
+    const char *key;
+    apr_array_header_t *ors, *ands;
+    if (!q2->pagination_keyset || q2->pagination_after == NULL) return NULL;
+    ors = apr_array_make(q2->pool, q2->pagination_keys->nelts,
+                         sizeof(const char*));
+    for (int i = 0; i < q2->pagination_keys->nelts; i++) {
+        ands = apr_array_make(q2->pool, i + 1, sizeof(const char*));
+        for (int j = 0; j <= i; j++) {
+            key = APR_ARRAY_IDX(q2->pagination_keys, j, const char*);
+            APR_ARRAY_PUSH(ands, const char*) =
+                apr_psprintf(q2->pool, j < i ? "%s=%s" : "%s>%s", key,
+                             q2_sql_bind(q2, APR_ARRAY_IDX(q2->pagination_after,
+                                                           j, const char*)));
         }
+        APR_ARRAY_PUSH(ors, const char*) =
+            apr_pstrcat(q2->pool, "(", q2_join(q2->pool, ands, " AND "),
+                        ")", NULL);
+    }
+    return apr_pstrcat(q2->pool, "(", q2_join(q2->pool, ors, " OR "), ")",
+                       NULL);
+}
+
+static const char* q2_sql_limit(q2_t *q2, int mode)
+{
+    int ppg = q2->pagination_ppg;
+    const char *pk_name = NULL, *order_s = "";
+    //! One extra row tells whether a next page exists without counting
+    if (ppg && (mode == Q2_COUNT_NONE ||
+                mode == Q2_COUNT_ESTIMATED ||
+                q2->pagination_keyset)) ppg ++;
+    if (q2->pagination_keyset) {
+        pk_name = apr_array_pstrcat(q2->pool, q2->pagination_keys, ',');
+        order_s = apr_pstrcat(q2->pool, "ORDER BY ", pk_name, " ", NULL);
+    }
+    if (q2->dbd_server_type == Q2_DBD_MSSQL) {
+        for (int i = 0; !q2->pagination_keyset && i < q2->columns->nelts; i++)
+            if (q2_column(q2->columns, i)->flags & Q2_COL_PK)
+                pk_name = q2_column(q2->columns, i)->name;
         if (pk_name == NULL) {
             q2_log_error(q2, "%s", "Primary key not found");
             return NULL;
         }
-        limit = apr_psprintf(q2->pool, "ORDER BY %s OFFSET %d "
-                                       "ROWS FETCH NEXT %d ROWS ONLY",
-                             pk_name, q2->pagination_offset, q2->pagination_ppg);
+        return apr_psprintf(q2->pool, "ORDER BY %s OFFSET %d "
+                                      "ROWS FETCH NEXT %d ROWS ONLY",
+                            pk_name, q2->pagination_offset, ppg);
     }
     if (q2->dbd_server_type == Q2_DBD_PGSQL ||
         q2->dbd_server_type == Q2_DBD_SQLT3)
-    {
-        limit = apr_psprintf(q2->pool,
-                             "LIMIT %d OFFSET %d",
-                             q2->pagination_ppg, q2->pagination_offset);
-    }
-    if (q2->dbd_server_type == Q2_DBD_MYSQL && q2->pagination_ppg) {
-        limit = apr_psprintf(q2->pool,
-                             "LIMIT %d, %d",
-                             q2->pagination_offset, q2->pagination_ppg);
-    }
+        return apr_psprintf(q2->pool, "%sLIMIT %d OFFSET %d",
+                            order_s, ppg, q2->pagination_offset);
+    if (q2->dbd_server_type == Q2_DBD_MYSQL && ppg)
+        return apr_psprintf(q2->pool, "%sLIMIT %d, %d",
+                            order_s, q2->pagination_offset, ppg);
+    return "";
+}
+
+static void q2_sql_count(q2_t *q2, const char *sql, int mode)
+{
+    q2->pagination_count = mode;
+    if (mode == Q2_COUNT_EXACT)
+        q2->query_num_rows = q2_count_rows(q2, sql);
+    else if (mode == Q2_COUNT_ESTIMATED)
+        q2->query_num_rows = q2_count_estimate(q2);
+}
+
+static const char* q2_sql_select_tab(q2_t *q2)
+{
+    int mode;
+    const char *sql, *limit, *cursor_s;
+    unsigned char ok = (unsigned char)(q2->uri_tables != NULL &&
+                                       q2->uri_tables->nelts == 1 &&
+                                       q2->uri_keys == NULL &&
+                                       q2->table != NULL &&
+                                       q2->column == NULL &&
+                                       q2->r_params == NULL);
+    if(!ok) return NULL;
+    if (q2_sql_keyset(q2, 1)) return NULL;
+    mode = q2_count_mode(q2);
+    if ((limit = q2_sql_limit(q2, mode)) == NULL) return NULL;
+    if (*limit == '\0') limit = NULL;
     sql = apr_psprintf(q2->pool, "SELECT * FROM %s", q2->table);
-    q2->query_num_rows = q2_count_rows(q2, sql);
+    q2_sql_count(q2, sql, mode);
+    cursor_s = q2_sql_cursor_conds(q2);
+    if (mode == Q2_COUNT_WINDOW || cursor_s != NULL)
+        sql = apr_psprintf(q2->pool, "SELECT %s FROM %s%s%s",
+                           mode == Q2_COUNT_WINDOW ? Q2_COUNT_SELECT : "*",
+                           q2->table,
+                           cursor_s == NULL ? "" : " WHERE ",
+                           cursor_s == NULL ? "" : cursor_s);
     return apr_psprintf(q2->pool,
                         limit == NULL ? "%s%s" : "%s %s", //! Pattern
                         sql,                              //! First in pattern
@@ -2110,10 +3604,11 @@ static const char* q2_sql_select_tab_col(q2_t *q2)
     if (!ok) return NULL;
     pks_ar = NULL;
     uri_column_is_pk = 0;
-    for (int i = 0; i < q2->attributes->nelts; i++) {
-        is_pk = (unsigned char)atoi(q2_dbd_get_value(q2->attributes, i, "is_primary_key"));
+    for (int i = 0; i < q2->columns->nelts; i++) {
+        is_pk = (unsigned char)((q2_column(q2->columns, i)->flags &
+                                 Q2_COL_PK) != 0);
         if (!is_pk) continue;
-        pk_name = q2_dbd_get_value(q2->attributes, i, "column_name");
+        pk_name = q2_column(q2->columns, i)->name;
         if (pk_name == NULL) return NULL;
         if (pks_ar == NULL)
             pks_ar = apr_array_make(q2->pool, 1, sizeof(const char*));
@@ -2135,7 +3630,7 @@ static const char* q2_sql_select_tab_col_prm(q2_t *q2)
 {
     unsigned char ok, is_pk, uri_column_is_pk;
     const char *pk_conds_s, *c_name, *c_val, *pks_s, *pars_v, *conds_s, *ordby_s;
-    apr_table_t *c_attr;
+    const q2_column_t *c_attr;
     apr_array_header_t *conds_ar, *ordby_ar, *pks_ar;
     ok = (unsigned char)(q2->uri_tables != NULL &&
                   q2->uri_tables->nelts == 1 && q2->uri_keys == NULL &&
@@ -2148,12 +3643,12 @@ static const char* q2_sql_select_tab_col_prm(q2_t *q2)
     conds_ar = NULL;
     conds_s = NULL;
     uri_column_is_pk = 0;
-    for (int i = 0; i < q2->attributes->nelts; i++) {
-        c_name = q2_dbd_get_value(q2->attributes, i, "column_name");
+    for (int i = 0; i < q2->columns->nelts; i++) {
+        c_name = q2_column(q2->columns, i)->name;
         if (c_name == NULL) continue;
         c_val = apr_table_get(q2->r_params, c_name);
         if (c_val != NULL) {
-            c_attr = q2_dbd_get_entry(q2->attributes, i);
+            c_attr = q2_column(q2->columns, i);
             pars_v = q2_sql_parse_value(q2, c_attr, c_name, c_val, &ordby_ar);
             if (pars_v != NULL) {
                 if (conds_ar == NULL) {
@@ -2163,7 +3658,8 @@ static const char* q2_sql_select_tab_col_prm(q2_t *q2)
                 APR_ARRAY_PUSH(conds_ar, const char*) = pars_v;
             }
         }
-        is_pk = (unsigned char)atoi(q2_dbd_get_value(q2->attributes, i, "is_primary_key"));
+        is_pk = (unsigned char)((q2_column(q2->columns, i)->flags &
+                                 Q2_COL_PK) != 0);
         if (!is_pk) continue;
         if (pks_ar == NULL)
             pks_ar = apr_array_make(q2->pool, 1, sizeof(const char*));
@@ -2193,9 +3689,11 @@ static const char* q2_sql_select_tab_col_prm(q2_t *q2)
 
 static const char* q2_sql_select_tab_prm(q2_t *q2)
 {
+    int mode;
     unsigned char ok;
-    const char *c_name, *c_val, *conds_s, *pars_v, *ordby_s, *sql, *limit;
-    apr_table_t *c_attr;
+    const char *c_name, *c_val, *conds_s, *pars_v, *ordby_s, *sql, *limit,
+               *cursor_s;
+    const q2_column_t *c_attr;
     apr_array_header_t *conds_ar, *ordby_ar;
     ok = (unsigned char)(q2->uri_tables != NULL &&
                   q2->uri_tables->nelts == 1 && q2->table != NULL &&
@@ -2204,12 +3702,12 @@ static const char* q2_sql_select_tab_prm(q2_t *q2)
     if (!ok) return NULL;
     conds_ar = NULL;
     ordby_ar = NULL;
-    for (int i = 0; i < q2->attributes->nelts; i++) {
-        c_name = q2_dbd_get_value(q2->attributes, i, "column_name");
+    for (int i = 0; i < q2->columns->nelts; i++) {
+        c_name = q2_column(q2->columns, i)->name;
         if (c_name == NULL) continue;
         c_val = apr_table_get(q2->r_params, c_name);
         if (c_val == NULL) continue;
-        c_attr = q2_dbd_get_entry(q2->attributes, i);
+        c_attr = q2_column(q2->columns, i);
         pars_v = q2_sql_parse_value(q2, c_attr, c_name, c_val, &ordby_ar);
         if (pars_v != NULL) {
             if (conds_ar == NULL) {
@@ -2228,6 +3726,8 @@ static const char* q2_sql_select_tab_prm(q2_t *q2)
     if (ordby_ar != NULL)
         ordby_s = apr_psprintf(q2->pool, " ORDER BY %s",
                                apr_array_pstrcat(q2->pool, ordby_ar, ','));
+    if (q2_sql_keyset(q2, ordby_s == NULL)) return NULL;
+    mode = q2_count_mode(q2);
     if (conds_s == NULL) {
         sql = apr_psprintf(q2->pool, "SELECT %s FROM %s%s", "*",
                             q2->table, ordby_s == NULL ? "" : ordby_s);
@@ -2237,35 +3737,21 @@ static const char* q2_sql_select_tab_prm(q2_t *q2)
                            ordby_s == NULL ? "" : ordby_s);
     }
 
-    limit = NULL;
-    if (q2->dbd_server_type == Q2_DBD_MSSQL) {
-        const char *pk_name = NULL;
-        for (int i = 0; i < q2->attributes->nelts; i++) {
-            int is_pk = (unsigned char)atoi(q2_dbd_get_value(q2->attributes, i, "is_primary_key"));
-            if (is_pk) pk_name = q2_dbd_get_value(q2->attributes, i, "column_name");
-        }
-        if (pk_name == NULL) {
-            q2_log_error(q2, "%s", "Primary key not found");
-            return NULL;
-        }
-        limit = apr_psprintf(q2->pool,
-                             "ORDER BY %s OFFSET %d ROWS FETCH NEXT %d ROWS ONLY",
-                             pk_name, q2->pagination_offset, q2->pagination_ppg);
-    }
-    if (q2->dbd_server_type == Q2_DBD_PGSQL ||
-        q2->dbd_server_type == Q2_DBD_SQLT3)
-    {
-        limit = apr_psprintf(q2->pool,
-                             "LIMIT %d OFFSET %d",
-                             q2->pagination_ppg, q2->pagination_offset);
-    }
-    if (q2->dbd_server_type == Q2_DBD_MYSQL && q2->pagination_ppg) {
-        limit = apr_psprintf(q2->pool,
-                             "LIMIT %d,%d",
-                             q2->pagination_offset, q2->pagination_ppg);
-    }
-
-    q2->query_num_rows = q2_count_rows(q2, sql);
+    if ((limit = q2_sql_limit(q2, mode)) == NULL) return NULL;
+    if (*limit == '\0') limit = NULL;
+
+    q2_sql_count(q2, sql, mode);
+    if ((cursor_s = q2_sql_cursor_conds(q2)) != NULL)
+        conds_s = conds_s == NULL
+            ? cursor_s
+            : apr_pstrcat(q2->pool, conds_s, " AND ", cursor_s, NULL);
+    if (mode == Q2_COUNT_WINDOW || cursor_s != NULL)
+        sql = apr_psprintf(q2->pool, "SELECT %s FROM %s%s%s%s",
+                           mode == Q2_COUNT_WINDOW ? Q2_COUNT_SELECT : "*",
+                           q2->table,
+                           conds_s == NULL ? "" : " WHERE ",
+                           conds_s == NULL ? "" : conds_s,
+                           ordby_s == NULL ? "" : ordby_s);
 
     return apr_psprintf(q2->pool,
                         limit == NULL ? "%s%s" : "%s %s", //! Pattern
@@ -2277,7 +3763,7 @@ static const char* q2_sql_select_tab_key_prm(q2_t *q2)
 {
     unsigned char ok;
     const char *c_name, *c_val, *conds_s, *key_conds_s, *pars_v, *ordby_s;
-    apr_table_t *c_attr;
+    const q2_column_t *c_attr;
     apr_array_header_t *ordby_ar, *conds_ar;
     ok = (unsigned char)(q2->uri_tables != NULL &&
                   q2->uri_tables->nelts == 1 && q2->table != NULL &&
@@ -2289,12 +3775,12 @@ static const char* q2_sql_select_tab_key_prm(q2_t *q2)
     if (q2->attributes == NULL || q2->attributes->nelts <= 0) return NULL;
     conds_ar = NULL;
     ordby_ar = NULL;
-    for (int i = 0; i < q2->attributes->nelts; i++) {
-        c_name = q2_dbd_get_value(q2->attributes, i, "column_name");
+    for (int i = 0; i < q2->columns->nelts; i++) {
+        c_name = q2_column(q2->columns, i)->name;
         if (c_name == NULL) continue;
         c_val = apr_table_get(q2->r_params, c_name);
         if (c_val == NULL) continue;
-        c_attr = q2_dbd_get_entry(q2->attributes, i);
+        c_attr = q2_column(q2->columns, i);
         pars_v = q2_sql_parse_value(q2, c_attr, c_name, c_val, &ordby_ar);
         if (pars_v != NULL) {
             if (conds_ar == NULL) {
@@ -2379,24 +3865,21 @@ static const char* q2_sql_select_tabs_key(q2_t *q2)
     const char *t_name, *c_name, *c_val, *first_uri_tab;
     first_uri_tab = APR_ARRAY_IDX(q2->uri_tables, 0, const char*);
     if (first_uri_tab == NULL) return NULL;
-    if (q2->attributes->nelts <= 0) return NULL;
+    if (q2->columns->nelts <= 0) return NULL;
     c_name = NULL;
     c_val = NULL;
-    for (int i = 0; i < q2->attributes->nelts;  i++) {
-        t_name = q2_dbd_get_value(q2->attributes, i, "referenced_table");
+    for (int i = 0; i < q2->columns->nelts;  i++) {
+        t_name = q2_column(q2->columns, i)->ref_table;
         if (t_name == NULL) continue;
         if (strcmp(t_name, first_uri_tab) != 0) continue;
         if (c_name != NULL) continue;
-        c_name = q2_dbd_get_value(q2->attributes, i, "column_name");
+        c_name = q2_column(q2->columns, i)->name;
         if (c_name == NULL) return NULL;
         c_val = APR_ARRAY_IDX(q2->uri_keys, 0, const char*);
         if (c_val == NULL) return NULL;
     }
-    return apr_psprintf(q2->pool,
-                        q2_is_integer(c_val)
-                            ? "SELECT %s FROM %s WHERE %s=%s%s"
-                            : "SELECT %s FROM %s WHERE %s='%s'%s",
-                        "*", q2->table, c_name, c_val, "");
+    return apr_psprintf(q2->pool, "SELECT %s FROM %s WHERE %s=%s%s",
+                        "*", q2->table, c_name, q2_sql_bind(q2, c_val), "");
 }
 static const char* q2_sql_select_tabs_key_11(q2_t *q2)
 {
@@ -2424,7 +3907,7 @@ static const char* q2_sql_select_tabs_key_prm_11(q2_t *q2)
 {
     unsigned char ok;
     const char *key_conds_s, *conds_s, *c_name, *c_val, *pars_v, *first_uri_tab;
-    apr_table_t *c_attr;
+    const q2_column_t *c_attr;
     apr_array_header_t *conds_ar, *ordby_ar;
     ok = (unsigned char)(q2->uri_tables != NULL &&
                   q2->uri_tables->nelts > 1 && q2->table != NULL &&
@@ -2437,12 +3920,12 @@ static const char* q2_sql_select_tabs_key_prm_11(q2_t *q2)
     if (q2->attributes->nelts <= 0) return NULL;
     conds_ar = NULL;
     ordby_ar = NULL;
-    for (int i = 0; i < q2->attributes->nelts; i++) {
-        c_name = q2_dbd_get_value(q2->attributes, i, "column_name");
+    for (int i = 0; i < q2->columns->nelts; i++) {
+        c_name = q2_column(q2->columns, i)->name;
         if (c_name == NULL) continue;
         c_val = apr_table_get(q2->r_params, c_name);
         if (c_val == NULL) continue;
-        c_attr = q2_dbd_get_entry(q2->attributes, i);
+        c_attr = q2_column(q2->columns, i);
         pars_v = q2_sql_parse_value(q2, c_attr, c_name, c_val, &ordby_ar);
         if (pars_v != NULL) {
             if (conds_ar == NULL) {
@@ -2464,7 +3947,7 @@ static const char* q2_sql_select_tabs_key_prm_1m(q2_t *q2)
     unsigned char ok;
     const char *t_name, *k_name, *c_name, *k_val, *c_val, *pars_v, *conds_s,
            *ordby_s, *first_uri_tab;
-    apr_table_t *c_attr;
+    const q2_column_t *c_attr;
     apr_array_header_t *conds_ar, *ordby_ar;
     ok = (unsigned char)(q2->uri_tables != NULL &&
                   q2->uri_tables->nelts > 1 && q2->table != NULL &&
@@ -2477,20 +3960,19 @@ static const char* q2_sql_select_tabs_key_prm_1m(q2_t *q2)
     k_val = NULL;
     conds_ar = NULL;
     ordby_ar = NULL;
-    for (int i = 0; i < q2->attributes->nelts; i++) {
-        t_name = q2_dbd_get_value(q2->attributes, i, "referenced_table");
-        if (t_name == NULL) continue;
-        if (strcmp(t_name, first_uri_tab) == 0) {
-            k_name = q2_dbd_get_value(q2->attributes, i, "column_name");
+    for (int i = 0; i < q2->columns->nelts; i++) {
+        t_name = q2_column(q2->columns, i)->ref_table;
+        if (t_name != NULL && strcmp(t_name, first_uri_tab) == 0) {
+            k_name = q2_column(q2->columns, i)->name;
             k_val = APR_ARRAY_IDX(q2->uri_keys, 0, const char*);
             if (k_name == NULL || k_val == NULL) return NULL;
             continue;
         }
-        c_name = q2_dbd_get_value(q2->attributes, i, "column_name");
+        c_name = q2_column(q2->columns, i)->name;
         if (c_name == NULL) continue;
         c_val = apr_table_get(q2->r_params, c_name);
         if (c_val == NULL) continue;
-        c_attr = q2_dbd_get_entry(q2->attributes, i);
+        c_attr = q2_column(q2->columns, i);
         pars_v = q2_sql_parse_value(q2, c_attr, c_name, c_val, &ordby_ar);
         if (pars_v == NULL) continue;
         if (conds_ar == NULL) {
@@ -2507,7 +3989,8 @@ static const char* q2_sql_select_tabs_key_prm_1m(q2_t *q2)
         ordby_s = apr_psprintf(q2->pool, " ORDER BY %s",
                                apr_array_pstrcat(q2->pool, ordby_ar, ','));
     return apr_psprintf(q2->pool, "SELECT %s FROM %s WHERE %s AND (%s=%s)%s",
-                        "*", q2->table, conds_s, k_name, k_val,
+                        "*", q2->table, conds_s, k_name,
+                        q2_sql_bind(q2, k_val),
                         ordby_s != NULL ? ordby_s : "");
 }
 
@@ -2517,8 +4000,9 @@ static const char* q2_sql_select_tabs_key_prm_mm(q2_t *q2)
     unsigned char ok;
     const char *lst_uri_tab, *sub_query, *conds_s, *key_conds_s, *c_name, *c_val,
            *pars_v, *ordby_s, *select_what, *lst_uri_tab_pk;
-    apr_table_t *c_attr;
-    apr_array_header_t *conds_ar, *ordby_ar, *lst_uri_tab_col_attrs, *lst_uri_tab_pk_attrs;
+    const q2_column_t *c_attr;
+    apr_array_header_t *conds_ar, *ordby_ar, *lst_uri_tab_col_attrs, *lst_uri_tab_pk_attrs,
+                       *lst_uri_tab_cols;
     ok = (unsigned char)(q2->uri_tables != NULL &&
                   q2->uri_tables->nelts > 1 && q2->table != NULL &&
                   q2->uri_keys != NULL && q2->r_params != NULL &&
@@ -2536,14 +4020,16 @@ static const char* q2_sql_select_tabs_key_prm_mm(q2_t *q2)
     lst_uri_tab_pk_attrs = q2_ischema_get_pk_attrs(q2, lst_uri_tab);
     if (lst_uri_tab_pk_attrs == NULL) return NULL;
     if (lst_uri_tab_col_attrs->nelts <= 0) return NULL;
+    lst_uri_tab_cols = q2_columns_make(q2->pool, lst_uri_tab_col_attrs);
+    if (lst_uri_tab_cols == NULL) return NULL;
     conds_ar = NULL;
     ordby_ar = NULL;
-    for (int i = 0; i < lst_uri_tab_col_attrs->nelts; i++) {
-        c_name = q2_dbd_get_value(lst_uri_tab_col_attrs, i, "column_name");
+    for (int i = 0; i < lst_uri_tab_cols->nelts; i++) {
+        c_name = q2_column(lst_uri_tab_cols, i)->name;
         if (c_name == NULL) continue;
         c_val = apr_table_get(q2->r_params, c_name);
         if (c_val == NULL) continue;
-        c_attr = q2_dbd_get_entry(lst_uri_tab_col_attrs, i);
+        c_attr = q2_column(lst_uri_tab_cols, i);
         pars_v = q2_sql_parse_value(q2, c_attr, c_name, c_val, &ordby_ar);
         if (pars_v != NULL) {
             if (conds_ar == NULL) {
@@ -2567,13 +4053,14 @@ static const char* q2_sql_select_tabs_key_prm_mm(q2_t *q2)
     lst_uri_tab_pk = q2_dbd_get_value(lst_uri_tab_pk_attrs, 0, "column_name");
     sub_query = apr_psprintf(q2->pool, "SELECT %s FROM %s WHERE %s%s",
                              select_what, q2->table, key_conds_s, "");
+    q2->rows_table = lst_uri_tab;
     return apr_psprintf(q2->pool, "SELECT %s FROM %s WHERE %s IN (%s)%s%s", "*",
                         lst_uri_tab, lst_uri_tab_pk, sub_query,
                         conds_s == NULL ? "" : conds_s,
                         ordby_s == NULL ? "" : ordby_s);
 }
 
-static const char* q2_sql_select(q2_t *q2)
+static const char* q2_sql_select_find(q2_t *q2)
 {
     const char *sql;
     if ((sql = q2_sql_select_tab(q2)) != NULL) return sql;
@@ -2593,21 +4080,34 @@ static const char* q2_sql_select(q2_t *q2)
     return NULL;
 }
 
+//! Only the plain lists follow a cursor, the other statements would
+//! return the first page again
+static const char* q2_sql_select(q2_t *q2)
+{
+    const char *sql = q2_sql_select_find(q2);
+    if (sql != NULL && q2->pagination_cursor != NULL &&
+        !q2->pagination_keyset) {
+        q2_log_error(q2, "%s", "Invalid pagination cursor");
+        return NULL;
+    }
+    return sql;
+}
+
 static const char* q2_sql_insert(q2_t *q2)
 {
-    unsigned char is_pk = 0, is_nullable = 0, is_auto_increment = 0, is_pk_multi = 0;
+    unsigned char is_pk_multi = 0;
     const char *values_s = NULL, *keys_s = NULL, *k = NULL, *v = NULL;
     const char *referenced_table = NULL, *current_target = NULL;
     apr_array_header_t *keys = NULL, *params = NULL, *defaults = NULL;
+    q2_column_t *c;
     is_pk_multi = q2->pk_attrs->nelts > 1;
     if (!is_pk_multi) {
-        for (int i = 0; i < q2->attributes->nelts; i++) {
-            is_pk = (unsigned char)atoi(q2_dbd_get_value(q2->attributes, i, "is_primary_key"));
-            if (!is_pk) continue;
-            is_auto_increment = (unsigned char)atoi(q2_dbd_get_value(q2->attributes, i, "is_auto_increment"));
-            if (!is_auto_increment) {
+        for (int i = 0; i < q2->columns->nelts; i++) {
+            c = q2_column(q2->columns, i);
+            if (!(c->flags & Q2_COL_PK)) continue;
+            if (!(c->flags & Q2_COL_AUTO_INCREMENT)) {
                 if (q2->uri_keys != NULL && q2->uri_keys->nelts > 0) {
-                    k = q2_dbd_get_value(q2->attributes, i, "column_name");
+                    k = c->name;
                     v = APR_ARRAY_IDX(q2->uri_keys, 0, const char*);
                     if (q2->r_params == NULL)
                         q2->r_params = apr_table_make(q2->pool, 0);
@@ -2618,14 +4118,15 @@ static const char* q2_sql_insert(q2_t *q2)
         }
     }
     if (q2->uri_tables->nelts > 1) {
-        for (int i = 0; i < q2->attributes->nelts; i++) {
-            is_pk = (unsigned char)atoi(q2_dbd_get_value(q2->attributes, i, "is_primary_key"));
-            if (!is_pk) continue;
-            referenced_table = q2_dbd_get_value(q2->attributes, i, "referenced_table");
+        for (int i = 0; i < q2->columns->nelts; i++) {
+            c = q2_column(q2->columns, i);
+            if (!(c->flags & Q2_COL_PK)) continue;
+            referenced_table = c->ref_table;
+            if (referenced_table == NULL) continue;
             for (int j = 0; j < q2->uri_tables->nelts; j ++) {
                 current_target = APR_ARRAY_IDX(q2->uri_tables, j, const char*);
                 if (strcmp(referenced_table, current_target) == 0) {
-                    k = q2_dbd_get_value(q2->attributes, i, "column_name");
+                    k = c->name;
                     v = APR_ARRAY_IDX(q2->uri_keys, j, const char*);
                     if (q2->r_params == NULL)
                         q2->r_params = apr_table_make(q2->pool, 0);
@@ -2642,21 +4143,19 @@ static const char* q2_sql_insert(q2_t *q2)
     if (params == NULL) return NULL;
     k = NULL;
     v = NULL;
-    for (int i = 0; i < q2->attributes->nelts; i++) {
-        k = q2_dbd_get_value(q2->attributes, i, "column_name");
+    for (int i = 0; i < q2->columns->nelts; i++) {
+        c = q2_column(q2->columns, i);
+        k = c->name;
         if (k == NULL) return NULL;
         APR_ARRAY_PUSH(keys, const char*) = k;
-        is_nullable = (unsigned char)atoi(q2_dbd_get_value(q2->attributes, i, "is_nullable"));
-        is_pk = (unsigned char)atoi(q2_dbd_get_value(q2->attributes, i, "is_primary_key"));
-        is_auto_increment = (unsigned char)atoi(q2_dbd_get_value(q2->attributes, i, "is_auto_increment"));
-        if (!is_auto_increment && !is_nullable) {
+        if (!(c->flags & (Q2_COL_AUTO_INCREMENT | Q2_COL_NULLABLE))) {
             if (q2->r_params != NULL) v = apr_table_get(q2->r_params, k);
             if (v == NULL) {
                 const char *err = apr_psprintf(q2->pool, "Parameter %s is mandatory", k);
                 q2_log_error(q2, "%s", err); //!
                 return NULL;
             }
-            APR_ARRAY_PUSH(defaults, const char*) = apr_pstrdup(q2->pool, v);
+            APR_ARRAY_PUSH(defaults, const char*) = q2_sql_bind(q2, v);
         } else {
             APR_ARRAY_PUSH(defaults, const char*) = apr_pstrdup(q2->pool, "default");
         }
@@ -2676,7 +4175,7 @@ static const char* q2_sql_insert(q2_t *q2)
 
 static const char* q2_sql_update(q2_t *q2, int all)
 {
-    unsigned char is_numeric = 0, is_primary_key = 0, params_ok;
+    unsigned char is_primary_key = 0, params_ok;
     int pairs_num = 0;
     const char *pairs_s = NULL, *pk_name = NULL, *pk_value = NULL;
     const char *col_name = NULL, *col_value = NULL;
@@ -2705,11 +4204,11 @@ static const char* q2_sql_update(q2_t *q2, int all)
                      "%s", "UPDATE not allowed on a table with multiple PK");
         return NULL;
     }
-    for (int i = 0; i < q2->attributes->nelts; i++) {
-        is_primary_key = (unsigned char)atoi(q2_dbd_get_value(q2->attributes, i, "is_primary_key"));
+    for (int i = 0; i < q2->columns->nelts; i++) {
+        is_primary_key = (unsigned char)((q2_column(q2->columns, i)->flags &
+                                          Q2_COL_PK) != 0);
         if (is_primary_key) continue;
-        is_numeric = (unsigned char)atoi(q2_dbd_get_value(q2->attributes, i, "is_numeric"));
-        col_name = q2_dbd_get_value(q2->attributes, i, "column_name");
+        col_name = q2_column(q2->columns, i)->name;
         if (col_name == NULL) continue;
         col_value = NULL;
         if (q2->r_params != NULL)
@@ -2734,11 +4233,8 @@ static const char* q2_sql_update(q2_t *q2, int all)
         }
         APR_ARRAY_PUSH(pairs_arr, const char*) =
             apr_psprintf(q2->pool, "%s=%s", col_name,
-                         is_numeric
-                            ? col_value
-                            : q2_sql_encode_value(
-                                q2, q2_dbd_get_entry(q2->attributes, i),
-                                col_value));
+                         q2_sql_encode_value(q2, q2_column(q2->columns, i),
+                                             col_value));
 
         pairs_num ++;
     }
@@ -2752,11 +4248,9 @@ static const char* q2_sql_update(q2_t *q2, int all)
     }
     pairs_s = apr_array_pstrcat(q2->pool, pairs_arr, ',');
     if (pairs_s == NULL) return NULL;
-    for (int i = 0; i < q2->attributes->nelts; i++) {
-        const char *is_pk =
-            q2_dbd_get_value(q2->attributes, i, "is_primary_key");
-        if (is_pk == NULL || !(unsigned char)atoi(is_pk)) continue;
-        pk_name = q2_dbd_get_value(q2->attributes, i, "column_name");
+    for (int i = 0; i < q2->columns->nelts; i++) {
+        if (!(q2_column(q2->columns, i)->flags & Q2_COL_PK)) continue;
+        pk_name = q2_column(q2->columns, i)->name;
         if (pk_name == NULL) return NULL;
     }
     if (pk_name == NULL) {
@@ -2769,7 +4263,8 @@ static const char* q2_sql_update(q2_t *q2, int all)
         return NULL;
     }
     return apr_psprintf(q2->pool, "UPDATE %s SET %s WHERE %s=%s",
-                        q2->table, pairs_s, pk_name, pk_value);
+                        q2->table, pairs_s, pk_name,
+                        q2_sql_bind(q2, pk_value));
 }
 
 static const char* q2_sql_delete(q2_t *q2)
@@ -2781,10 +4276,10 @@ static const char* q2_sql_delete(q2_t *q2)
         q2_log_error(q2, "%s", "No primary key in URI");
         return NULL;
     }
-    for (int i = 0; i < q2->attributes->nelts; i++) {
-        cname = q2_dbd_get_value(q2->attributes, i, "column_name");
+    for (int i = 0; i < q2->columns->nelts; i++) {
+        cname = q2_column(q2->columns, i)->name;
         if (cname == NULL) return NULL;
-        ref_table = q2_dbd_get_value(q2->attributes, i, "referenced_table");
+        ref_table = q2_column(q2->columns, i)->ref_table;
         if (ref_table != NULL) {
             for (int j = 0; j < q2->uri_keys->nelts; j ++) {
                 target = APR_ARRAY_IDX(q2->uri_tables, j, const char*);
@@ -2798,7 +4293,8 @@ static const char* q2_sql_delete(q2_t *q2)
                             if (key_conds == NULL) return NULL;
                         }
                         APR_ARRAY_PUSH(key_conds, const char*) =
-                            apr_psprintf(q2->pool, "(%s=%s)", cname, cval);
+                            apr_psprintf(q2->pool, "(%s=%s)", cname,
+                                         q2_sql_bind(q2, cval));
                     }
                 }
             }
@@ -2823,7 +4319,7 @@ static const char* q2_sql_delete(q2_t *q2)
             return NULL;
         }
         return apr_psprintf(q2->pool, "DELETE FROM %s WHERE %s=%s",
-                            q2->table, cname, cval);
+                            q2->table, cname, q2_sql_bind(q2, cval));
     }
     if ((key_conds_s = q2_join(q2->pool, key_conds, " AND ")) == NULL)
         return NULL;
@@ -2865,7 +4361,9 @@ static const char* q2_sql_delete(q2_t *q2)
 //     return 0;
 // }
 
-static int q2_paginate_results(q2_t *q2)
+//! Sets total rows and links from the number of rows of the page and its
+//! last row, the extra row fetched to detect a next page already dropped
+static int q2_paginate_links(q2_t *q2, int nelts, apr_table_t *last)
 {
     int pagination_next, pagination_prev;
     const apr_strmatch_pattern *pattern;
@@ -2874,8 +4372,13 @@ static int q2_paginate_results(q2_t *q2)
 
     if (!q2->pagination_ppg) return 1;
 
-    if (q2->sql == NULL || q2->results == NULL ||
-        q2->results->nelts < q2->pagination_ppg) return 1;
+    //! Without a count the total is what has been seen so far
+    if (q2->pagination_count == Q2_COUNT_NONE && nelts > 0)
+        q2->query_num_rows = q2->pagination_offset + nelts +
+                             q2->pagination_more;
+
+    if (q2->sql == NULL || last == NULL || nelts < q2->pagination_ppg)
+        return 1;
 
     pagination_next = q2->pagination_ppg + q2->pagination_offset;
 
@@ -2893,11 +4396,39 @@ static int q2_paginate_results(q2_t *q2)
     }
     pattern = apr_strmatch_precompile(q2->pool, "/next/", 1);
     next_p = apr_strmatch(pattern, path, strlen(path));
+    if (next_p == NULL) {
+        pattern = apr_strmatch_precompile(q2->pool,
+                                          "/" Q2_PAGINATE_AFTER "/", 1);
+        next_p = apr_strmatch(pattern, path, strlen(path));
+    }
     if (next_p != NULL)
         new_path = apr_pstrndup(q2->pool, path,
                                 (int)strlen(path) - (int)strlen(next_p));
 
-    if (pagination_next < q2->query_num_rows) {
+    if (q2->pagination_keyset) {
+        if (q2->pagination_more) {
+            apr_array_header_t *vals;
+            vals = apr_array_make(q2->pool, q2->pagination_keys->nelts,
+                                  sizeof(const char*));
+            for (int i = 0; i < q2->pagination_keys->nelts; i++)
+                APR_ARRAY_PUSH(vals, const char*) =
+                    apr_table_get(last, APR_ARRAY_IDX(q2->pagination_keys,
+                                                      i, const char*));
+            q2->pagination_next = apr_psprintf(q2->pool, "%s/%s/%s%s%s",
+                                    new_path == NULL ? path : new_path,
+                                    Q2_PAGINATE_AFTER,
+                                    q2_cursor_encode(q2->pool, vals),
+                                    qstr == NULL ? "" : "?",
+                                    qstr == NULL ? "" : qstr);
+        }
+        q2->pagination_total_rows = q2->query_num_rows;
+        return 0;
+    }
+
+    if (q2->pagination_count == Q2_COUNT_NONE ||
+        q2->pagination_count == Q2_COUNT_ESTIMATED
+            ? q2->pagination_more
+            : pagination_next < q2->query_num_rows) {
         q2->pagination_next = apr_psprintf(q2->pool, "%s/next/%d%s%s",
                                 new_path == NULL ? path : new_path,
                                 pagination_next,
@@ -2930,6 +4461,38 @@ static int q2_paginate_results(q2_t *q2)
     return 0;
 }
 
+static int q2_paginate_results(q2_t *q2)
+{
+    if (q2->pagination_count == Q2_COUNT_WINDOW && q2->results != NULL) {
+        apr_table_t *t;
+        q2->query_num_rows = 0;
+        for (int i = 0; i < q2->results->nelts; i++) {
+            t = APR_ARRAY_IDX(q2->results, i, apr_table_t*);
+            if (i == 0 && apr_table_get(t, Q2_COUNT_COLUMN) != NULL)
+                q2->query_num_rows = atoi(apr_table_get(t, Q2_COUNT_COLUMN));
+            apr_table_unset(t, Q2_COUNT_COLUMN);
+        }
+    }
+
+    if (!q2->pagination_ppg) return 1;
+
+    if ((q2->pagination_count == Q2_COUNT_NONE ||
+         q2->pagination_count == Q2_COUNT_ESTIMATED ||
+         q2->pagination_keyset) &&
+        q2->results != NULL) {
+        if (q2->results->nelts > q2->pagination_ppg) {
+            apr_array_pop(q2->results);
+            q2->pagination_more = 1;
+        }
+    }
+
+    if (q2->results == NULL || q2->results->nelts <= 0)
+        return q2_paginate_links(q2, 0, NULL);
+    return q2_paginate_links(q2, q2->results->nelts,
+                             APR_ARRAY_IDX(q2->results, q2->results->nelts-1,
+                                           apr_table_t*));
+}
+
 
 static q2_t* q2_initialize(apr_pool_t *mp)
 {
@@ -2947,6 +4510,7 @@ static q2_t* q2_initialize(apr_pool_t *mp)
     q2->affected_rows = 0;
     q2->last_insert_id = NULL;
     q2->tb_name_fn = NULL;
+    q2->tb_list_fn = NULL;
     q2->cl_name_fn = NULL;
     q2->cl_attr_fn = NULL;
     q2->pk_attr_fn = NULL;
@@ -2965,6 +4529,7 @@ static q2_t* q2_initialize(apr_pool_t *mp)
     q2->uri_tables = NULL;
     q2->uri_keys = NULL;
     q2->table = NULL;
+    q2->rows_table = NULL;
     q2->request_uri = NULL;
     q2->tab_relation=0;
     q2->column = NULL;
@@ -2980,8 +4545,31 @@ static q2_t* q2_initialize(apr_pool_t *mp)
     q2->request_method = 0;
     q2->request_method_name = NULL;
     q2->query_num_rows = 0;
+    q2->count_mode = Q2_COUNT_EXACT;
+    q2->pagination_count = 0;
+    q2->pagination_more = 0;
+    q2->pagination_mode = Q2_PAGINATE_OFFSET;
+    q2->pagination_cursor = NULL;
+    q2->pagination_keys = NULL;
+    q2->pagination_after = NULL;
+    q2->pagination_keyset = 0;
     q2->pagination_ppg = 0;
     q2->single_entity = 0;
+    q2->schema_cache = NULL;
+    q2->schema_ttl = 0;
+    q2->schema_reload = 0;
+    q2->graph = NULL;
+    q2->columns = NULL;
+    q2->sql_binds = NULL;
+    q2->sql_args = NULL;
+    q2->stmt_cache = NULL;
+    q2->stmt_pool = NULL;
+    q2->row_fn = NULL;
+    q2->row_ctx = NULL;
+    q2->stream_res = NULL;
+    q2->with_attributes = 0;
+    q2->resolved = 0;
+    q2->version_column = NULL;
 #ifdef _APMOD
     q2->r_rec = NULL;
 #endif
@@ -3034,6 +4622,8 @@ static void q2_set_method(q2_t *q2, const char* method)
         q2->request_method = Q2_HT_METHOD_PATCH;
     if (strcmp(method, "DELETE") == 0)
         q2->request_method = Q2_HT_METHOD_DELETE;
+    if (strcmp(method, "OPTIONS") == 0)
+        q2->request_method = Q2_HT_METHOD_OPTIONS;
 }
 
 static void q2_set_uri(q2_t *q2, const char *uri)
@@ -3051,37 +4641,83 @@ static void q2_set_params(q2_t *q2, apr_table_t *params)
     q2->request_params = params;
 }
 
+static void q2_set_attributes(q2_t *q2, int with_attributes)
+{
+    q2->with_attributes = with_attributes;
+}
+
+static void q2_set_version_column(q2_t *q2, const char *column)
+{
+    q2->version_column = column;
+}
+
 static void q2_set_ppg(q2_t *q2, int ppg)
 {
     q2->pagination_ppg = ppg;
 }
 
+static int q2_count_mode_parse(const char *mode)
+{
+    if (mode == NULL) return 0;
+    if (strcasecmp(mode, "exact") == 0) return Q2_COUNT_EXACT;
+    if (strcasecmp(mode, "window") == 0) return Q2_COUNT_WINDOW;
+    if (strcasecmp(mode, "estimated") == 0) return Q2_COUNT_ESTIMATED;
+    if (strcasecmp(mode, "none") == 0) return Q2_COUNT_NONE;
+    return 0;
+}
+
+static void q2_set_count_mode(q2_t *q2, int mode)
+{
+    if (mode) q2->count_mode = mode;
+}
+
+static void q2_set_pagination_mode(q2_t *q2, int mode)
+{
+    q2->pagination_mode = mode;
+}
+
 static void q2_set_rawdata(q2_t *q2, const char *data, int len)
 {
     q2->request_rawdata = data;
     q2->request_rawdata_len = len;
 }
 
-static int q2_acquire(q2_t *q2)
+static void q2_set_schema_cache(q2_t *q2, q2_shm_cache_t *cache, int ttl)
+{
+    q2->schema_cache = cache;
+    q2->schema_ttl = ttl;
+}
+
+static void q2_set_schema_reload(q2_t *q2, int reload)
+{
+    q2->schema_reload = reload;
+}
+
+static void q2_set_graph(q2_t *q2, q2_graph_t *graph)
+{
+    q2->graph = graph;
+}
+
+//! GET lists are streamed to fn instead of being loaded into q2->results
+static void q2_set_row_fn(q2_t *q2, q2_row_fn_t fn, void *ctx)
+{
+    q2->row_fn = fn;
+    q2->row_ctx = ctx;
+}
+
+//! cache must live as long as the connection, statements go into mp
+static void q2_set_stmt_cache(q2_t *q2, apr_hash_t *cache, apr_pool_t *mp)
+{
+    q2->stmt_cache = cache;
+    q2->stmt_pool = mp;
+}
+
+static int q2_dbd_bind(q2_t *q2)
 {
-    int er;
-    int tab_found;
-    const char *dbd_driver_name, *entity;
-    apr_uri_t *ht_uri;
-    apr_array_header_t *uri_arr;
-    if (!q2_initialized(q2)) {
-        q2_log_error(q2, "%s", "Q2 not initialized");
-        return 1;
-    }
-    if (q2->dbd_driver == NULL ||
-        q2->dbd_handle == NULL ||
-        q2->dbd_server_type == 0) {
-        q2_log_error(q2, "%s", "DBD error");
-        return 1;
-    }
     #if !defined (Q2DBD) || defined (MYSQL)
     if (q2->dbd_server_type == Q2_DBD_MYSQL) {
         q2->tb_name_fn = q2_mysql_tb_name;
+        q2->tb_list_fn = q2_mysql_tb_list;
         q2->cl_name_fn = q2_mysql_cl_name;
         q2->cl_attr_fn = q2_mysql_cl_attr;
         q2->pk_attr_fn = q2_mysql_pk_attr;
@@ -3095,6 +4731,7 @@ static int q2_acquire(q2_t *q2)
     #if !defined (Q2DBD) || defined (PGSQL)
     if (q2->dbd_server_type == Q2_DBD_PGSQL) {
         q2->tb_name_fn = q2_pgsql_tb_name;
+        q2->tb_list_fn = q2_pgsql_tb_list;
         q2->cl_name_fn = q2_pgsql_cl_name;
         q2->cl_attr_fn = q2_pgsql_cl_attr;
         q2->pk_attr_fn = q2_pgsql_pk_attr;
@@ -3108,6 +4745,7 @@ static int q2_acquire(q2_t *q2)
     #if !defined (Q2DBD) || defined (SQLITE3)
     if (q2->dbd_server_type == Q2_DBD_SQLT3) {
         q2->tb_name_fn = q2_sqlt3_tb_name;
+        q2->tb_list_fn = q2_sqlt3_tb_list;
         q2->cl_name_fn = q2_sqlt3_cl_name;
         q2->cl_attr_fn = q2_sqlt3_cl_attr;
         q2->pk_attr_fn = q2_sqlt3_pk_attr;
@@ -3121,6 +4759,7 @@ static int q2_acquire(q2_t *q2)
     #if !defined (Q2DBD) || defined (MSSQL)
     if (q2->dbd_server_type == Q2_DBD_MSSQL) {
         q2->tb_name_fn = q2_mssql_tb_name;
+        q2->tb_list_fn = q2_mssql_tb_list;
         q2->cl_name_fn = q2_mssql_cl_name;
         q2->cl_attr_fn = q2_mssql_cl_attr;
         q2->pk_attr_fn = q2_mssql_pk_attr;
@@ -3131,7 +4770,49 @@ static int q2_acquire(q2_t *q2)
         q2->db_vers_fn = q2_mssql_getvers;
     }
     #endif
-    if (!q2->dbd_server_type) {
+    return (int)(q2->tb_name_fn == NULL);
+}
+
+//! Builds the relation graph of the connected schema into mp; catalog
+//! queries run in a scratch subpool that is released before returning.
+static q2_graph_t* q2_relation_graph(apr_pool_t *mp,
+                                     const apr_dbd_driver_t *drv,
+                                     apr_dbd_t *hd)
+{
+    q2_t *q2;
+    q2_graph_t *g;
+    apr_pool_t *tp;
+    if (mp == NULL || drv == NULL || hd == NULL) return NULL;
+    if (apr_pool_create(&tp, mp) != APR_SUCCESS) return NULL;
+    g = NULL;
+    if ((q2 = q2_initialize(tp)) != NULL) {
+        q2_set_dbd(q2, drv, hd);
+        if (q2->dbd_server_type != 0 && !q2_dbd_bind(q2))
+            g = q2_graph_build(q2, mp);
+    }
+    apr_pool_destroy(tp);
+    return g;
+}
+
+//! Route resolution only: driver binding and target table, no metadata.
+//! Lets the caller answer a conditional request before any query work.
+static int q2_resolve(q2_t *q2)
+{
+    int er;
+    int tab_found;
+    apr_uri_t *ht_uri;
+    apr_array_header_t *uri_arr;
+    if (!q2_initialized(q2)) {
+        q2_log_error(q2, "%s", "Q2 not initialized");
+        return 1;
+    }
+    if (q2->dbd_driver == NULL ||
+        q2->dbd_handle == NULL ||
+        q2->dbd_server_type == 0) {
+        q2_log_error(q2, "%s", "DBD error");
+        return 1;
+    }
+    if (q2_dbd_bind(q2)) {
         q2_log_error(q2, "%s", "DBD driver not supported");
         return 1;
     }
@@ -3151,12 +4832,19 @@ static int q2_acquire(q2_t *q2)
     }
     uri_arr = q2_split(q2->pool, ht_uri->path , "/");
     q2->pagination_offset = q2_uri_get_pag_offset(q2->pool, uri_arr);
+    q2->pagination_cursor = q2_uri_get_pag_cursor(q2->pool, uri_arr);
     q2->uri_tables = q2_uri_get_tabs(q2->pool, uri_arr);
     q2->uri_keys = q2_uri_get_keys(q2->pool, uri_arr);
     tab_found = 0;
-    q2->table = q2_ischema_get_target_table(q2, Q2_RL_11REL);
-    tab_found = (int)(q2->table != NULL);
-    if (tab_found) q2->tab_relation = Q2_RL_11REL;
+    if (q2->graph != NULL) {
+        q2->table = q2_graph_get_target_table(q2);
+        tab_found = (int)(q2->table != NULL);
+    }
+    if (!tab_found) {
+        q2->table = q2_ischema_get_target_table(q2, Q2_RL_11REL);
+        tab_found = (int)(q2->table != NULL);
+        if (tab_found) q2->tab_relation = Q2_RL_11REL;
+    }
     if (!tab_found) {
         q2->table = q2_ischema_get_target_table(q2, Q2_RL_1MREL);
         tab_found = (int)(q2->table != NULL);
@@ -3181,30 +4869,58 @@ static int q2_acquire(q2_t *q2)
         q2_log_error(q2, "%s", "Target table not found");
         return 1;
     }
-    q2->attributes = q2_ischema_get_col_attrs(q2, q2->table);
-    if (q2->attributes == NULL) {
-        q2_log_error(q2, "%s", "q2_ischema_get_col_attrs() error");
-        return 1;
-    }
-    q2->pk_attrs = q2_ischema_get_pk_attrs(q2, q2->table);
-    if (q2->error) {
-        q2_log_error(q2, "%s", "q2_ischema_get_pk_attrs() error");
-        return 1;
-    }
-    q2->unsigned_attrs = q2_ischema_get_unsig_attrs(q2, q2->table);
-    if (q2->error) {
-        q2_log_error(q2, "%s", "q2_ischema_get_unsig_attrs() error");
-        return 1;
-    }
-    q2->refs_attrs = q2_ischema_get_refs_attrs(q2, q2->table);
-    if (q2->error) {
-        q2_log_error(q2, "%s", "An error occurred");
-        return 1;
-    }
-    q2_ischema_update_attrs(q2);
-
+    q2->resolved = 1;
+    return 0;
+}
 
+//! Resolves the request and builds its statement, without running it
+static int q2_prepare(q2_t *q2)
+{
+    const char *dbd_driver_name, *entity;
+    if (!q2->resolved && q2_resolve(q2)) return 1;
+    if (q2->schema_reload) q2_ischema_cache_invalidate(q2, q2->table);
+    if ((q2->attributes = q2_ischema_cache_get(q2, q2->table)) != NULL) {
+        q2->columns = q2_columns_make(q2->pool, q2->attributes);
+        if (q2->columns == NULL) {
+            q2_log_error(q2, "%s", "q2_columns_make() error");
+            return 1;
+        }
+        q2->pk_attrs = q2_ischema_pk_attrs_from_cache(q2);
+    } else {
+        q2->attributes = q2_ischema_get_col_attrs(q2, q2->table);
+        if (q2->attributes == NULL) {
+            q2_log_error(q2, "%s", "q2_ischema_get_col_attrs() error");
+            return 1;
+        }
+        q2->pk_attrs = q2_ischema_get_pk_attrs(q2, q2->table);
+        if (q2->error) {
+            q2_log_error(q2, "%s", "q2_ischema_get_pk_attrs() error");
+            return 1;
+        }
+        q2->unsigned_attrs = q2_ischema_get_unsig_attrs(q2, q2->table);
+        if (q2->error) {
+            q2_log_error(q2, "%s", "q2_ischema_get_unsig_attrs() error");
+            return 1;
+        }
+        q2->refs_attrs = q2_ischema_get_refs_attrs(q2, q2->table);
+        if (q2->error) {
+            q2_log_error(q2, "%s", "An error occurred");
+            return 1;
+        }
+        q2_ischema_update_attrs(q2);
+        q2_ischema_cache_set(q2, q2->table);
+        q2->columns = q2_columns_make(q2->pool, q2->attributes);
+        if (q2->columns == NULL) {
+            q2_log_error(q2, "%s", "q2_columns_make() error");
+            return 1;
+        }
+    }
 
+    //! the schema of the table, nothing to query
+    if (q2->request_method == Q2_HT_METHOD_OPTIONS) {
+        q2_ischema_update_options_attr(q2);
+        return 0;
+    }
 
     if (q2->request_params == NULL && q2->request_query != NULL)
         q2_args_to_table(q2->pool, &(q2->request_params), q2->request_query);
@@ -3257,17 +4973,26 @@ static int q2_acquire(q2_t *q2)
         q2_log_error(q2, "%s", "Invalid HTTP method");
         return 1;
     }
+    if (q2->sql != NULL)
+        q2->sql = q2_sql_template(q2, q2->sql, &(q2->sql_args));
     if (q2->sql == NULL) {
         q2_log_error(q2, "%s", "SQL error");
         return 1;
     }
-    if (q2->request_method == Q2_HT_METHOD_GET) {
-        q2->results = q2_dbd_select(q2->pool, q2->dbd_driver,
-                                    q2->dbd_handle, q2->sql, &q2->error);
+    return 0;
+}
+
+static int q2_execute(q2_t *q2)
+{
+    if (q2->request_method == Q2_HT_METHOD_GET &&
+        q2->row_fn != NULL && !q2->single_entity) {
+        //! rows are read later by q2_stream_results()
+        q2->stream_res = q2_sql_exec_stream(q2, q2->sql, q2->sql_args);
+    } else if (q2->request_method == Q2_HT_METHOD_GET) {
+        q2->results = q2_sql_exec_select(q2, q2->sql, q2->sql_args);
         q2_paginate_results(q2);
     } else {
-        q2->affected_rows = q2_dbd_query(q2->pool, q2->dbd_driver,
-                                         q2->dbd_handle, q2->sql, &q2->error);
+        q2->affected_rows = q2_sql_exec_query(q2, q2->sql, q2->sql_args);
         if (!q2->error) {
             if (q2->request_method == Q2_HT_METHOD_POST) {
                 q2->last_insert_id = q2_ischema_get_last_id(q2);
@@ -3282,63 +5007,294 @@ static int q2_acquire(q2_t *q2)
     return 0;
 }
 
-static const char* q2_encode_json(q2_t *q2)
+static int q2_acquire(q2_t *q2)
 {
-    size_t timestamp_len, out_len;
-    char *out_s;
-    const char *now, *dbd_driver_name;
-    apr_status_t rv;
-    dbd_driver_name = apr_dbd_name(q2->dbd_driver);
-    out_s = apr_psprintf(
-        q2->pool,
-        Q2_OUTPUT_S,
-        q2->error,
-        q2->log == NULL
-            ? "null"
-            : q2_json_value(q2->pool, q2->log),
-        q2->request_method_name == NULL
-            ? "null"
-            : q2_json_value(q2->pool, q2->request_method_name),
-        dbd_driver_name == NULL
-            ? "null"
-            : q2_json_value(q2->pool, dbd_driver_name),
-        q2->dbd_server_version == NULL
-            ? "null"
-            : q2_json_value(q2->pool, q2->dbd_server_version),
-        q2->table == NULL
-            ? "null"
-            : q2_json_value(q2->pool, q2->table),
-        q2->column == NULL
-            ? "null"
-            : q2_json_value(q2->pool, q2->column),
-        q2->sql == NULL
-            ? "null"
-            : q2_json_value(q2->pool, q2->sql),
-        q2->attributes == NULL || q2->request_method != Q2_HT_METHOD_GET
-            ? "null"
-            : q2_json_array(q2->pool, q2->attributes, Q2_TABLE),
-        q2->results == NULL
-            ? (q2->request_method == Q2_HT_METHOD_POST &&
-               q2->last_insert_id != NULL
-                    ? q2_json_value(q2->pool, 
-                                    apr_psprintf(q2->pool,
-                                                 "/%s/%s",
-                                                 q2->table,
-                                                 q2->last_insert_id))
-                    : "null")
-            : q2_json_array(q2->pool, q2->results, Q2_TABLE),
-        q2->pagination_total_rows,
-        q2->pagination_prev == NULL
-            ? "null"
-            : q2_json_value(q2->pool, q2->pagination_prev),
-        q2->pagination_next == NULL
-            ? "null"
-            : q2_json_value(q2->pool, q2->pagination_next),
-        q2->affected_rows,
-        q2->last_insert_id == NULL
-            ? "null"
-            : q2_json_value(q2->pool, q2->last_insert_id));
-    return out_s;
+    if (q2_prepare(q2)) return 1;
+    if (q2->request_method == Q2_HT_METHOD_OPTIONS) return 0;
+    return q2_execute(q2);
+}
+
+//! Runs the prepared INSERTs batch[idx[i]], all with the same template, as
+//! multi-row statements in one transaction on the connection of the first.
+//! Nothing is written when 1 is returned. Multi-row INSERTs return no ids.
+static int q2_insert_rows(apr_array_header_t *batch, apr_array_header_t *idx)
+{
+    int rv = 0, n, per, nargs;
+    const char *values, *head;
+    q2_t *q2, *first;
+    apr_dbd_transaction_t *trans = NULL;
+    apr_array_header_t *rows, *args;
+    first = APR_ARRAY_IDX(batch, APR_ARRAY_IDX(idx, 0, int), q2_t*);
+    if ((values = strstr(first->sql, " VALUES (")) == NULL) return 1;
+    head = apr_pstrndup(first->pool, first->sql, values + 8 - first->sql);
+    values += 8;
+    //! SQL Server takes up to 2100 parameters per statement
+    nargs = first->sql_args->nelts;
+    per = nargs > 0 ? Q2_INSERT_BATCH_ARGS / nargs : Q2_INSERT_BATCH_ROWS;
+    if (per > Q2_INSERT_BATCH_ROWS) per = Q2_INSERT_BATCH_ROWS;
+    if (per < 1) per = 1;
+    if (apr_dbd_transaction_start(first->dbd_driver, first->pool,
+                                  first->dbd_handle, &trans) != 0)
+        return 1;
+    for (int i = 0; i < idx->nelts && !rv; i += n) {
+        n = idx->nelts - i < per ? idx->nelts - i : per;
+        rows = apr_array_make(first->pool, n, sizeof(const char*));
+        args = apr_array_make(first->pool, n * nargs, sizeof(const char*));
+        for (int j = i; j < i + n; j++) {
+            q2 = APR_ARRAY_IDX(batch, APR_ARRAY_IDX(idx, j, int), q2_t*);
+            APR_ARRAY_PUSH(rows, const char*) = values;
+            apr_array_cat(args, q2->sql_args);
+        }
+        q2_sql_exec_query(first,
+                          apr_pstrcat(first->pool, head,
+                                      q2_join(first->pool, rows, ","), NULL),
+                          args);
+        rv = first->error != 0;
+    }
+    if (rv)
+        apr_dbd_transaction_mode_set(first->dbd_driver, trans,
+                                     APR_DBD_TRANSACTION_ROLLBACK);
+    if (apr_dbd_transaction_end(first->dbd_driver, first->pool, trans) != 0)
+        rv = 1;
+    first->error = 0;
+    for (int i = 0; i < idx->nelts && !rv; i++)
+        APR_ARRAY_IDX(batch, APR_ARRAY_IDX(idx, i, int), q2_t*)->
+            affected_rows = 1;
+    return rv;
+}
+
+//! Runs several requests sharing one connection. POSTs with the same INSERT
+//! template (same table and columns) become multi-row statements; when
+//! those fail the rows are inserted one by one, so that only the faulty
+//! ones report an error. rv[i] is what q2_acquire() returned for batch[i].
+static void q2_acquire_batch(apr_array_header_t *batch, int *rv)
+{
+    q2_t *q2;
+    apr_pool_t *mp;
+    apr_hash_t *tpls;
+    apr_hash_index_t *hi;
+    apr_array_header_t *idx;
+    if (batch == NULL || batch->nelts <= 0) return;
+    mp = APR_ARRAY_IDX(batch, 0, q2_t*)->pool;
+    tpls = apr_hash_make(mp);
+    for (int i = 0; i < batch->nelts; i++) {
+        q2 = APR_ARRAY_IDX(batch, i, q2_t*);
+        if ((rv[i] = q2_prepare(q2)) != 0 ||
+            q2->request_method == Q2_HT_METHOD_OPTIONS)
+            continue;
+        if (q2->request_method != Q2_HT_METHOD_POST) {
+            rv[i] = q2_execute(q2);
+            continue;
+        }
+        idx = apr_hash_get(tpls, q2->sql, APR_HASH_KEY_STRING);
+        if (idx == NULL) {
+            idx = apr_array_make(mp, 8, sizeof(int));
+            apr_hash_set(tpls, q2->sql, APR_HASH_KEY_STRING, idx);
+        }
+        APR_ARRAY_PUSH(idx, int) = i;
+    }
+    for (hi = apr_hash_first(mp, tpls); hi; hi = apr_hash_next(hi)) {
+        idx = (apr_array_header_t*)apr_hash_this_val(hi);
+        if (idx->nelts > 1 && !q2_insert_rows(batch, idx)) continue;
+        for (int j = 0; j < idx->nelts; j++)
+            rv[APR_ARRAY_IDX(idx, j, int)] =
+                q2_execute(APR_ARRAY_IDX(batch, APR_ARRAY_IDX(idx, j, int),
+                                         q2_t*));
+    }
+}
+
+//! Hands the rows of a streamed select to the row callback one at a time.
+//! Rows alternate between two scratch pools, so only the current row and
+//! the previous one (needed for the cursor of the next link) are in memory.
+static int q2_stream_results(q2_t *q2)
+{
+    apr_pool_t *rp[2];
+    apr_dbd_row_t *row;
+    apr_table_t *rec, *last = NULL;
+    int nelts = 0, max = 0, stop = 0, num_fields;
+    if (q2->stream_res == NULL || q2->row_fn == NULL) return 1;
+    if (apr_pool_create(&rp[0], q2->pool) != APR_SUCCESS ||
+        apr_pool_create(&rp[1], q2->pool) != APR_SUCCESS) {
+        q2_log_error(q2, "%s", "apr_pool_create() error");
+        return 1;
+    }
+    //! the limit has one extra row that only tells whether a next page exists
+    if (q2->pagination_ppg &&
+        (q2->pagination_count == Q2_COUNT_NONE ||
+         q2->pagination_count == Q2_COUNT_ESTIMATED ||
+         q2->pagination_keyset)) max = q2->pagination_ppg;
+    if (q2->pagination_count == Q2_COUNT_WINDOW) q2->query_num_rows = 0;
+    num_fields = apr_dbd_num_cols(q2->dbd_driver, q2->stream_res);
+    for (;;) {
+        apr_pool_clear(rp[nelts % 2]);
+        row = NULL;
+        if (apr_dbd_get_row(q2->dbd_driver, rp[nelts % 2],
+                            q2->stream_res, &row, -1) != 0) break;
+        //! sequential results are always drained, even when stopped
+        if (stop) continue;
+        if (max && nelts == max) {
+            q2->pagination_more = 1;
+            continue;
+        }
+        rec = q2_dbd_row(rp[nelts % 2], q2->dbd_driver, q2->stream_res,
+                         row, num_fields);
+        if (q2->pagination_count == Q2_COUNT_WINDOW) {
+            if (nelts == 0 && apr_table_get(rec, Q2_COUNT_COLUMN) != NULL)
+                q2->query_num_rows = atoi(apr_table_get(rec, Q2_COUNT_COLUMN));
+            apr_table_unset(rec, Q2_COUNT_COLUMN);
+        }
+        if (q2->row_fn(q2->row_ctx, rp[nelts % 2], rec)) {
+            stop = 1;
+            continue;
+        }
+        last = rec;
+        nelts ++;
+    }
+    q2->stream_res = NULL;
+    q2_paginate_links(q2, nelts, last);
+    return 0;
+}
+
+static int q2_streaming(q2_t *q2)
+{
+    return q2->stream_res != NULL;
+}
+
+//! The payload up to "results": so that rows can be streamed after it
+static void q2_encode_json_head(q2_t *q2, q2_json_t *w)
+{
+    q2_json_puts(w, "{\"err\":");
+    q2_json_int(w, q2->error);
+    q2_json_puts(w, ",\"log\":");
+    q2_json_value(w, q2->log);
+    q2_json_puts(w, ",\"http_method\":");
+    q2_json_value(w, q2->request_method_name);
+    q2_json_puts(w, ",\"dbd_driver_name\":");
+    q2_json_value(w, apr_dbd_name(q2->dbd_driver));
+    q2_json_puts(w, ",\"db_server_vers\":");
+    q2_json_value(w, q2->dbd_server_version);
+    q2_json_puts(w, ",\"table\":");
+    q2_json_value(w, q2->table);
+    q2_json_puts(w, ",\"column\":");
+    q2_json_value(w, q2->column);
+    q2_json_puts(w, ",\"sql\":");
+    q2_json_value(w, q2->sql);
+    q2_json_puts(w, ",\"attributes\":");
+    q2_json_array(w, q2->request_method == Q2_HT_METHOD_GET &&
+                     q2->with_attributes
+                         ? q2->attributes
+                         : NULL, Q2_TABLE);
+    q2_json_puts(w, ",\"results\":");
+}
+
+static void q2_encode_json_tail(q2_t *q2, q2_json_t *w)
+{
+    q2_json_puts(w, ",\"pagination\":{\"total_rows\":");
+    q2_json_int(w, q2->pagination_total_rows);
+    q2_json_puts(w, ",\"prev\":");
+    q2_json_value(w, q2->pagination_prev);
+    q2_json_puts(w, ",\"next\":");
+    q2_json_value(w, q2->pagination_next);
+    q2_json_puts(w, "},\"affected_rows\":");
+    q2_json_int(w, q2->affected_rows);
+    q2_json_puts(w, ",\"last_insert_id\":");
+    q2_json_value(w, q2->last_insert_id);
+    q2_json_putc(w, '}');
+}
+
+//! The payload of OPTIONS, only depends on the table schema
+static void q2_encode_schema(q2_t *q2, q2_json_t *w)
+{
+    q2_json_puts(w, "{\"table\":");
+    q2_json_value(w, q2->table);
+    q2_json_puts(w, ",\"attributes\":");
+    q2_json_array(w, q2->attributes, Q2_TABLE);
+    q2_json_putc(w, '}');
+}
+
+//! The table the result rows come from, see q2_json_emitters()
+static const char* q2_get_rows_table(q2_t *q2)
+{
+    return q2->rows_table != NULL ? q2->rows_table : q2->table;
+}
+
+static void q2_encode_json(q2_t *q2, q2_json_t *w)
+{
+    q2_encode_json_head(q2, w);
+    if (q2->results != NULL) {
+        q2_json_rows(w, q2->results, q2->columns, q2_get_rows_table(q2));
+    } else if (q2->request_method == Q2_HT_METHOD_POST &&
+               q2->last_insert_id != NULL) {
+        q2_json_write(w, "\"/", 2);
+        q2_json_escape(w, q2->table, strlen(q2->table));
+        q2_json_putc(w, '/');
+        q2_json_escape(w, q2->last_insert_id, strlen(q2->last_insert_id));
+        q2_json_putc(w, '"');
+    } else {
+        q2_json_write(w, "null", 4);
+    }
+    q2_encode_json_tail(q2, w);
+}
+
+//! Tables whose changes affect the response. A GET depends on the tables of
+//! the URI and on those referenced by the target, a write changes the target
+//! and, through cascades, the tables referencing it. Before the columns are
+//! read the referenced tables come from the graph, NULL without it.
+static apr_array_header_t* q2_get_dep_tables(q2_t *q2)
+{
+    q2_graph_node_t *node;
+    apr_array_header_t *tabs;
+    if (q2->table == NULL) return NULL;
+    node = q2_graph_get_node(q2->graph, q2->table);
+    tabs = apr_array_make(q2->pool, 4, sizeof(const char*));
+    APR_ARRAY_PUSH(tabs, const char*) = q2->table;
+    if (q2->request_method == Q2_HT_METHOD_GET) {
+        if (q2->columns == NULL && node == NULL) return NULL;
+        for (int i = 0; q2->uri_tables != NULL &&
+                        i < q2->uri_tables->nelts; i++)
+            APR_ARRAY_PUSH(tabs, const char*) =
+                APR_ARRAY_IDX(q2->uri_tables, i, const char*);
+        for (int i = 0; q2->columns != NULL && i < q2->columns->nelts; i++)
+            if (q2_column(q2->columns, i)->ref_table != NULL)
+                APR_ARRAY_PUSH(tabs, const char*) =
+                    q2_column(q2->columns, i)->ref_table;
+        for (int i = 0; q2->columns == NULL && i < node->fks->nelts; i++)
+            APR_ARRAY_PUSH(tabs, const char*) =
+                APR_ARRAY_IDX(node->fks, i, q2_graph_fk_t*)->ref_table;
+        //! M:M junction tables
+        if (node != NULL)
+            apr_array_cat(tabs, node->refd_by);
+    } else {
+        if (node != NULL)
+            apr_array_cat(tabs, node->refd_by);
+    }
+    return tabs;
+}
+
+//! Highest value of the version column of the target table, NULL when it is
+//! not configured or missing. Errors are not reported, the column is optional.
+static const char* q2_get_table_version(q2_t *q2)
+{
+    q2_graph_node_t *node;
+    const char *tpl, *v;
+    apr_array_header_t *rset;
+    if (q2->version_column == NULL || q2->table == NULL) return NULL;
+    node = q2_graph_get_node(q2->graph, q2->table);
+    if (node != NULL && apr_hash_get(node->columns, q2->version_column,
+                                     APR_HASH_KEY_STRING) == NULL)
+        return NULL;
+    tpl = apr_pstrcat(q2->pool, "SELECT MAX(", q2->version_column,
+                      ") AS version FROM ", q2->table, NULL);
+    rset = q2_sql_exec_select(q2, tpl, NULL);
+    q2->error = 0;
+    if (rset == NULL || rset->nelts <= 0) return NULL;
+    v = q2_dbd_get_value(rset, 0, "version");
+    return v == NULL ? "" : v;
+}
+
+static apr_array_header_t* q2_get_columns(q2_t *q2)
+{
+    return q2->columns;
 }
 
 static apr_array_header_t* q2_get_results(q2_t *q2)
@@ -3384,22 +5340,140 @@ static const char* q2_get_error(q2_t *q2)
 module AP_MODULE_DECLARE_DATA q2_module;
 static ap_dbd_t* (*dbd_fn)(request_rec*) = NULL;
 
+//! Shared by all the children
+typedef struct q2_rest_async_stats_t {
+    volatile apr_uint32_t pending;  //! accepted and not yet executed
+    volatile apr_uint32_t running;  //! of which handed to the executor
+    volatile apr_uint32_t done;     //! completed, watched by the waiters
+    volatile apr_uint32_t entries;  //! status and result files, last GC pass
+    volatile apr_uint32_t expired;  //! files removed after their TTL
+    volatile apr_uint32_t evicted;  //! files removed over Q2AsyncMaxEntries
+} q2_rest_async_stats_t;
+
+//! Group-commit journal segment, shared by all the children. Records are
+//! appended under the journal lock and one fsync makes every record up to
+//! "end" durable.
+typedef struct q2_rest_segment_t {
+    volatile apr_uint32_t end;      //! bytes appended
+    volatile apr_uint32_t synced;   //! bytes on disk
+    volatile apr_uint32_t dispatched; //! bytes handed to the executor
+    volatile apr_uint32_t completed;  //! bytes of the jobs done or voided
+    volatile apr_uint32_t syncing;  //! a child is running the fsync
+    volatile apr_uint32_t gen;      //! truncations of the segment
+} q2_rest_segment_t;
+
+//! A published relation graph, freed with its pool when the last request
+//! using it is over. Counted under the graph lock.
+typedef struct q2_rest_graph_ref_t {
+    apr_pool_t *pool;
+    q2_graph_t *graph;
+    apr_uint32_t refs;            //! the requests, plus one while published
+    apr_thread_mutex_t *mutex;
+} q2_rest_graph_ref_t;
+
 typedef struct q2_rest_cfg_t {
     int pagination_ppg;
-    int server_port;
-    const char *hostname;
     const char *auth_params;
     const char *async_path;
+    int schema_cache_ttl;
+    int schema_cache_size;
+    int schema_cache_slot;        //! KB
+    q2_shm_cache_t *schema_cache;
+    int relation_graph;
+    q2_rest_graph_ref_t *graph;   //! under graph_mutex
+    apr_pool_t *graph_pool;
+    apr_time_t graph_next;        //! under graph_mutex, see q2_rest_graph()
+    apr_thread_mutex_t *graph_mutex;
+    int count_mode;
+    int pagination_mode;
+    int stream_results;
+    int response_cache_ttl;
+    int response_cache_size;
+    q2_shm_cache_t *response_cache;
+    apr_shm_t *gens_shm;
+    apr_uint32_t *gens;           //! [0] write epoch, then one per table hash
+    apr_time_t gens_boot;         //! gens restart from 0 with the server
+    int version_etag;
+    const char *version_column;
+    int auth_cache_ttl;
+    int auth_cache_size;
+    q2_shm_cache_t *auth_cache;
+    int token_ttl;
+    char *token_key;
+    apr_size_t token_key_len;
+    int async_queue;              //! Q2_REST_QUEUE_*
+    int async_queue_size;
+    q2_shm_ring_t *async_ring;
+    const char *async_journal;
+    apr_global_mutex_t *journal_mutex;
+    volatile apr_uint32_t journal_running; //! executor, jobs from the ring
+    int journal_dirty;            //! executor, records since the truncation
+    int async_threads;
+    int async_backlog;
+    int async_wait_max;
+    int async_batch;
+    apr_thread_pool_t *async_tp;  //! watchdog singleton process only
+    server_rec *async_server;
+    apr_thread_mutex_t *async_mutex;
+    apr_thread_t *async_watcher;
+    int async_watch_fd;
+    volatile apr_uint32_t async_stop;
+    apr_shm_t *async_shm;
+    q2_rest_async_stats_t *async_stats;
+    int async_result_ttl;
+    int async_result_size;
+    q2_shm_cache_t *async_results;
+    int async_status_ttl;
+    int async_max_entries;
+    int async_gc_shard;           //! watchdog singleton process only
+    apr_time_t async_gc_next;
+    apr_uint32_t async_gc_entries[Q2_REST_GC_SHARDS];
+    apr_uint32_t segment_size;
+    apr_interval_time_t sync_window;
+    apr_file_t *segment_fh;
+    apr_shm_t *segment_shm;
+    q2_rest_segment_t *segment;
 } q2_rest_cfg_t;
 
+typedef struct q2_rest_stream_t {
+    request_rec *r;
+    q2_t *q2;
+    apr_bucket_brigade *bb;
+    q2_json_t *w;
+    apr_array_header_t *emit;
+    int rows;
+} q2_rest_stream_t;
+
+//! Where a job was queued, marked done there once it completed
+typedef struct q2_rest_async_origin_t {
+    int queue;                    //! Q2_REST_QUEUE_*
+    apr_uint32_t off;             //! frame in the segment
+    apr_uint32_t len;
+} q2_rest_async_origin_t;
+
 typedef struct q2_rest_url_data_t {
     apr_pool_t *pool;
+    q2_rest_cfg_t *cfg;
     char *async_id;
-    apr_array_header_t *data;
-    const char *server;
-    int port;
+    const char *data;
+    q2_rest_async_origin_t origin;
 } q2_rest_url_data_t;
 
+//! Jobs run by one executor task on one connection
+typedef struct q2_rest_async_group_t {
+    apr_pool_t *pool;
+    q2_rest_cfg_t *cfg;
+    apr_array_header_t *jobs;     //! q2_rest_url_data_t*
+} q2_rest_async_group_t;
+
+//! Jobs taken from the queues in one pass, POSTs grouped by URI
+typedef struct q2_rest_async_batch_t {
+    q2_rest_cfg_t *cfg;
+    apr_pool_t *pool;
+    apr_hash_t *groups;           //! URI -> q2_rest_async_group_t*
+    int held;
+} q2_rest_async_batch_t;
+
 static int q2_rest_valid_handler(request_rec *r, const char *hd)
 {
     return strcmp(r->handler, hd) == 0;
@@ -3409,7 +5483,7 @@ static int q2_rest_valid_method(request_rec *r)
 {
     return (r->method_number == M_GET || r->method_number == M_POST ||
             r->method_number == M_PUT || r->method_number == M_PATCH ||
-            r->method_number == M_DELETE);
+            r->method_number == M_DELETE || r->method_number == M_OPTIONS);
 }
 
 static int q2_rest_valid_content_type(request_rec *r)
@@ -3445,35 +5519,239 @@ static const char* q2_rest_md5(apr_pool_t *mp, const char *s)
     return str;
 }
 
-static char* q2_rest_base64_encode(apr_pool_t *mp, const char *s)
+static pthread_key_t q2_rest_hmac_key;
+static pthread_once_t q2_rest_hmac_once = PTHREAD_ONCE_INIT;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static EVP_MAC *q2_rest_hmac_mac = NULL;
+#endif
+
+static void q2_rest_hmac_free(void *ctx)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    EVP_MAC_CTX_free((EVP_MAC_CTX*)ctx);
+#else
+    HMAC_CTX_free((HMAC_CTX*)ctx);
+#endif
+}
+
+static void q2_rest_hmac_init(void)
+{
+    pthread_key_create(&q2_rest_hmac_key, q2_rest_hmac_free);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    q2_rest_hmac_mac = EVP_MAC_fetch(NULL, "HMAC", NULL);
+#endif
+}
+
+//! One HMAC context per thread, reused by all the requests it serves
+static q2_hmac_ctx_t* q2_rest_hmac_ctx(void)
+{
+    q2_hmac_ctx_t *ctx;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    OSSL_PARAM params[2];
+#endif
+    pthread_once(&q2_rest_hmac_once, q2_rest_hmac_init);
+    ctx = (q2_hmac_ctx_t*)pthread_getspecific(q2_rest_hmac_key);
+    if (ctx != NULL) return ctx;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    if (q2_rest_hmac_mac == NULL) return NULL;
+    if ((ctx = EVP_MAC_CTX_new(q2_rest_hmac_mac)) == NULL) return NULL;
+    params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+                                                 (char*)"SHA256", 0);
+    params[1] = OSSL_PARAM_construct_end();
+    if (!EVP_MAC_CTX_set_params(ctx, params)) {
+        EVP_MAC_CTX_free(ctx);
+        return NULL;
+    }
+#else
+    if ((ctx = HMAC_CTX_new()) == NULL) return NULL;
+#endif
+    pthread_setspecific(q2_rest_hmac_key, ctx);
+    return ctx;
+}
+
+//! HMAC-SHA256 of the concatenated parts into md, returns the digest length
+//! or 0 on error
+static size_t q2_rest_hmac_sha256(const char *key,
+                                  size_t key_len,
+                                  const char **parts,
+                                  int n_parts,
+                                  unsigned char *md)
+{
+    size_t md_len = 0;
+    q2_hmac_ctx_t *ctx;
+    if ((ctx = q2_rest_hmac_ctx()) == NULL) return 0;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    if (!EVP_MAC_init(ctx, (const unsigned char*)key, key_len, NULL))
+        return 0;
+    for (int i = 0; i < n_parts; i++)
+        if (!EVP_MAC_update(ctx, (const unsigned char*)parts[i],
+                            strlen(parts[i])))
+            return 0;
+    if (!EVP_MAC_final(ctx, md, &md_len, SHA256_DIGEST_SIZE)) return 0;
+#else
+    unsigned int len = 0;
+    if (!HMAC_Init_ex(ctx, key, (int)key_len, EVP_sha256(), NULL)) return 0;
+    for (int i = 0; i < n_parts; i++)
+        if (!HMAC_Update(ctx, (const unsigned char*)parts[i],
+                         strlen(parts[i])))
+            return 0;
+    if (!HMAC_Final(ctx, md, &len)) return 0;
+    md_len = len;
+#endif
+    return md_len;
+}
+
+//! Lowercase hex of md into out, 2*len characters, not terminated
+static void q2_rest_hex(const unsigned char *md, size_t len, char *out)
 {
-    int s_l, b64_l;
-    char *b64_s;
-    if (s == NULL) return NULL;
-    s_l = (int)strlen(s);
-    b64_l = apr_base64_encode_len(s_l);
-    b64_s = (char*)apr_palloc(mp, sizeof(char)*b64_l);
-    if (b64_s == NULL) return NULL;
-    apr_base64_encode(b64_s, s, s_l);
-    return b64_s;
+    static const char hex[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; i++) {
+        out[i * 2] = hex[md[i] >> 4];
+        out[i * 2 + 1] = hex[md[i] & 0x0f];
+    }
+}
+
+//! base64(hex(HMAC-SHA256(key, "method+uri+date+nonce"))) as computed by the
+//! clients, written to out (Q2_REST_DIGEST_LEN bytes). No pool allocations.
+static int q2_rest_hmac_digest(const char *key,
+                               const char *method,
+                               const char *uri,
+                               const char *date,
+                               const char *nonce,
+                               char *out)
+{
+    unsigned char md[SHA256_DIGEST_SIZE];
+    char md_hex[SHA256_DIGEST_SIZE * 2];
+    const char *parts[] = {method, "+", uri, "+", date, "+", nonce};
+    size_t md_len;
+    md_len = q2_rest_hmac_sha256(key, strlen(key), parts,
+                                 sizeof(parts) / sizeof(parts[0]), md);
+    if (md_len == 0) return 1;
+    q2_rest_hex(md, md_len, md_hex);
+    apr_base64_encode(out, md_hex, (int)(md_len * 2));
+    return 0;
 }
 
-static const char* q2_rest_hmac(apr_pool_t *mp,
-                                const uint8_t *k,
-                                uint32_t k_len,
-                                const uint8_t *s,
-                                uint32_t s_len)
+//! Constant time: the comparison leaks nothing but the digest length
+static int q2_rest_hmac_verify(const char *key,
+                               const char *method,
+                               const char *uri,
+                               const char *date,
+                               const char *nonce,
+                               const char *req_digest)
+{
+    char digest[Q2_REST_DIGEST_LEN];
+    size_t len;
+    if (q2_rest_hmac_digest(key, method, uri, date, nonce, digest)) return 0;
+    len = strlen(digest);
+    if (strlen(req_digest) != len) return 0;
+    return CRYPTO_memcmp(digest, req_digest, len) == 0;
+}
+
+//! Prepared statements live in the connection pool, so they are cached there
+static apr_hash_t* q2_rest_stmt_cache(ap_dbd_t *dbd)
+{
+    void *cache = NULL;
+    if (dbd->pool == NULL) return NULL;
+    apr_pool_userdata_get(&cache, Q2_REST_STMT_CACHE, dbd->pool);
+    if (cache != NULL) return (apr_hash_t*)cache;
+    if ((cache = apr_hash_make(dbd->pool)) == NULL) return NULL;
+    apr_pool_userdata_setn(cache, Q2_REST_STMT_CACHE, NULL, dbd->pool);
+    return (apr_hash_t*)cache;
+}
+
+//! Password of user, NULL with *er == 0 when there is no such account.
+//! The statement is prepared once per connection.
+static const char* q2_rest_auth_lookup(request_rec *r,
+                                       ap_dbd_t *dbd,
+                                       apr_array_header_t *params,
+                                       const char *user,
+                                       int *er)
+{
+    const char *tpl, *pwdcl;
+    apr_hash_t *cache;
+    apr_dbd_prepared_t *stmt = NULL;
+    apr_array_header_t *args, *res;
+    *er = 0;
+    pwdcl = APR_ARRAY_IDX(params, 2, const char*);
+    tpl = apr_pstrcat(r->pool, "SELECT ", pwdcl,
+                      " FROM ", APR_ARRAY_IDX(params, 0, const char*),
+                      " WHERE ", APR_ARRAY_IDX(params, 1, const char*),
+                      "=%s", NULL);
+    if ((cache = q2_rest_stmt_cache(dbd)) != NULL)
+        stmt = apr_hash_get(cache, tpl, APR_HASH_KEY_STRING);
+    if (stmt == NULL) {
+        *er = apr_dbd_prepare(dbd->driver, cache ? dbd->pool : r->pool,
+                              dbd->handle, tpl,
+                              cache ? q2_sql_label(r->pool, cache) : NULL,
+                              &stmt);
+        if (*er) return NULL;
+        if (cache != NULL)
+            apr_hash_set(cache, apr_pstrdup(dbd->pool, tpl),
+                         APR_HASH_KEY_STRING, stmt);
+    }
+    args = apr_array_make(r->pool, 1, sizeof(const char*));
+    APR_ARRAY_PUSH(args, const char*) = user;
+    res = q2_dbd_pselect(r->pool, dbd->driver, dbd->handle, stmt, args, er);
+    if (*er) return NULL;
+    return q2_dbd_get_value(res, 0, pwdcl);
+}
+
+//! Credentials are cached as "+<password>", unknown users as "-" for a
+//! shorter time. A cached password that fails the HMAC is read again, the
+//! account may have changed in the meantime.
+static const char* q2_rest_auth_password(request_rec *r,
+                                         ap_dbd_t *dbd,
+                                         q2_rest_cfg_t *cfg,
+                                         apr_array_header_t *params,
+                                         const char *user,
+                                         int reload,
+                                         int *cached)
 {
-    apr_array_header_t *hash_ar;
-    uint32_t hash_len = SHA256_DIGEST_SIZE;
-    uint8_t hash[hash_len];
-    unsigned char* res;
-    res = HMAC(EVP_sha256(), k, k_len, s, s_len, hash, &hash_len);
-    hash_ar = apr_array_make(mp, SHA256_DIGEST_SIZE, sizeof(const char*));
-    for (int i = 0; i < hash_len; i++) {
-        APR_ARRAY_PUSH(hash_ar, const char*) = apr_psprintf(mp, "%02x", res[i]);
+    int er;
+    char *data;
+    const char *key, *pwd;
+    apr_size_t len;
+    *cached = 0;
+    key = q2_rest_md5(r->pool, user);
+    if (cfg->auth_cache != NULL && !reload) {
+        data = q2_shm_cache_get(cfg->auth_cache, r->pool, key, &len);
+        if (data != NULL && len > 0) {
+            *cached = 1;
+            return *data == '+' ? data + 1 : NULL;
+        }
     }
-    return q2_join(mp, hash_ar, "");
+    //! the connection is taken only on a cache miss
+    if (dbd == NULL) dbd = dbd_fn(r);
+    pwd = q2_rest_auth_lookup(r, dbd, params, user, &er);
+    if (er || cfg->auth_cache == NULL) return pwd;
+    if (pwd == NULL)
+        q2_shm_cache_set(cfg->auth_cache, key, "-", 1,
+                         cfg->auth_cache_ttl < Q2_REST_AUTH_NEG_TTL
+                             ? cfg->auth_cache_ttl
+                             : Q2_REST_AUTH_NEG_TTL);
+    else
+        q2_shm_cache_set(cfg->auth_cache, key,
+                         apr_pstrcat(r->pool, "+", pwd, NULL),
+                         strlen(pwd) + 1, cfg->auth_cache_ttl);
+    return pwd;
+}
+
+//! A signature that does not match the cached password may follow a change
+//! of password: it is read again at most once per user every
+//! Q2_REST_AUTH_RELOAD seconds, so wrong signatures cost no query
+static int q2_rest_auth_may_reload(request_rec *r,
+                                   q2_rest_cfg_t *cfg,
+                                   const char *user)
+{
+    apr_size_t len;
+    const char *key;
+    if (cfg->auth_cache == NULL) return TRUE;
+    key = apr_pstrcat(r->pool, "!", q2_rest_md5(r->pool, user), NULL);
+    if (q2_shm_cache_get(cfg->auth_cache, r->pool, key, &len) != NULL)
+        return FALSE;
+    q2_shm_cache_set(cfg->auth_cache, key, "1", 1, Q2_REST_AUTH_RELOAD);
+    return TRUE;
 }
 
 static int q2_rest_authenticate(request_rec *r,
@@ -3483,24 +5761,15 @@ static int q2_rest_authenticate(request_rec *r,
                                 char *date,
                                 int *unauth)
 {
-    int er;
+    int cached, valid;
     const char *auth_data;
     const char *user;
     const char *nonce;
     const char *req_digest;
-    const char *sql;
-    const char *table;
-    const char *usrcl;
-    const char *pwdcl;
-    const uint8_t *pwd;
-    const char *hmac;
-    const char *digest;
-    const uint8_t *s;
+    const char *pwd;
     apr_array_header_t *auth_ar;
     apr_array_header_t *auth_data_ar;
     apr_array_header_t *dbd_data_ar;
-    apr_array_header_t *pwd_res;
-    char qry[] = "SELECT %s FROM %s where %s='%s'";
     if (auth == NULL || date == NULL || cfg->auth_params == NULL) return 1;
     *unauth = 1;
     q2_strip_spaces(date);
@@ -3513,34 +5782,85 @@ static int q2_rest_authenticate(request_rec *r,
     user = APR_ARRAY_IDX(auth_data_ar, 0, const char*);
     nonce = APR_ARRAY_IDX(auth_data_ar, 1, const char*);
     req_digest = APR_ARRAY_IDX(auth_data_ar, 2, const char*);
+    if (user == NULL || nonce == NULL || req_digest == NULL) return 1;
     dbd_data_ar = q2_split(r->pool, cfg->auth_params, ":");
-    if (dbd_data_ar == NULL) return 1;
-    table = APR_ARRAY_IDX(dbd_data_ar, 0, const char*);
-    if (table == NULL) return 1;
-    usrcl = APR_ARRAY_IDX(dbd_data_ar, 1, const char*);
-    if (usrcl == NULL) return 1;
-    pwdcl = APR_ARRAY_IDX(dbd_data_ar, 2, const char*);
-    if (pwdcl == NULL) return 1;
-    sql = apr_psprintf(r->pool, qry, pwdcl, table, usrcl, user);
-    if (sql == NULL) return 1;
-    pwd_res = q2_dbd_select(r->pool, dbd->driver, dbd->handle, sql, &er);
-    if (pwd_res == NULL || pwd_res->nelts <= 0) return 1;
-    apr_table_t *pwd_tab = APR_ARRAY_IDX(pwd_res, 0, apr_table_t*);
-    if (pwd_tab == NULL) return 1;
-    pwd = (const uint8_t*)apr_table_get(pwd_tab, pwdcl);
+    if (dbd_data_ar == NULL || dbd_data_ar->nelts < 3) return 1;
+    pwd = q2_rest_auth_password(r, dbd, cfg, dbd_data_ar, user, 0, &cached);
     if (pwd == NULL) return 1;
-    s = (const uint8_t*)apr_psprintf(r->pool, "%s+%s+%s+%s", r->method,
-                                     r->unparsed_uri, date, nonce);
-    if (s == NULL) return 1;
-    hmac = q2_rest_hmac(r->pool, pwd, strlen((const char*)pwd), s,
-                   strlen((const char*)s));
-    if (hmac == NULL) return 1;
-    digest = q2_rest_base64_encode(r->pool, hmac);
-    if (digest == NULL) return 1;
-    *unauth = strcmp(digest, req_digest) != 0;
+    valid = q2_rest_hmac_verify(pwd, r->method, r->unparsed_uri,
+                                date, nonce, req_digest);
+    if (!valid && cached && q2_rest_auth_may_reload(r, cfg, user)) {
+        pwd = q2_rest_auth_password(r, dbd, cfg, dbd_data_ar, user, 1,
+                                    &cached);
+        if (pwd == NULL) return 1;
+        valid = q2_rest_hmac_verify(pwd, r->method, r->unparsed_uri,
+                                    date, nonce, req_digest);
+    }
+    *unauth = !valid;
+    if (!*unauth) {
+        r->user = apr_pstrdup(r->pool, user);
+        r->ap_auth_type = Q2_REST_HMAC_SCHEME;
+    }
     return 0;
 }
 
+static const char* q2_rest_token_sig(apr_pool_t *mp,
+                                     q2_rest_cfg_t *cfg,
+                                     const char *payload)
+{
+    unsigned char md[SHA256_DIGEST_SIZE];
+    char *sig;
+    size_t md_len;
+    md_len = q2_rest_hmac_sha256(cfg->token_key, cfg->token_key_len,
+                                 &payload, 1, md);
+    if (md_len == 0) return NULL;
+    if ((sig = (char*)apr_palloc(mp, md_len * 2 + 1)) == NULL) return NULL;
+    q2_rest_hex(md, md_len, sig);
+    sig[md_len * 2] = '\0';
+    return sig;
+}
+
+//! "<payload>.<signature>": the payload is the URL-safe encoding of expiry
+//! and user, the signature its HMAC with the server key
+static const char* q2_rest_token_issue(request_rec *r,
+                                       q2_rest_cfg_t *cfg,
+                                       apr_time_t expires)
+{
+    const char *payload, *sig;
+    apr_array_header_t *vals;
+    vals = apr_array_make(r->pool, 2, sizeof(const char*));
+    APR_ARRAY_PUSH(vals, const char*) =
+        apr_psprintf(r->pool, "%" APR_TIME_T_FMT, expires);
+    APR_ARRAY_PUSH(vals, const char*) = r->user;
+    if ((payload = q2_cursor_encode(r->pool, vals)) == NULL) return NULL;
+    if ((sig = q2_rest_token_sig(r->pool, cfg, payload)) == NULL) return NULL;
+    return apr_pstrcat(r->pool, payload, ".", sig, NULL);
+}
+
+//! Signature and expiry only, the accounts table is not read
+static int q2_rest_token_verify(request_rec *r,
+                                q2_rest_cfg_t *cfg,
+                                const char *token)
+{
+    const char *dot, *payload, *sig;
+    apr_array_header_t *vals;
+    while (*token == ' ') token ++;
+    if ((dot = strchr(token, '.')) == NULL) return 0;
+    payload = apr_pstrndup(r->pool, token, dot - token);
+    if ((sig = q2_rest_token_sig(r->pool, cfg, payload)) == NULL) return 0;
+    if (strlen(dot + 1) != strlen(sig) ||
+        CRYPTO_memcmp(sig, dot + 1, strlen(sig)) != 0)
+        return 0;
+    vals = q2_cursor_decode(r->pool, payload);
+    if (vals == NULL || vals->nelts < 2) return 0;
+    if (apr_atoi64(APR_ARRAY_IDX(vals, 0, const char*)) <
+        apr_time_sec(apr_time_now()))
+        return 0;
+    r->user = APR_ARRAY_IDX(vals, 1, const char*);
+    r->ap_auth_type = Q2_REST_TOKEN_SCHEME;
+    return 1;
+}
+
 static int q2_rest_authorized(request_rec *r,
                               ap_dbd_t *dbd,
                               q2_rest_cfg_t *cfg)
@@ -3548,6 +5868,11 @@ static int q2_rest_authorized(request_rec *r,
     const char *date = apr_table_get(r->headers_in, "Date");
     const char *authn = apr_table_get(r->headers_in, "Authentication");
     int unauthz = 1;
+    if (authn != NULL && cfg->token_ttl > 0 &&
+        strncasecmp(authn, Q2_REST_TOKEN_SCHEME " ",
+                    sizeof(Q2_REST_TOKEN_SCHEME)) == 0)
+        return q2_rest_token_verify(r, cfg,
+                                    authn + sizeof(Q2_REST_TOKEN_SCHEME));
     if (authn != NULL && date != NULL && cfg->auth_params != NULL)
         q2_rest_authenticate(r, dbd, cfg, (char*)authn, (char*)date, &unauthz);
     return !unauthz;
@@ -3658,82 +5983,289 @@ static const char* q2_rest_async_id(request_rec *r, const char *uri)
     return apr_pstrdup(r->pool, tmp);
 }
 
-static int q2_rest_async_save_data(request_rec *r,
-                                   q2_rest_cfg_t *cfg,
-                                   const char *data,
-                                   const char **id)
+static int q2_rest_journal_append(apr_pool_t *mp,
+                                  q2_rest_cfg_t *cfg,
+                                  const char *rec)
 {
-    int rand_num;
-    const char *ctype;
-    const char *accept;
-    const char *auth;
-    const char *date;
-    const char *fdata;
-    const char *fname;
-    ctype = apr_table_get(r->headers_in, "Content-Type");
-    accept = apr_table_get(r->headers_in, "Accept");
-    auth = apr_table_get(r->headers_in, "Authentication");
-    date = apr_table_get(r->headers_in, "Date");
-    if (auth == NULL || ctype == NULL || accept == NULL || date == NULL)
-        return FALSE;
-    *id = q2_rest_md5(r->pool, apr_psprintf(r->pool, "%s-%s-%" APR_TIME_T_FMT,
-                                       auth, r->unparsed_uri,
-                                       apr_time_now()));
-    if (*id != NULL) {
-        fname = apr_psprintf(r->pool, Q2_REST_ASYNC_FREQUEST,
-                             cfg->async_path, *id);
-        fdata = apr_psprintf(r->pool, Q2_REST_ASYNC_REQUEST, r->the_request,
-                             r->server->server_hostname,
-                             accept, ctype, *id, auth, date,
-                             data == NULL ? "\0" : data);
-        if (fname != NULL && fdata != NULL)
-            if (q2_rest_write_file(r->pool, fname, fdata))
-                return TRUE;
-    }
-    return FALSE;
+    apr_status_t rv;
+    apr_file_t *fh;
+    rv = apr_file_open(&fh, cfg->async_journal,
+                       APR_FOPEN_WRITE|APR_FOPEN_CREATE|APR_FOPEN_APPEND,
+                       APR_OS_DEFAULT, mp);
+    if (rv != APR_SUCCESS) return FALSE;
+    rv = apr_file_write_full(fh, rec, strlen(rec), NULL);
+    apr_file_close(fh);
+    return rv == APR_SUCCESS;
+}
+
+//! Shared memory queue, "<id>\n<request>" records. The journal gets the
+//! record under its lock, so the consumer cannot truncate it in between.
+static int q2_rest_async_enqueue(request_rec *r,
+                                 q2_rest_cfg_t *cfg,
+                                 const char *id,
+                                 const char *fdata)
+{
+    int retv;
+    const char *rec = apr_pstrcat(r->pool, id, "\n", fdata, NULL);
+    apr_size_t len = strlen(rec);
+    if (cfg->journal_mutex == NULL)
+        return !q2_shm_ring_push(cfg->async_ring, rec, len);
+    if (apr_global_mutex_lock(cfg->journal_mutex) != APR_SUCCESS) return FALSE;
+    retv = !q2_shm_ring_push(cfg->async_ring, rec, len);
+    if (retv)
+        q2_rest_journal_append(r->pool, cfg,
+                               apr_psprintf(r->pool, Q2_REST_JOURNAL_QUEUED,
+                                            len, rec));
+    apr_global_mutex_unlock(cfg->journal_mutex);
+    return retv;
 }
 
-static int q2_rest_async_save_status(request_rec *r,
+//! Appends the done record of a job taken from the ring once it completed,
+//! in the executor
+static void q2_rest_journal_complete(apr_pool_t *mp,
                                      q2_rest_cfg_t *cfg,
-                                     const char *id,
-                                     const char *status)
+                                     const char *id)
 {
-    const char *fname;
-    if (id != NULL) {
-        fname = apr_psprintf(r->pool, Q2_REST_ASYNC_FSTATUS,
-                             cfg->async_path, id);
-        if (fname != NULL)
-            if (q2_rest_write_file(r->pool, fname, status))
-                return TRUE;
+    if (apr_global_mutex_lock(cfg->journal_mutex) == APR_SUCCESS) {
+        q2_rest_journal_append(mp, cfg,
+                               apr_psprintf(mp, Q2_REST_JOURNAL_DONE, id));
+        apr_global_mutex_unlock(cfg->journal_mutex);
     }
-    return FALSE;
+    apr_atomic_dec32(&(cfg->journal_running));
 }
 
-static int q2_rest_async_get_status(request_rec *r,
-                                    q2_rest_cfg_t *cfg,
-                                    const char *id)
+//! Empties the segment and allocates its blocks again, so that the appends
+//! and the fsyncs that follow do not change the file metadata
+static apr_status_t q2_rest_segment_reset(apr_file_t *fh, apr_off_t size)
 {
-    char ch;
-    const char *fname = NULL;
-    if (id != NULL) {
-        fname = apr_psprintf(r->pool, Q2_REST_ASYNC_FSTATUS,
-                             cfg->async_path, id);
-        if (q2_rest_file_read_char(r->pool, fname, &ch))
-            return (int)atoi(apr_psprintf(r->pool, "%c", ch));
-    }
-    return 0;
+    apr_status_t rv;
+    apr_os_file_t fd;
+    if ((rv = apr_file_trunc(fh, 0)) != APR_SUCCESS) return rv;
+    if (apr_os_file_get(&fd, fh) != APR_SUCCESS ||
+        posix_fallocate(fd, 0, size) != 0)
+        if ((rv = apr_file_trunc(fh, size)) != APR_SUCCESS) return rv;
+    return apr_file_sync(fh);
 }
 
-static int q2_rest_async_remove_request(request_rec *r,
-                                        q2_rest_cfg_t *cfg,
-                                        const char *id)
+//! Group commit: the first waiter lets the batch window fill, then one
+//! fsync covers every record appended meanwhile. The records of a truncated
+//! segment were all completed, hence already on disk.
+static int q2_rest_segment_sync(q2_rest_cfg_t *cfg,
+                                apr_uint32_t gen,
+                                apr_uint32_t upto)
 {
     apr_status_t rv;
-    apr_finfo_t finfo;
-    const char *fname;
-    if (id != NULL) {
-        fname = apr_psprintf(r->pool, Q2_REST_ASYNC_FREQUEST,
-                             cfg->async_path, id);
+    apr_uint32_t g, end;
+    q2_rest_segment_t *seg = cfg->segment;
+    while (apr_atomic_read32(&(seg->gen)) == gen &&
+           apr_atomic_read32(&(seg->synced)) < upto) {
+        if (apr_atomic_cas32(&(seg->syncing), 1, 0) != 0) {
+            apr_sleep(cfg->sync_window / 4 + 1);
+            continue;
+        }
+        apr_sleep(cfg->sync_window);
+        //! gen and end are read together, a truncation may follow the fsync
+        rv = apr_global_mutex_lock(cfg->journal_mutex);
+        if (rv == APR_SUCCESS) {
+            g = apr_atomic_read32(&(seg->gen));
+            end = apr_atomic_read32(&(seg->end));
+            apr_global_mutex_unlock(cfg->journal_mutex);
+            rv = apr_file_datasync(cfg->segment_fh);
+        }
+        if (rv == APR_SUCCESS &&
+            (rv = apr_global_mutex_lock(cfg->journal_mutex)) == APR_SUCCESS) {
+            if (apr_atomic_read32(&(seg->gen)) == g &&
+                apr_atomic_read32(&(seg->synced)) < end)
+                apr_atomic_set32(&(seg->synced), end);
+            apr_global_mutex_unlock(cfg->journal_mutex);
+        }
+        apr_atomic_set32(&(seg->syncing), 0);
+        if (rv != APR_SUCCESS) return FALSE;
+    }
+    return TRUE;
+}
+
+//! Appends "Q <len>\n<id>\n<request>\n" to the segment and returns 1 once
+//! it is on disk. 0 when the request was not queued: a full segment or a
+//! failed fsync, the request falls back to the request files. -1 when the
+//! record could not be voided after a failed fsync and may still run.
+static int q2_rest_segment_push(request_rec *r,
+                                q2_rest_cfg_t *cfg,
+                                const char *id,
+                                const char *fdata)
+{
+    apr_off_t off;
+    apr_size_t len;
+    apr_uint32_t gen, end;
+    const char *rec, *frame;
+    rec = apr_pstrcat(r->pool, id, "\n", fdata, NULL);
+    frame = apr_psprintf(r->pool, Q2_REST_JOURNAL_QUEUED, strlen(rec), rec);
+    len = strlen(frame);
+    if (apr_global_mutex_lock(cfg->journal_mutex) != APR_SUCCESS) return FALSE;
+    off = (apr_off_t)apr_atomic_read32(&(cfg->segment->end));
+    //! a zero byte is left after the last record
+    if (off + (apr_off_t)len >= (apr_off_t)cfg->segment_size ||
+        apr_file_seek(cfg->segment_fh, APR_SET, &off) != APR_SUCCESS ||
+        apr_file_write_full(cfg->segment_fh, frame, len, NULL)
+            != APR_SUCCESS) {
+        apr_global_mutex_unlock(cfg->journal_mutex);
+        return FALSE;
+    }
+    end = (apr_uint32_t)off + (apr_uint32_t)len;
+    apr_atomic_set32(&(cfg->segment->end), end);
+    gen = apr_atomic_read32(&(cfg->segment->gen));
+    apr_global_mutex_unlock(cfg->journal_mutex);
+    if (q2_rest_segment_sync(cfg, gen, end)) return 1;
+    ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r,
+                  "q2: unable to sync the async journal");
+    //! the record is voided ('D') unless the drain took it, which means a
+    //! later fsync covered it, or the segment was truncated after it ran
+    if (apr_global_mutex_lock(cfg->journal_mutex) != APR_SUCCESS) return -1;
+    if (apr_atomic_read32(&(cfg->segment->gen)) != gen ||
+        apr_atomic_read32(&(cfg->segment->dispatched)) > (apr_uint32_t)off) {
+        apr_global_mutex_unlock(cfg->journal_mutex);
+        return 1;
+    }
+    if (apr_file_seek(cfg->segment_fh, APR_SET, &off) != APR_SUCCESS ||
+        apr_file_write_full(cfg->segment_fh, "D", 1, NULL) != APR_SUCCESS) {
+        apr_global_mutex_unlock(cfg->journal_mutex);
+        return -1;
+    }
+    apr_global_mutex_unlock(cfg->journal_mutex);
+    return 0;
+}
+
+//! Marks the record of a job done ('Q' becomes 'D') once the job completed,
+//! in the executor. The mark is not synced: a job whose mark is lost in a
+//! crash of the host runs again after the next start.
+static void q2_rest_segment_complete(q2_rest_cfg_t *cfg,
+                                     const q2_rest_async_origin_t *o)
+{
+    apr_off_t off = (apr_off_t)o->off;
+    if (apr_global_mutex_lock(cfg->journal_mutex) != APR_SUCCESS) return;
+    if (apr_file_seek(cfg->segment_fh, APR_SET, &off) != APR_SUCCESS ||
+        apr_file_write_full(cfg->segment_fh, "D", 1, NULL) != APR_SUCCESS)
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, cfg->async_server,
+                     "q2: unable to mark a job done in the async journal");
+    apr_atomic_add32(&(cfg->segment->completed), o->len);
+    apr_global_mutex_unlock(cfg->journal_mutex);
+}
+
+//! Backpressure: new async requests are refused while the executor is
+//! that far behind
+static int q2_rest_async_busy(q2_rest_cfg_t *cfg)
+{
+    if (cfg->async_stats == NULL) return FALSE;
+    return apr_atomic_read32(&(cfg->async_stats->pending)) >=
+           (apr_uint32_t)cfg->async_backlog;
+}
+
+static void q2_rest_async_pending(q2_rest_cfg_t *cfg, int n)
+{
+    apr_uint32_t v;
+    if (cfg->async_stats == NULL) return;
+    if (n > 0) {
+        apr_atomic_add32(&(cfg->async_stats->pending), (apr_uint32_t)n);
+        return;
+    }
+    //! never below zero
+    do {
+        v = apr_atomic_read32(&(cfg->async_stats->pending));
+    } while (v > 0 &&
+             apr_atomic_cas32(&(cfg->async_stats->pending),
+                              v > (apr_uint32_t)-n ? v + n : 0, v) != v);
+}
+
+//! Status and result files are sharded on the first two characters of the
+//! job id, so that Q2AsyncPath only holds the queued requests. NULL when
+//! the id was not generated by q2_rest_md5().
+static const char* q2_rest_async_fname(apr_pool_t *mp,
+                                       q2_rest_cfg_t *cfg,
+                                       const char *fmt,
+                                       const char *id)
+{
+    if (id == NULL || strlen(id) != Q2_REST_ASYNC_ID_LEN ||
+        strspn(id, "0123456789abcdef") != Q2_REST_ASYNC_ID_LEN)
+        return NULL;
+    return apr_psprintf(mp, fmt, cfg->async_path, id, id);
+}
+
+static int q2_rest_async_write(apr_pool_t *mp,
+                               q2_rest_cfg_t *cfg,
+                               const char *fmt,
+                               const char *id,
+                               const char *data)
+{
+    const char *fname = q2_rest_async_fname(mp, cfg, fmt, id);
+    if (fname == NULL) return FALSE;
+    if (q2_rest_write_file(mp, fname, data)) return TRUE;
+    //! first file of the shard
+    apr_dir_make(q2_rest_async_fname(mp, cfg, Q2_REST_ASYNC_FSHARD, id),
+                 APR_OS_DEFAULT, mp);
+    return q2_rest_write_file(mp, fname, data);
+}
+
+//! The status file holds "<status><user>". The file is not truncated, so a
+//! later status only replaces the first byte and the owner is kept.
+static int q2_rest_async_save_status(apr_pool_t *mp,
+                                     q2_rest_cfg_t *cfg,
+                                     const char *id,
+                                     const char *status)
+{
+    return q2_rest_async_write(mp, cfg, Q2_REST_ASYNC_FSTATUS, id, status);
+}
+
+//! Only the user that queued a job can read its status and result
+static int q2_rest_async_owned(request_rec *r,
+                               q2_rest_cfg_t *cfg,
+                               const char *id)
+{
+    char *buf;
+    apr_size_t len;
+    apr_file_t *fh;
+    apr_finfo_t finfo;
+    const char *fname;
+    fname = q2_rest_async_fname(r->pool, cfg, Q2_REST_ASYNC_FSTATUS, id);
+    if (fname == NULL ||
+        apr_file_open(&fh, fname, APR_FOPEN_READ, APR_OS_DEFAULT,
+                      r->pool) != APR_SUCCESS)
+        return FALSE;
+    buf = NULL;
+    if (apr_file_info_get(&finfo, APR_FINFO_SIZE, fh) == APR_SUCCESS &&
+        finfo.size > 0) {
+        len = (apr_size_t)finfo.size;
+        buf = (char*)apr_pcalloc(r->pool, len + 1);
+        if (apr_file_read_full(fh, buf, len, NULL) != APR_SUCCESS) buf = NULL;
+    }
+    apr_file_close(fh);
+    return buf != NULL &&
+           strcmp(buf + 1, r->user == NULL ? "" : r->user) == 0;
+}
+
+static int q2_rest_async_get_status(request_rec *r,
+                                    q2_rest_cfg_t *cfg,
+                                    const char *id)
+{
+    char ch;
+    const char *fname = NULL;
+    fname = q2_rest_async_fname(r->pool, cfg, Q2_REST_ASYNC_FSTATUS, id);
+    if (fname != NULL) {
+        if (q2_rest_file_read_char(r->pool, fname, &ch))
+            return (int)atoi(apr_psprintf(r->pool, "%c", ch));
+    }
+    return 0;
+}
+
+static int q2_rest_async_remove_request(request_rec *r,
+                                        q2_rest_cfg_t *cfg,
+                                        const char *id)
+{
+    apr_status_t rv;
+    apr_finfo_t finfo;
+    const char *fname;
+    if (id != NULL) {
+        fname = apr_psprintf(r->pool, Q2_REST_ASYNC_FREQUEST,
+                             cfg->async_path, id);
         if (fname != NULL) {
             rv = apr_stat(&finfo, fname, APR_FINFO_NORM, r->pool);
             if (rv == APR_SUCCESS) apr_file_remove(fname, r->pool);
@@ -3749,8 +6281,7 @@ static int q2_rest_async_remove_status(request_rec *r, q2_rest_cfg_t *cfg,
     apr_finfo_t finfo;
     const char *fname;
     if (id != NULL) {
-        fname = apr_psprintf(r->pool, Q2_REST_ASYNC_FSTATUS,
-                             cfg->async_path, id);
+        fname = q2_rest_async_fname(r->pool, cfg, Q2_REST_ASYNC_FSTATUS, id);
         if (fname != NULL) {
             rv = apr_stat(&finfo, fname, APR_FINFO_NORM, r->pool);
             if (rv == APR_SUCCESS) apr_file_remove(fname, r->pool);
@@ -3759,6 +6290,111 @@ static int q2_rest_async_remove_status(request_rec *r, q2_rest_cfg_t *cfg,
     return FALSE;
 }
 
+static int q2_rest_async_save_data(request_rec *r,
+                                   q2_rest_cfg_t *cfg,
+                                   const char *data,
+                                   const char **id)
+{
+    int rv;
+    int rand_num;
+    const char *ctype;
+    const char *accept;
+    const char *auth;
+    const char *date;
+    const char *fdata;
+    const char *fname;
+    ctype = apr_table_get(r->headers_in, "Content-Type");
+    accept = apr_table_get(r->headers_in, "Accept");
+    auth = apr_table_get(r->headers_in, "Authentication");
+    date = apr_table_get(r->headers_in, "Date");
+    if (auth == NULL || ctype == NULL || accept == NULL || date == NULL)
+        return FALSE;
+    *id = q2_rest_md5(r->pool, apr_psprintf(r->pool, "%s-%s-%" APR_TIME_T_FMT,
+                                       auth, r->unparsed_uri,
+                                       apr_time_now()));
+    if (*id == NULL) return FALSE;
+    fname = apr_psprintf(r->pool, Q2_REST_ASYNC_FREQUEST,
+                         cfg->async_path, *id);
+    fdata = apr_psprintf(r->pool, Q2_REST_ASYNC_REQUEST, r->the_request,
+                         r->server->server_hostname,
+                         accept, ctype, *id, auth, date,
+                         data == NULL ? "\0" : data);
+    if (fname == NULL || fdata == NULL) return FALSE;
+    //! status and counter first: once published, the job may complete
+    //! before this request returns
+    if (!q2_rest_async_save_status(r->pool, cfg, *id,
+                                   apr_pstrcat(r->pool, Q2_REST_ASYNC_PROGRESS,
+                                               r->user == NULL ? "" : r->user,
+                                               NULL)))
+        return FALSE;
+    q2_rest_async_pending(cfg, 1);
+    //! a full ring falls back to the request files
+    if (cfg->async_ring != NULL && q2_rest_async_enqueue(r, cfg, *id, fdata))
+        return TRUE;
+    if (cfg->segment != NULL &&
+        (rv = q2_rest_segment_push(r, cfg, *id, fdata)) != 0) {
+        if (rv > 0) return TRUE;
+    } else if (q2_rest_write_file(r->pool, fname, fdata)) {
+        return TRUE;
+    }
+    q2_rest_async_pending(cfg, -1);
+    q2_rest_async_remove_status(r, cfg, *id);
+    return FALSE;
+}
+
+//! Result entry: "<expiry>\n<json>", kept in shared memory and spilled to
+//! a file next to the status file when it is too large or its slot is taken
+static int q2_rest_async_save_result(apr_pool_t *mp,
+                                     q2_rest_cfg_t *cfg,
+                                     const char *id,
+                                     const char *res)
+{
+    const char *entry;
+    apr_time_t expires;
+    if (cfg->async_result_ttl <= 0 || id == NULL || res == NULL) return FALSE;
+    expires = apr_time_now() + apr_time_from_sec(cfg->async_result_ttl);
+    entry = apr_psprintf(mp, "%" APR_TIME_T_FMT "\n%s", expires, res);
+    if (!q2_shm_cache_add(cfg->async_results, id, entry, strlen(entry),
+                          cfg->async_result_ttl))
+        return TRUE;
+    return q2_rest_async_write(mp, cfg, Q2_REST_ASYNC_FRESULT, id, entry);
+}
+
+//! The JSON result and its expiry, NULL when there is none or it expired
+static const char* q2_rest_async_get_result(request_rec *r,
+                                            q2_rest_cfg_t *cfg,
+                                            const char *id,
+                                            apr_time_t *expires)
+{
+    char *entry = NULL, *res;
+    const char *fname;
+    apr_size_t len;
+    apr_file_t *fh;
+    apr_finfo_t finfo;
+    if (cfg->async_result_ttl <= 0 || id == NULL) return NULL;
+    fname = q2_rest_async_fname(r->pool, cfg, Q2_REST_ASYNC_FRESULT, id);
+    if (fname == NULL) return NULL;
+    entry = q2_shm_cache_get(cfg->async_results, r->pool, id, &len);
+    if (entry == NULL &&
+        apr_file_open(&fh, fname, APR_FOPEN_READ, APR_OS_DEFAULT,
+                      r->pool) == APR_SUCCESS) {
+        if (apr_file_info_get(&finfo, APR_FINFO_SIZE, fh) == APR_SUCCESS) {
+            entry = (char*)apr_pcalloc(r->pool, (apr_size_t)finfo.size + 1);
+            if (apr_file_read_full(fh, entry, (apr_size_t)finfo.size,
+                                   NULL) != APR_SUCCESS)
+                entry = NULL;
+        }
+        apr_file_close(fh);
+    }
+    if (entry == NULL) return NULL;
+    *expires = (apr_time_t)apr_atoi64(entry);
+    if ((res = strchr(entry, '\n')) == NULL || *expires <= apr_time_now()) {
+        apr_file_remove(fname, r->pool);
+        return NULL;
+    }
+    return res + 1;
+}
+
 static apr_table_t* q2_rest_request_formdata(request_rec *r)
 {
     int rv;
@@ -3828,6 +6464,137 @@ static int q2_rest_valid_data(request_rec *r, apr_table_t **params,
     return TRUE;
 }
 
+//! Value of a "name=value" preference of the Prefer header (RFC 7240)
+static const char* q2_rest_prefer(request_rec *r, const char *name)
+{
+    size_t len;
+    char *tok, *last, *end;
+    const char *prefer = apr_table_get(r->headers_in, "Prefer");
+    if (prefer == NULL || name == NULL) return NULL;
+    len = strlen(name);
+    tok = apr_strtok(apr_pstrdup(r->pool, prefer), ",;", &last);
+    for (; tok != NULL; tok = apr_strtok(NULL, ",;", &last)) {
+        while (isspace((unsigned char)*tok)) tok ++;
+        if (strncasecmp(tok, name, len) != 0 || tok[len] != '=') continue;
+        tok += len + 1;
+        end = tok + strlen(tok);
+        while (end > tok && isspace((unsigned char)end[-1])) *(--end) = '\0';
+        return tok;
+    }
+    return NULL;
+}
+
+//! Drops a reference, with the graph lock held
+static void q2_rest_graph_unref(q2_rest_graph_ref_t *ref)
+{
+    if (--ref->refs == 0) apr_pool_destroy(ref->pool);
+}
+
+static apr_status_t q2_rest_graph_release(void *data)
+{
+    q2_rest_graph_ref_t *ref = (q2_rest_graph_ref_t*)data;
+    apr_thread_mutex_t *mutex = ref->mutex;
+    apr_thread_mutex_lock(mutex);
+    q2_rest_graph_unref(ref);
+    apr_thread_mutex_unlock(mutex);
+    return APR_SUCCESS;
+}
+
+//! Builds a graph in its own subpool and publishes it, with the graph lock
+//! held or at child init. The graph it replaces is freed when the last
+//! request using it is over.
+static q2_rest_graph_ref_t* q2_rest_graph_build(q2_rest_cfg_t *cfg,
+                                                ap_dbd_t *dbd)
+{
+    q2_rest_graph_ref_t *ref;
+    apr_pool_t *pool;
+    cfg->graph_next = apr_time_now() + apr_time_from_sec(Q2_REST_GRAPH_RETRY);
+    if (apr_pool_create(&pool, cfg->graph_pool) != APR_SUCCESS) return NULL;
+    ref = (q2_rest_graph_ref_t*)apr_pcalloc(pool, sizeof(q2_rest_graph_ref_t));
+    ref->graph = q2_relation_graph(pool, dbd->driver, dbd->handle);
+    if (ref->graph == NULL) {
+        apr_pool_destroy(pool);
+        return NULL;
+    }
+    ref->pool = pool;
+    ref->refs = 1;
+    ref->mutex = cfg->graph_mutex;
+    if (cfg->graph != NULL) q2_rest_graph_unref(cfg->graph);
+    cfg->graph = ref;
+    return ref;
+}
+
+//! Returns the graph built at child init, building it on first use when
+//! no connection was available at that time. A failed build is retried,
+//! and a reload ("Q2-Schema: reload") rebuilt, at most once every
+//! Q2_REST_GRAPH_RETRY seconds. The graph stays valid until pool is
+//! cleared, even if it is replaced meanwhile.
+static q2_graph_t* q2_rest_graph(q2_rest_cfg_t *cfg, ap_dbd_t *dbd,
+                                 int reload, apr_pool_t *pool)
+{
+    q2_rest_graph_ref_t *ref;
+    if (!cfg->relation_graph || cfg->graph_pool == NULL ||
+        cfg->graph_mutex == NULL)
+        return NULL;
+    apr_thread_mutex_lock(cfg->graph_mutex);
+    ref = cfg->graph;
+    if ((ref == NULL || reload) && dbd != NULL &&
+        apr_time_now() >= cfg->graph_next &&
+        q2_rest_graph_build(cfg, dbd) != NULL)
+        ref = cfg->graph;
+    if (ref != NULL) ref->refs ++;
+    apr_thread_mutex_unlock(cfg->graph_mutex);
+    if (ref == NULL) return NULL;
+    apr_pool_cleanup_register(pool, ref, q2_rest_graph_release,
+                              apr_pool_cleanup_null);
+    return ref->graph;
+}
+
+static int q2_rest_schema_reload(request_rec *r)
+{
+    const char *schema;
+    if ((schema = apr_table_get(r->headers_in, Q2_REST_SCHEMA_HEADER)) != NULL)
+        return strcmp(schema, Q2_REST_SCHEMA_RELOAD) == 0;
+    return FALSE;
+}
+
+//! "Prefer: attributes=include" or ?_attributes=1, the flag is removed from
+//! params so that it is not taken for a column filter
+static int q2_rest_want_attributes(request_rec *r, apr_table_t **params)
+{
+    const char *v = NULL;
+    int want = 0;
+    if (*params != NULL && (v = apr_table_get(*params,
+                                              Q2_REST_ATTRS_PARAM)) != NULL) {
+        want = (int)(strcmp(v, "1") == 0 || strcasecmp(v, "true") == 0);
+        apr_table_unset(*params, Q2_REST_ATTRS_PARAM);
+        if ((apr_table_elts(*params))->nelts <= 0) *params = NULL;
+    }
+    if ((v = q2_rest_prefer(r, "attributes")) != NULL)
+        want = (int)(strcasecmp(v, "include") == 0);
+    return want;
+}
+
+//! OPTIONS /q2/v1/<table>: the attributes, fetched once and revalidated
+static int q2_rest_schema(request_rec *r, q2_t *q2)
+{
+    const char *payload, *etag, *res_etag;
+    q2_json_t *w = q2_json_make(r->pool, Q2_JSON_BUFSIZE);
+    if (w == NULL) return HTTP_INTERNAL_SERVER_ERROR;
+    q2_encode_schema(q2, w);
+    if ((payload = q2_json_get(w)) == NULL) return HTTP_INTERNAL_SERVER_ERROR;
+    res_etag = apr_psprintf(r->pool, "W/\"%s\"", q2_rest_etag_gen(r, payload));
+    apr_table_set(r->headers_out, "ETag", res_etag);
+    apr_table_set(r->headers_out, "Allow", Q2_REST_ALLOW);
+    apr_table_set(r->headers_out, "Cache-Control", "no-cache");
+    if (q2_rest_want_none_match(r, &etag))
+        if (q2_rest_etag_match(r->pool, etag, res_etag))
+            return HTTP_NOT_MODIFIED;
+    ap_set_content_type(r, Q2_REST_CTYPE_JSON);
+    ap_rwrite(payload, (int)w->len, r);
+    return OK;
+}
+
 static int q2_rest_prefer_minimal(request_rec *r)
 {
     const char *prefer;
@@ -3836,13 +6603,12 @@ static int q2_rest_prefer_minimal(request_rec *r)
     return FALSE;
 }
 
-static const char* q2_hateoas(q2_t *q2)
+//! Appends the links of a result row to links, comma separated
+static void q2_hateoas_row(q2_t *q2, q2_json_t *links, apr_table_t *result)
 {
-    const char *l, *links_s, *attrs_s, *col, *opt, *rel, *rpk, *val;
-    apr_array_header_t *links;
-    apr_table_t *t, *result;
-    if (q2->attributes == NULL) return NULL;
-    links = apr_array_make(q2->pool, 0, sizeof(const char*));
+    const char *col, *opt, *rel, *rpk, *val;
+    apr_table_t *t;
+    if (q2->attributes == NULL || result == NULL) return;
     for (int i = 0; i < q2->attributes->nelts; i++) {
         t = APR_ARRAY_IDX(q2->attributes, i, apr_table_t*);
         if (t != NULL) {
@@ -3851,19 +6617,46 @@ static const char* q2_hateoas(q2_t *q2)
             rel = apr_table_get(t, "referenced_table");
             rpk = apr_table_get(t, "referenced_pk");
             if (col != NULL && opt != NULL && rel != NULL && rpk != NULL && strcmp(opt, "null")) {
-                for (int j = 0; j < q2->results->nelts; j++) {
-                    result = APR_ARRAY_IDX(q2->results, j, apr_table_t*);
-                    if (result != NULL) {
-                        val = apr_table_get(result, col);
-                        if (val != NULL) {
-                            l = apr_psprintf(q2->pool, "%s/%s;rel=\"%s\"", rel, val, rel);
-                            APR_ARRAY_PUSH(links, const char*) = l;
-                        }
-                    }
+                val = apr_table_get(result, col);
+                if (val != NULL) {
+                    if (links->len > 0) q2_json_putc(links, ',');
+                    q2_json_putc(links, '"');
+                    q2_json_escape(links, rel, strlen(rel));
+                    q2_json_putc(links, '/');
+                    q2_json_escape(links, val, strlen(val));
+                    q2_json_escape(links, ";rel=\"", 6);
+                    q2_json_escape(links, rel, strlen(rel));
+                    q2_json_escape(links, "\"", 1);
+                    q2_json_putc(links, '"');
                 }
             }
         }
     }
+}
+
+static void q2_hateoas_links(q2_json_t *w, q2_json_t *links)
+{
+    if (links == NULL || links->len == 0) {
+        q2_json_write(w, "null", 4);
+        return;
+    }
+    q2_json_putc(w, '[');
+    q2_json_write(w, links->buf, links->len);
+    q2_json_putc(w, ']');
+}
+
+static void q2_hateoas(q2_t *q2, q2_json_t *w)
+{
+    q2_json_t *links;
+    if (q2->attributes == NULL || q2->results == NULL) {
+        q2_json_write(w, "null", 4);
+        return;
+    }
+    links = q2_json_make(q2->pool, 1024);
+    if (q2->results != NULL)
+        for (int j = 0; j < q2->results->nelts; j++)
+            q2_hateoas_row(q2, links,
+                           APR_ARRAY_IDX(q2->results, j, apr_table_t*));
     // attrs_s = q2->attributes == NULL
     //     ? NULL
     //     : q2_json_array(q2->pool, q2->attributes, Q2_TP_TABLE);
@@ -3873,9 +6666,332 @@ static const char* q2_hateoas(q2_t *q2)
     // return apr_psprintf(q2->pool, "{\"links\":%s,\"attributes\":%s}",
     //                     links_s == NULL ? "null" : links_s,
     //                     attrs_s == NULL ? "null" : attrs_s);
-    return links == NULL
-        ? NULL
-        : q2_json_array(q2->pool, links, Q2_STRING);
+    q2_hateoas_links(w, links);
+}
+
+//! Generation of a table, shared by the tables with the same hash
+static volatile apr_uint32_t* q2_rest_gen(q2_rest_cfg_t *cfg, const char *tab)
+{
+    apr_ssize_t klen = (apr_ssize_t)strlen(tab);
+    unsigned int h = apr_hashfunc_default(tab, &klen);
+    return &(cfg->gens[1 + h % Q2_REST_RCACHE_GENS]);
+}
+
+//! The epoch is bumped first: a GET that sees a new table generation also
+//! sees the new epoch and does not store what it read before the write
+static void q2_rest_gen_bump(q2_rest_cfg_t *cfg, apr_array_header_t *tabs)
+{
+    if (cfg->gens == NULL || tabs == NULL) return;
+    apr_atomic_inc32(&(cfg->gens[0]));
+    for (int i = 0; i < tabs->nelts; i++)
+        apr_atomic_inc32(q2_rest_gen(cfg, APR_ARRAY_IDX(tabs, i, const char*)));
+}
+
+static int q2_rest_rcache_cmp(const void *a, const void *b)
+{
+    return strcmp(*(const char**)a, *(const char**)b);
+}
+
+//! Principal, path, query arguments in sorted order and preferences
+static const char* q2_rest_rcache_key(request_rec *r)
+{
+    char *tok, *last;
+    const char *prefer;
+    apr_array_header_t *args = apr_array_make(r->pool, 4, sizeof(char*));
+    if (r->args != NULL) {
+        tok = apr_strtok(apr_pstrdup(r->pool, r->args), "&", &last);
+        for (; tok != NULL; tok = apr_strtok(NULL, "&", &last))
+            APR_ARRAY_PUSH(args, char*) = tok;
+        qsort(args->elts, args->nelts, sizeof(char*), q2_rest_rcache_cmp);
+    }
+    prefer = apr_table_get(r->headers_in, "Prefer");
+    return q2_rest_md5(r->pool,
+                       apr_pstrcat(r->pool, r->user == NULL ? "" : r->user,
+                                   "\n", r->parsed_uri.path, "?",
+                                   apr_array_pstrcat(r->pool, args, '&'),
+                                   "\n", prefer == NULL ? "" : prefer,
+                                   NULL));
+}
+
+//! Entry: "<n> <gen index>:<gen>...\n<etag>\n<payload>", served only if no
+//! generation changed since it was stored
+static int q2_rest_rcache_get(request_rec *r, q2_rest_cfg_t *cfg,
+                              const char *key)
+{
+    int n;
+    char *data, *p, *etag_p;
+    const char *etag;
+    apr_size_t len;
+    unsigned long idx, gen;
+    if ((data = q2_shm_cache_get(cfg->response_cache, r->pool,
+                                 key, &len)) == NULL) return DECLINED;
+    n = (int)strtol(data, &p, 10);
+    for (int i = 0; i < n; i++) {
+        idx = strtoul(p, &p, 10);
+        if (*p ++ != ':' || idx < 1 || idx > Q2_REST_RCACHE_GENS)
+            return DECLINED;
+        gen = strtoul(p, &p, 10);
+        if (apr_atomic_read32(&(cfg->gens[idx])) != (apr_uint32_t)gen) {
+            q2_shm_cache_remove(cfg->response_cache, key);
+            return DECLINED;
+        }
+    }
+    if (*p ++ != '\n' || (etag_p = strchr(p, '\n')) == NULL) return DECLINED;
+    *etag_p ++ = '\0';
+    if (*p != '\0') {
+        apr_table_set(r->headers_out, "ETag", p);
+        if (q2_rest_want_none_match(r, &etag))
+            if (q2_rest_etag_match(r->pool, etag, p))
+                return HTTP_NOT_MODIFIED;
+    }
+    ap_rwrite(etag_p, (int)(len - (apr_size_t)(etag_p - data)), r);
+    return OK;
+}
+
+static void q2_rest_rcache_set(request_rec *r, q2_rest_cfg_t *cfg, q2_t *q2,
+                               const char *key, apr_uint32_t epoch,
+                               const char *payload, apr_size_t len)
+{
+    const char *etag, *head;
+    volatile apr_uint32_t *gen;
+    apr_array_header_t *tabs, *gens;
+    if ((tabs = q2_get_dep_tables(q2)) == NULL) return;
+    gens = apr_array_make(r->pool, tabs->nelts, sizeof(const char*));
+    for (int i = 0; i < tabs->nelts; i++) {
+        gen = q2_rest_gen(cfg, APR_ARRAY_IDX(tabs, i, const char*));
+        APR_ARRAY_PUSH(gens, const char*) =
+            apr_psprintf(r->pool, " %d:%u", (int)(gen - cfg->gens),
+                         apr_atomic_read32(gen));
+    }
+    //! a write ran meanwhile, what was read may already be stale
+    if (apr_atomic_read32(&(cfg->gens[0])) != epoch) return;
+    etag = apr_table_get(r->headers_out, "ETag");
+    head = apr_psprintf(r->pool, "%d%s\n%s\n", gens->nelts,
+                        apr_array_pstrcat(r->pool, gens, 0),
+                        etag == NULL ? "" : etag);
+    q2_shm_cache_set(cfg->response_cache, key,
+                     apr_pstrcat(r->pool, head, payload, NULL),
+                     strlen(head) + len, cfg->response_cache_ttl);
+}
+
+//! Weak ETag of a resolved GET built from the generations of the tables it
+//! reads, plus the version column of the target when configured. Known
+//! before any query, so unchanged resources are answered with 304 at once.
+//! The preferences change the representation, so they are part of it.
+static const char* q2_rest_version_etag(request_rec *r, q2_rest_cfg_t *cfg,
+                                        q2_t *q2)
+{
+    const char *v, *prefer;
+    apr_array_header_t *tabs, *parts;
+    volatile apr_uint32_t *gen;
+    if (cfg->gens == NULL || q2_resolve(q2)) return NULL;
+    if ((tabs = q2_get_dep_tables(q2)) == NULL) return NULL;
+    parts = apr_array_make(r->pool, tabs->nelts + 2, sizeof(const char*));
+    APR_ARRAY_PUSH(parts, const char*) =
+        apr_psprintf(r->pool, "%" APR_TIME_T_FMT, cfg->gens_boot);
+    for (int i = 0; i < tabs->nelts; i++) {
+        gen = q2_rest_gen(cfg, APR_ARRAY_IDX(tabs, i, const char*));
+        APR_ARRAY_PUSH(parts, const char*) =
+            apr_psprintf(r->pool, " %d:%u", (int)(gen - cfg->gens),
+                         apr_atomic_read32(gen));
+    }
+    if ((v = q2_get_table_version(q2)) != NULL)
+        APR_ARRAY_PUSH(parts, const char*) = apr_pstrcat(r->pool, " ", v, NULL);
+    prefer = apr_table_get(r->headers_in, "Prefer");
+    apr_table_merge(r->headers_out, "Vary", "Prefer");
+    return apr_psprintf(r->pool, "W/\"%s\"",
+                        q2_rest_md5(r->pool,
+                                    apr_pstrcat(r->pool, r->unparsed_uri, "\n",
+                                                prefer == NULL ? "" : prefer,
+                                                "\n",
+                                                apr_array_pstrcat(r->pool,
+                                                                  parts, 0),
+                                                NULL)));
+}
+
+static int q2_rest_stream_write(void *ctx, const char *buf, apr_size_t len)
+{
+    q2_rest_stream_t *st = (q2_rest_stream_t*)ctx;
+    return apr_brigade_write(st->bb, ap_filter_flush, st->r->output_filters,
+                             buf, len) != APR_SUCCESS;
+}
+
+static int q2_rest_stream_row(void *ctx, apr_pool_t *mp, apr_table_t *row)
+{
+    q2_rest_stream_t *st = (q2_rest_stream_t*)ctx;
+    if (st->r->connection->aborted) return 1;
+    q2_json_putc(st->w, st->rows ? ',' : '[');
+    if (st->emit == NULL)
+        st->emit = q2_json_emitters(st->r->pool, q2_get_columns(st->q2),
+                                    q2_get_rows_table(st->q2), row);
+    q2_json_row(st->w, row, st->emit);
+    //! full buffers go down by themselves, this bounds the latency
+    if (++ st->rows % Q2_REST_STREAM_FLUSH == 0) {
+        if (q2_json_flush(st->w)) return 1;
+        return ap_fflush(st->r->output_filters, st->bb) != APR_SUCCESS;
+    }
+    return st->w->error;
+}
+
+static q2_rest_stream_t* q2_rest_stream_make(request_rec *r, q2_t *q2)
+{
+    q2_rest_stream_t *st;
+    st = (q2_rest_stream_t*)apr_palloc(r->pool, sizeof(q2_rest_stream_t));
+    if (st == NULL) return NULL;
+    st->r = r;
+    st->q2 = q2;
+    st->bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+    st->w = q2_json_make(r->pool, Q2_JSON_BUFSIZE);
+    st->emit = NULL;
+    st->rows = 0;
+    if (st->w == NULL) return NULL;
+    q2_json_set_flush(st->w, q2_rest_stream_write, st);
+    return st;
+}
+
+//! Writes the payload of a streamed GET: the rows go to the client as soon
+//! as they are read, pagination follows them. The links of the rows would
+//! have to be kept until the end, streamed lists have none.
+static int q2_rest_stream(request_rec *r, q2_t *q2, q2_rest_stream_t *st)
+{
+    q2_json_puts(st->w, "{\"body\":");
+    q2_encode_json_head(q2, st->w);
+    q2_json_flush(st->w);
+    ap_fflush(r->output_filters, st->bb);
+    q2_stream_results(q2);
+    q2_json_puts(st->w, st->rows ? "]" : "null");
+    q2_encode_json_tail(q2, st->w);
+    q2_json_puts(st->w, ",\"_links\":null}");
+    if (q2_json_flush(st->w)) return AP_FILTER_ERROR;
+    return ap_pass_brigade(r->output_filters, st->bb) == APR_SUCCESS
+        ? OK
+        : AP_FILTER_ERROR;
+}
+
+//! A status as JSON, or as a "status" event of a text/event-stream
+static void q2_rest_async_status(request_rec *r,
+                                 const char *status,
+                                 const char *result,
+                                 apr_time_t expires,
+                                 int events)
+{
+    q2_json_t *w = q2_json_make(r->pool, 64);
+    if (events) q2_json_puts(w, "event: status\ndata: ");
+    q2_json_puts(w, "{\"status\":");
+    q2_json_string(w, status);
+    if (result != NULL) {
+        q2_json_puts(w, ",\"expires_in\":");
+        q2_json_int(w, (int)apr_time_sec(expires - apr_time_now()));
+        q2_json_puts(w, ",\"result\":");
+        q2_json_puts(w, result);
+    }
+    q2_json_putc(w, '}');
+    if (events) q2_json_puts(w, "\n\n");
+    if (w->error) return;
+    ap_rwrite(w->buf, (int)w->len, r);
+    if (events) ap_rflush(r);
+}
+
+//! True when the Accept list names text/event-stream, parameters and
+//! quality values aside, unless it is refused with q=0
+static int q2_rest_async_events(request_rec *r)
+{
+    char *tok, *last, *p;
+    const char *accept = apr_table_get(r->headers_in, "Accept");
+    if (accept == NULL) return FALSE;
+    tok = apr_strtok(apr_pstrdup(r->pool, accept), ",", &last);
+    for (; tok != NULL; tok = apr_strtok(NULL, ",", &last)) {
+        while (isspace((unsigned char)*tok)) tok ++;
+        p = tok + strcspn(tok, "; \t");
+        if ((apr_size_t)(p - tok) != sizeof(Q2_REST_CTYPE_EVENTS) - 1 ||
+            strncasecmp(tok, Q2_REST_CTYPE_EVENTS, p - tok) != 0)
+            continue;
+        p = strstr(p, "q=");
+        return p == NULL || atof(p + 2) > 0;
+    }
+    return FALSE;
+}
+
+//! Seconds GET /q2/v1/async/<id>?wait=<s> may be held, up to
+//! Q2AsyncWaitMax. Event streams wait the longest time by default.
+static int q2_rest_async_wait_time(request_rec *r,
+                                   q2_rest_cfg_t *cfg,
+                                   int events)
+{
+    int sec;
+    const char *wait = NULL;
+    apr_table_t *args = NULL;
+    if (cfg->async_wait_max <= 0 || cfg->async_stats == NULL) return 0;
+    if (r->args != NULL && !q2_args_to_table(r->pool, &args, r->args) &&
+        args != NULL)
+        wait = apr_table_get(args, "wait");
+    if (wait == NULL) return events ? cfg->async_wait_max : 0;
+    sec = atoi(wait);
+    if (sec <= 0) return 0;
+    return sec < cfg->async_wait_max ? sec : cfg->async_wait_max;
+}
+
+//! Holds the request until the job completes, the wait expires or the
+//! client goes away. The executor runs in another process: it counts the
+//! completed jobs in shared memory and the status file is read again only
+//! when the counter moves.
+static int q2_rest_async_wait(request_rec *r,
+                              q2_rest_cfg_t *cfg,
+                              const char *id,
+                              int sec,
+                              int events)
+{
+    int status;
+    apr_uint32_t seen;
+    apr_time_t now = apr_time_now();
+    apr_time_t until = now + apr_time_from_sec(sec);
+    apr_time_t ping = now + apr_time_from_sec(Q2_REST_WAIT_PING);
+    for (;;) {
+        //! read before the status, a completion in between is not missed
+        seen = cfg->async_stats != NULL
+            ? apr_atomic_read32(&(cfg->async_stats->done))
+            : 0;
+        status = q2_rest_async_get_status(r, cfg, id);
+        if (status != atoi(Q2_REST_ASYNC_PROGRESS)) return status;
+        do {
+            if ((now = apr_time_now()) >= until || r->connection->aborted)
+                return status;
+            if (events && now >= ping) {
+                //! comment line, keeps proxies from closing the stream
+                ap_rputs(": ping\n\n", r);
+                ap_rflush(r);
+                ping = now + apr_time_from_sec(Q2_REST_WAIT_PING);
+            }
+            apr_sleep(apr_time_from_msec(Q2_REST_WAIT_POLL_MS));
+        } while (apr_atomic_read32(&(cfg->async_stats->done)) == seen);
+    }
+}
+
+//! Exchanges a successful HMAC authentication for a session token. A token
+//! cannot be renewed with itself, the credentials are needed again.
+static int q2_rest_token(request_rec *r, q2_rest_cfg_t *cfg)
+{
+    const char *token;
+    apr_time_t expires;
+    q2_json_t *w;
+    if (r->ap_auth_type == NULL ||
+        strcmp(r->ap_auth_type, Q2_REST_HMAC_SCHEME) != 0)
+        return HTTP_FORBIDDEN;
+    expires = apr_time_sec(apr_time_now()) + cfg->token_ttl;
+    if ((token = q2_rest_token_issue(r, cfg, expires)) == NULL)
+        return HTTP_INTERNAL_SERVER_ERROR;
+    w = q2_json_make(r->pool, 256);
+    q2_json_puts(w, "{\"token\":");
+    q2_json_string(w, token);
+    q2_json_puts(w, ",\"token_type\":\"" Q2_REST_TOKEN_SCHEME "\"");
+    q2_json_puts(w, ",\"expires_in\":");
+    q2_json_int(w, cfg->token_ttl);
+    q2_json_putc(w, '}');
+    if (w->error) return HTTP_INTERNAL_SERVER_ERROR;
+    apr_table_set(r->headers_out, "Cache-Control", "no-store");
+    ap_set_content_type(r, Q2_REST_CTYPE_JSON);
+    ap_rwrite(w->buf, (int)w->len, r);
+    return OK;
 }
 
 static int q2_rest_request_handler(request_rec *r)
@@ -3889,9 +7005,14 @@ static int q2_rest_request_handler(request_rec *r)
     apr_table_t *params = NULL;
     const char *er;
     const char *out;
+    int range_from, range_to;
+    q2_rest_stream_t *stream = NULL;
+    const char *rc_key = NULL;
+    apr_uint32_t rc_epoch = 0;
+    const char *ver_etag = NULL, *etag = NULL;
 
     dbd_fn = APR_RETRIEVE_OPTIONAL_FN(ap_dbd_acquire);
-    dbd = dbd_fn(r);
+    dbd = NULL;
     cfg = (q2_rest_cfg_t*)ap_get_module_config(r->server->module_config,
                                                &q2_module);
 
@@ -3900,6 +7021,9 @@ static int q2_rest_request_handler(request_rec *r)
     if (!q2_rest_valid_content_type(r)) return HTTP_UNSUPPORTED_MEDIA_TYPE;
     if (!q2_rest_valid_accept(r)) return HTTP_NOT_ACCEPTABLE;
     if (!q2_rest_authorized(r, dbd, cfg)) return HTTP_UNAUTHORIZED;
+    if (cfg->token_ttl > 0 && r->method_number == M_POST &&
+        strcmp(r->parsed_uri.path, Q2_REST_TOKEN_URI) == 0)
+        return q2_rest_token(r, cfg);
 
     // cfg->hostname = apr_pstrdup(r->pool, r->server->server_hostname);
     // cfg->server_port = r->server->port;
@@ -3919,19 +7043,47 @@ static int q2_rest_request_handler(request_rec *r)
     //! }
     //!
     if (cfg->async_path != NULL) {
-        const char *async_id = q2_rest_async_id(r, r->unparsed_uri);
+        const char *async_id = q2_rest_async_id(r, r->parsed_uri.path);
         if (async_id != NULL) {
             int async_status = q2_rest_async_get_status(r, cfg, async_id);
-            if (!async_status) return HTTP_NOT_FOUND;
+            int events = q2_rest_async_events(r);
+            int wait = q2_rest_async_wait_time(r, cfg, events);
+            const char *result;
+            apr_time_t expires = 0;
+            if (!async_status || !q2_rest_async_owned(r, cfg, async_id))
+                return HTTP_NOT_FOUND;
+            if (events) {
+                ap_set_content_type(r, Q2_REST_CTYPE_EVENTS);
+                apr_table_set(r->headers_out, "Cache-Control", "no-cache");
+            }
+            if (async_status != atoi(Q2_REST_ASYNC_DONE) && wait > 0) {
+                if (events)
+                    q2_rest_async_status(r, "In progress...", NULL, 0, 1);
+                async_status = q2_rest_async_wait(r, cfg, async_id, wait,
+                                                  events);
+                //! the status was forgotten while waiting
+                if (!async_status) {
+                    if (!events) return HTTP_NOT_FOUND;
+                    q2_rest_async_status(r, "Not found.", NULL, 0, 1);
+                    return OK;
+                }
+            }
             if (async_status == atoi(Q2_REST_ASYNC_DONE)) {
-                ap_rprintf(r, Q2_REST_ASYNC_STATUS, "Completed.");
-                q2_rest_async_remove_status(r, cfg, async_id);
+                //! a stored result can be read until it expires
+                result = q2_rest_async_get_result(r, cfg, async_id, &expires);
+                q2_rest_async_status(r, "Completed.", result, expires,
+                                     events);
+                if (result == NULL)
+                    q2_rest_async_remove_status(r, cfg, async_id);
             } else {
-                ap_rprintf(r, Q2_REST_ASYNC_STATUS, "In progress...");
+                //! the last event of a stream that timed out, a dropped
+                //! connection has none
+                q2_rest_async_status(r, "In progress...", NULL, 0, events);
             }
             return OK;
         }
     }
+    dbd = dbd_fn(r);
     //! ========================================================================
 
     //! ========================================================================
@@ -3949,6 +7101,16 @@ static int q2_rest_request_handler(request_rec *r)
     //!
     if (!q2_rest_valid_data(r, &params, &rawdata, &rawlen))
         return HTTP_BAD_REQUEST;
+
+    if (cfg->response_cache != NULL && r->method_number == M_GET &&
+        apr_table_get(r->headers_in, "If-Match") == NULL &&
+        !q2_rest_range(r, &range_from, &range_to) &&
+        !q2_rest_schema_reload(r)) {
+        rc_key = q2_rest_rcache_key(r);
+        rc_epoch = apr_atomic_read32(&(cfg->gens[0]));
+        if ((rv = q2_rest_rcache_get(r, cfg, rc_key)) != DECLINED)
+            return rv;
+    }
     //! ========================================================================
 
     //! ========================================================================
@@ -3971,10 +7133,15 @@ static int q2_rest_request_handler(request_rec *r)
     //!     return HTTP_INTERNAL_SERVER_ERROR;
     //! }
     //!
-    if (r->method_number != M_GET) {
+    if (r->method_number != M_GET && r->method_number != M_OPTIONS) {
         const char *async = apr_table_get(r->headers_in, Q2_REST_ASYNC_HEADER);
         if (async != NULL && (strcmp(async, "1") == 0)) {
             const char *query_string = NULL;
+            if (q2_rest_async_busy(cfg)) {
+                apr_table_set(r->err_headers_out, "Retry-After",
+                              Q2_REST_ASYNC_RETRY);
+                return HTTP_SERVICE_UNAVAILABLE;
+            }
             if (r->method_number == M_PUT)
                 if (r->parsed_uri.query != NULL)
                     query_string = apr_pstrdup(r->pool, r->parsed_uri.query);
@@ -3987,17 +7154,15 @@ static int q2_rest_request_handler(request_rec *r)
                                             ? rawdata
                                             : query_string,
                                         &async_id)) {
-                if (q2_rest_async_save_status(r, cfg, async_id, Q2_REST_ASYNC_PROGRESS)) {
-                    const char *loc = apr_psprintf(r->pool,
-                                                   Q2_REST_ASYNC_URI, async_id);
-                    apr_table_set(r->headers_out, "Location", loc);
-                    //! ===========================
-                    //!
-                    //! FIXME: return HTTP_ACCEPTED
-                    //!
-                    //! ===========================
-                    return OK;
-                }
+                const char *loc = apr_psprintf(r->pool,
+                                               Q2_REST_ASYNC_URI, async_id);
+                apr_table_set(r->headers_out, "Location", loc);
+                //! ===========================
+                //!
+                //! FIXME: return HTTP_ACCEPTED
+                //!
+                //! ===========================
+                return OK;
             }
             return HTTP_INTERNAL_SERVER_ERROR;
         }
@@ -4013,32 +7178,43 @@ static int q2_rest_request_handler(request_rec *r)
     q2_set_dbd(q2, dbd->driver, dbd->handle);
     q2_set_method(q2, r->method);
     q2_set_uri(q2, r->unparsed_uri);
+    q2_set_attributes(q2, q2_rest_want_attributes(r, &params));
     q2_set_params(q2, params);
     q2_set_rawdata(q2, rawdata, rawlen);
     q2_set_ppg(q2, cfg->pagination_ppg);
+    q2_set_count_mode(q2, cfg->count_mode);
+    q2_set_pagination_mode(q2, cfg->pagination_mode);
+    q2_set_count_mode(q2, q2_count_mode_parse(q2_rest_prefer(r, "count")));
+    q2_set_schema_cache(q2, cfg->schema_cache, cfg->schema_cache_ttl);
+    q2_set_schema_reload(q2, q2_rest_schema_reload(r));
+    q2_set_graph(q2, q2_rest_graph(cfg, dbd, q2_rest_schema_reload(r),
+                                 r->pool));
+    q2_set_stmt_cache(q2, q2_rest_stmt_cache(dbd), dbd->pool);
+    q2_set_version_column(q2, cfg->version_column);
+    if (cfg->version_etag && r->method_number == M_GET &&
+        (ver_etag = q2_rest_version_etag(r, cfg, q2)) != NULL) {
+        apr_table_set(r->headers_out, "ETag", ver_etag);
+        if (q2_rest_want_match(r, &etag))
+            if (!q2_rest_etag_match(r->pool, etag, ver_etag))
+                return HTTP_PRECONDITION_FAILED;
+        if (q2_rest_want_none_match(r, &etag))
+            if (q2_rest_etag_match(r->pool, etag, ver_etag))
+                return HTTP_NOT_MODIFIED;
+    }
+    if (cfg->stream_results && r->method_number == M_GET &&
+        !q2_rest_range(r, &range_from, &range_to)) {
+        if ((stream = q2_rest_stream_make(r, q2)) != NULL)
+            q2_set_row_fn(q2, q2_rest_stream_row, stream);
+    }
     rv = q2_acquire(q2);
     if (rv != APR_SUCCESS) {
         if ((er = q2_get_error(q2)) != NULL) ap_rprintf(r, "Error: %s\n\n", er);
         else ap_rprintf(r, "An error occurred.\n\n");
         return OK;
     }
-
-    //! ========================================================================
-    //!
-    //! TODO:
-    //!
-    //! const char *async_id;
-    //! if (q2_rest_valid_async_request(r, Q2_REST_ASYNC_CLOSE, &async_id))
-    //!     if (q2_rest_async_save_status(r, cfg, async_id, Q2_REST_ASYNC_DONE))
-    //!         return HTTP_NO_CONTENT;
-    //!
-    if (r->method_number != M_GET) {
-        const char *async = apr_table_get(r->headers_in, Q2_REST_ASYNC_HEADER);
-        if (async != NULL && strcmp(async, "1"))
-            if (q2_rest_async_save_status(r, cfg, async, "2"))
-                return OK;
-    }
-    //! ========================================================================
+    if (r->method_number == M_OPTIONS) return q2_rest_schema(r, q2);
+    if (r->method_number != M_GET)
+        q2_rest_gen_bump(cfg, q2_get_dep_tables(q2));
 
     const char *id, *loc;
     if (r->method_number != M_GET) {
@@ -4084,7 +7260,8 @@ static int q2_rest_request_handler(request_rec *r)
     //!     }
     //! }
     //!
-    int range_from, range_to;
+    if (q2_streaming(q2)) return q2_rest_stream(r, q2, stream);
+
     const char *partial = NULL;
     if (r->method_number == M_GET) {
         if (q2_rest_range(r, &range_from, &range_to)) {
@@ -4105,18 +7282,18 @@ static int q2_rest_request_handler(request_rec *r)
     }
     //! ========================================================================
 
-    out = q2_encode_json(q2);
-
-    const char *hateoas = q2_hateoas(q2);
-    const char *payload = apr_psprintf(r->pool,
-                                       "{\"body\":%s,\"_links\":%s}",
-                                       out,
-                                       hateoas == NULL
-                                            ? "null"
-                                            : hateoas);
-
-    const char *res_etag = NULL, *etag = NULL;
-    if (r->method_number == M_GET) {
+    q2_json_t *w = q2_json_make(r->pool, Q2_JSON_BUFSIZE);
+    if (w == NULL) return HTTP_INTERNAL_SERVER_ERROR;
+    q2_json_puts(w, "{\"body\":");
+    q2_encode_json(q2, w);
+    q2_json_puts(w, ",\"_links\":");
+    q2_hateoas(q2, w);
+    q2_json_putc(w, '}');
+    const char *payload = q2_json_get(w);
+    if (payload == NULL) return HTTP_INTERNAL_SERVER_ERROR;
+
+    const char *res_etag = NULL;
+    if (r->method_number == M_GET && ver_etag == NULL) {
         if (q2_contains_single_entity(q2)) {
             res_etag = q2_rest_etag_gen(r, payload);
             apr_table_set(r->headers_out, "ETag",
@@ -4134,75 +7311,177 @@ static int q2_rest_request_handler(request_rec *r)
         }
     }
 
-    ap_rprintf(r, "%s", payload);
+    if (rc_key != NULL)
+        q2_rest_rcache_set(r, cfg, q2, rc_key, rc_epoch, payload, w->len);
+    ap_rwrite(payload, (int)w->len, r);
     return OK;
 }
 
-static apr_status_t q2_rest_do_connect(apr_socket_t **sock,
-                                       q2_rest_url_data_t *d)
+//! Splits a queued request: "METHOD URI PROTO", the headers and the body
+static int q2_rest_async_parse(apr_pool_t *mp,
+                               const char *data,
+                               const char **method,
+                               const char **uri,
+                               const char **body)
+{
+    char *line, *last, *end;
+    if ((end = strstr(data, "\r\n")) == NULL) return FALSE;
+    line = apr_pstrndup(mp, data, (apr_size_t)(end - data));
+    *method = apr_strtok(line, " ", &last);
+    *uri = apr_strtok(NULL, " ", &last);
+    if (*method == NULL || *uri == NULL) return FALSE;
+    *body = (end = strstr(end, "\r\n\r\n")) == NULL ? "" : end + 4;
+    return TRUE;
+}
+
+//! Query arguments decoded as ap_args_to_table() does for the requests
+static apr_table_t* q2_rest_async_args(apr_pool_t *mp, const char *uri)
+{
+    apr_table_t *args;
+    const apr_array_header_t *arr;
+    apr_table_entry_t *e;
+    const char *query = strchr(uri, '?');
+    if (query == NULL) return NULL;
+    q2_args_to_table(mp, &args, query + 1);
+    if (args == NULL) return NULL;
+    arr = apr_table_elts(args);
+    e = (apr_table_entry_t*)arr->elts;
+    for (int i = 0; i < arr->nelts; i ++) {
+        ap_unescape_urlencoded(e[i].key);
+        ap_unescape_urlencoded(e[i].val);
+    }
+    return args;
+}
+
+static ap_dbd_t* q2_rest_async_dbd_open(q2_rest_cfg_t *cfg, apr_pool_t *mp)
 {
-    apr_sockaddr_t *sa;
-    apr_socket_t *s;
-    apr_status_t rv;
-    rv = apr_sockaddr_info_get(&sa, d->server, APR_INET, d->port, 0, d->pool);
-    if (rv != APR_SUCCESS) return rv;
-    rv = apr_socket_create(&s, sa->family, SOCK_STREAM, APR_PROTO_TCP, d->pool);
-    if (rv != APR_SUCCESS) return rv;
-    apr_socket_opt_set(s, APR_SO_NONBLOCK, 1);
-    apr_socket_timeout_set(s, Q2_REST_WD_SOCK_TIMEOUT);
-    rv = apr_socket_connect(s, sa);
-    if (rv != APR_SUCCESS) return rv;
-    apr_socket_opt_set(s, APR_SO_NONBLOCK, 0);
-    apr_socket_timeout_set(s, Q2_REST_WD_SOCK_TIMEOUT);
-    *sock = s;
-    return APR_SUCCESS;
+    ap_dbd_t* (*open_fn)(apr_pool_t*, server_rec*);
+    open_fn = APR_RETRIEVE_OPTIONAL_FN(ap_dbd_open);
+    if (open_fn == NULL || cfg->async_server == NULL) return NULL;
+    return open_fn(mp, cfg->async_server);
 }
 
-static apr_status_t q2_rest_do_client_task(apr_socket_t *sock,
-                                           const char *data,
-                                           q2_rest_url_data_t *d)
+static void q2_rest_async_dbd_close(q2_rest_cfg_t *cfg, ap_dbd_t *dbd)
 {
-    apr_status_t rv;
-    apr_size_t len = strlen(data);
-    rv = apr_socket_send(sock, data, &len);
-    if (rv != APR_SUCCESS) return rv;
-    return rv;
+    void (*close_fn)(server_rec*, ap_dbd_t*);
+    close_fn = APR_RETRIEVE_OPTIONAL_FN(ap_dbd_close);
+    if (close_fn != NULL && dbd != NULL) close_fn(cfg->async_server, dbd);
 }
 
-static void *q2_rest_thread(void *t_data)
+//! The q2_t of a queued request on a mod_dbd connection of the executor
+//! process, NULL when the request cannot be read. The request was
+//! authenticated when it was queued.
+static q2_t* q2_rest_async_make(q2_rest_url_data_t *d, ap_dbd_t *dbd)
 {
-    apr_status_t rv;
-    apr_socket_t *s;
-    q2_rest_url_data_t *d;
-    const char *data, *tmp;
-    apr_time_t inizio = apr_time_now();
-    apr_sleep(1 * Q2_REST_WD_SECOND);
-    d = (q2_rest_url_data_t *)t_data;
-    data = "";
-    for (int i = 0; i < d->data->nelts; i++) {
-        tmp = APR_ARRAY_IDX(d->data, i, const char *);
-        if (tmp != NULL) data = apr_pstrcat(d->pool, data, tmp, NULL);
-    }
-    rv = q2_rest_do_connect(&s, d);
-    if (rv != APR_SUCCESS) goto end;
-    rv = q2_rest_do_client_task(s, data, d);
-    if (rv != APR_SUCCESS) goto end;
-    apr_time_t fine = apr_time_now();
-end:
-    apr_socket_close(s);
-    apr_pool_destroy(d->pool);
-    pthread_exit(0);
+    q2_t *q2;
+    apr_table_t *params = NULL;
+    const char *method, *uri, *body, *rawdata = NULL;
+    q2_rest_cfg_t *cfg = d->cfg;
+    if (!q2_rest_async_parse(d->pool, d->data, &method, &uri, &body))
+        return NULL;
+    if (strcmp(method, "PATCH") == 0) rawdata = body;
+    else if (strcmp(method, "POST") == 0)
+        q2_args_to_table(d->pool, &params, body);
+    else params = q2_rest_async_args(d->pool, uri);
+    if ((q2 = q2_initialize(d->pool)) == NULL) return NULL;
+    q2_set_dbd(q2, dbd->driver, dbd->handle);
+    q2_set_method(q2, method);
+    q2_set_uri(q2, uri);
+    q2_set_params(q2, params);
+    q2_set_rawdata(q2, rawdata, rawdata == NULL ? 0 : (int)strlen(rawdata));
+    q2_set_ppg(q2, cfg->pagination_ppg);
+    q2_set_count_mode(q2, cfg->count_mode);
+    q2_set_pagination_mode(q2, cfg->pagination_mode);
+    q2_set_schema_cache(q2, cfg->schema_cache, cfg->schema_cache_ttl);
+    q2_set_graph(q2, q2_rest_graph(cfg, dbd, 0, d->pool));
+    q2_set_stmt_cache(q2, q2_rest_stmt_cache(dbd), dbd->pool);
+    q2_set_version_column(q2, cfg->version_column);
+    return q2;
 }
 
-// static int q2_rest_aysnc_get_proc(q2_rest_cfg_t *cfg, apr_pool_t *mp)
-// {
-//     const char *dirpath;
-//     const char *fname;
-//     pthread_t tid;
-//     apr_status_t rv;
-//     apr_pool_t *pool;
-//     apr_dir_t *dir;
-//     apr_finfo_t dirent;
+//! Stores the result of a job and then marks it done, so that a completed
+//! job always has its result
+static void q2_rest_async_done(q2_rest_url_data_t *d, q2_t *q2, int rv)
+{
+    const char *er = NULL;
+    q2_json_t *w = q2_json_make(d->pool, Q2_JSON_BUFSIZE);
+    if (rv != 0) {
+        if (q2 != NULL) er = q2_get_error(q2);
+        if (er == NULL) er = "An error occurred.";
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, d->cfg->async_server,
+                     "q2: async %s failed: %s", d->async_id, er);
+    }
+    if (w != NULL) {
+        if (rv == 0) {
+            q2_json_puts(w, "{\"body\":");
+            q2_encode_json(q2, w);
+        } else {
+            q2_json_puts(w, "{\"error\":");
+            q2_json_string(w, er);
+        }
+        q2_json_putc(w, '}');
+        q2_rest_async_save_result(d->pool, d->cfg, d->async_id,
+                                  q2_json_get(w));
+    }
+    q2_rest_async_save_status(d->pool, d->cfg, d->async_id,
+                              Q2_REST_ASYNC_DONE);
+    if (d->origin.queue == Q2_REST_QUEUE_JOURNAL)
+        q2_rest_segment_complete(d->cfg, &(d->origin));
+    else if (d->origin.queue == Q2_REST_QUEUE_SHM &&
+             d->cfg->journal_mutex != NULL)
+        q2_rest_journal_complete(d->pool, d->cfg, d->async_id);
+    if (d->cfg->async_stats != NULL) {
+        apr_atomic_inc32(&(d->cfg->async_stats->done));
+        apr_atomic_dec32(&(d->cfg->async_stats->running));
+    }
+    q2_rest_async_pending(d->cfg, -1);
+}
+
+//! Runs a group of jobs on one connection, see q2_acquire_batch()
+static void* APR_THREAD_FUNC q2_rest_async_task(apr_thread_t *t,
+                                               void *t_data)
+{
+    int *rv;
+    q2_t *q2;
+    ap_dbd_t *dbd;
+    q2_rest_url_data_t *d;
+    apr_array_header_t *q2s, *jobs;
+    q2_rest_async_group_t *g = (q2_rest_async_group_t*)t_data;
+    dbd = q2_rest_async_dbd_open(g->cfg, g->pool);
+    q2s = apr_array_make(g->pool, g->jobs->nelts, sizeof(q2_t*));
+    jobs = apr_array_make(g->pool, g->jobs->nelts,
+                          sizeof(q2_rest_url_data_t*));
+    for (int i = 0; i < g->jobs->nelts; i++) {
+        d = APR_ARRAY_IDX(g->jobs, i, q2_rest_url_data_t*);
+        if (dbd == NULL || (q2 = q2_rest_async_make(d, dbd)) == NULL) {
+            q2_rest_async_done(d, NULL, 1);
+            continue;
+        }
+        APR_ARRAY_PUSH(q2s, q2_t*) = q2;
+        APR_ARRAY_PUSH(jobs, q2_rest_url_data_t*) = d;
+    }
+    rv = (int*)apr_pcalloc(g->pool, sizeof(int) * (q2s->nelts + 1));
+    q2_acquire_batch(q2s, rv);
+    for (int i = 0; i < q2s->nelts; i++) {
+        q2 = APR_ARRAY_IDX(q2s, i, q2_t*);
+        if (rv[i] == 0) q2_rest_gen_bump(g->cfg, q2_get_dep_tables(q2));
+        q2_rest_async_done(APR_ARRAY_IDX(jobs, i, q2_rest_url_data_t*),
+                           q2, rv[i]);
+    }
+    q2_rest_async_dbd_close(g->cfg, dbd);
+    apr_pool_destroy(g->pool);
+    return NULL;
+}
+
+// static int q2_rest_aysnc_get_proc(q2_rest_cfg_t *cfg, apr_pool_t *mp)
+// {
+//     const char *dirpath;
+//     const char *fname;
+//     pthread_t tid;
+//     apr_status_t rv;
+//     apr_pool_t *pool;
+//     apr_dir_t *dir;
+//     apr_finfo_t dirent;
 //     apr_file_t *fh;
 //     q2_rest_url_data_t *d;
 //     if (cfg->hostname == NULL || cfg->server_port == 0) return 0;
@@ -4246,50 +7525,197 @@ end:
 //     return 0;
 // }
 
-static int q2_rest_aysnc_get_proc(q2_rest_cfg_t *cfg, apr_pool_t *mp)
+//! The executor has room for another job: its queue is kept short, jobs
+//! wait in the ring or in the request files instead
+static int q2_rest_async_ready(q2_rest_cfg_t *cfg)
+{
+    if (cfg->async_tp == NULL) return FALSE;
+    return apr_thread_pool_tasks_count(cfg->async_tp) <
+           (apr_size_t)cfg->async_threads;
+}
+
+static q2_rest_async_group_t* q2_rest_async_group_make(q2_rest_cfg_t *cfg)
 {
-    const char *dirpath;
+    apr_pool_t *t_pool;
+    q2_rest_async_group_t *g;
+    if (apr_pool_create(&t_pool, NULL) != APR_SUCCESS) return NULL;
+    g = (q2_rest_async_group_t*)apr_palloc(t_pool,
+                                           sizeof(q2_rest_async_group_t));
+    g->pool = t_pool;
+    g->cfg = cfg;
+    g->jobs = apr_array_make(t_pool, 1, sizeof(q2_rest_url_data_t*));
+    return g;
+}
+
+static void q2_rest_async_group_add(q2_rest_async_group_t *g,
+                                    const char *id,
+                                    const char *data,
+                                    const q2_rest_async_origin_t *o)
+{
+    q2_rest_url_data_t *d;
+    d = (q2_rest_url_data_t*)apr_palloc(g->pool, sizeof(q2_rest_url_data_t));
+    d->pool = g->pool;
+    d->cfg = g->cfg;
+    d->async_id = apr_pstrdup(g->pool, id);
+    d->data = apr_pstrdup(g->pool, data);
+    d->origin = *o;
+    APR_ARRAY_PUSH(g->jobs, q2_rest_url_data_t*) = d;
+}
+
+//! A job that will not run is no longer pending, nor kept by its queue
+static void q2_rest_async_drop(q2_rest_cfg_t *cfg,
+                               const q2_rest_async_origin_t *o)
+{
+    q2_rest_async_pending(cfg, -1);
+    if (o->queue == Q2_REST_QUEUE_SHM && cfg->journal_mutex != NULL)
+        apr_atomic_dec32(&(cfg->journal_running));
+    else if (o->queue == Q2_REST_QUEUE_JOURNAL &&
+             apr_global_mutex_lock(cfg->journal_mutex) == APR_SUCCESS) {
+        apr_atomic_add32(&(cfg->segment->completed), o->len);
+        apr_global_mutex_unlock(cfg->journal_mutex);
+    }
+}
+
+//! Runs the group on the executor, which owns its pool from now on
+static void q2_rest_async_group_push(q2_rest_async_group_t *g)
+{
+    int n = g->jobs->nelts;
+    q2_rest_url_data_t *d;
+    q2_rest_cfg_t *cfg = g->cfg;
+    //! counted first, the task may be done before the push returns
+    if (cfg->async_stats != NULL)
+        apr_atomic_add32(&(cfg->async_stats->running), (apr_uint32_t)n);
+    if (apr_thread_pool_push(cfg->async_tp, q2_rest_async_task, g,
+                             APR_THREAD_TASK_PRIORITY_NORMAL, NULL)
+            != APR_SUCCESS) {
+        if (cfg->async_stats != NULL)
+            apr_atomic_add32(&(cfg->async_stats->running), (apr_uint32_t)-n);
+        for (int i = 0; i < n; i++) {
+            d = APR_ARRAY_IDX(g->jobs, i, q2_rest_url_data_t*);
+            q2_rest_async_drop(cfg, &(d->origin));
+        }
+        apr_pool_destroy(g->pool);
+    }
+}
+
+//! Runs the request on the executor, with its own pool
+static void q2_rest_async_dispatch(q2_rest_cfg_t *cfg,
+                                   const char *id,
+                                   const char *data,
+                                   const q2_rest_async_origin_t *o)
+{
+    q2_rest_async_group_t *g;
+    if ((g = q2_rest_async_group_make(cfg)) == NULL) {
+        q2_rest_async_drop(cfg, o);
+        return;
+    }
+    q2_rest_async_group_add(g, id, data, o);
+    q2_rest_async_group_push(g);
+}
+
+static q2_rest_async_batch_t* q2_rest_async_batch_make(q2_rest_cfg_t *cfg,
+                                                       apr_pool_t *mp)
+{
+    q2_rest_async_batch_t *b;
+    b = (q2_rest_async_batch_t*)apr_palloc(mp, sizeof(q2_rest_async_batch_t));
+    b->cfg = cfg;
+    b->pool = mp;
+    b->groups = apr_hash_make(mp);
+    b->held = 0;
+    return b;
+}
+
+static void q2_rest_async_flush(q2_rest_async_batch_t *b)
+{
+    apr_hash_index_t *hi;
+    for (hi = apr_hash_first(b->pool, b->groups); hi; hi = apr_hash_next(hi))
+        q2_rest_async_group_push((q2_rest_async_group_t*)apr_hash_this_val(hi));
+    apr_hash_clear(b->groups);
+    b->held = 0;
+}
+
+//! POSTs wait in the group of their URI until q2_rest_async_flush(), the
+//! other requests are dispatched at once. At most Q2AsyncBatch jobs are
+//! held, so the executor keeps being fed during a long drain.
+static void q2_rest_async_collect(q2_rest_async_batch_t *b,
+                                  const char *id,
+                                  const char *data,
+                                  const q2_rest_async_origin_t *o)
+{
+    const char *method, *uri, *body;
+    q2_rest_async_group_t *g;
+    if (b->cfg->async_batch <= 1 ||
+        !q2_rest_async_parse(b->pool, data, &method, &uri, &body) ||
+        strcmp(method, "POST") != 0) {
+        q2_rest_async_dispatch(b->cfg, id, data, o);
+        return;
+    }
+    g = (q2_rest_async_group_t*)apr_hash_get(b->groups, uri,
+                                             APR_HASH_KEY_STRING);
+    if (g == NULL) {
+        if ((g = q2_rest_async_group_make(b->cfg)) == NULL) {
+            q2_rest_async_drop(b->cfg, o);
+            return;
+        }
+        apr_hash_set(b->groups, uri, APR_HASH_KEY_STRING, g);
+    }
+    q2_rest_async_group_add(g, id, data, o);
+    if (++ b->held >= b->cfg->async_batch) q2_rest_async_flush(b);
+}
+
+//! Takes a request file and dispatches it. The watcher and the watchdog
+//! sweep may see the same file: the first one removes it under the lock.
+static void q2_rest_async_pickup(q2_rest_async_batch_t *b, const char *name)
+{
+    q2_rest_cfg_t *cfg = b->cfg;
+    apr_pool_t *pool = b->pool;
     const char *fname;
-    pthread_t tid;
+    apr_status_t rv;
+    apr_finfo_t finfo;
+    apr_file_t *fh;
+    char *data = NULL;
+    int taken = 0;
+    q2_rest_async_origin_t o = {Q2_REST_QUEUE_FILE, 0, 0};
+    fname = apr_pstrcat(pool, cfg->async_path, "/", name, NULL);
+    if (cfg->async_mutex != NULL) apr_thread_mutex_lock(cfg->async_mutex);
+    rv = apr_file_open(&fh, fname, APR_FOPEN_READ, APR_OS_DEFAULT, pool);
+    if (rv == APR_SUCCESS) {
+        taken = 1;
+        rv = apr_file_info_get(&finfo, APR_FINFO_SIZE, fh);
+        data = rv != APR_SUCCESS
+            ? NULL
+            : (char*)apr_pcalloc(pool, (apr_size_t)finfo.size + 1);
+        if (data != NULL)
+            rv = apr_file_read_full(fh, data, (apr_size_t)finfo.size, NULL);
+        apr_file_close(fh);
+        apr_file_remove(fname, pool);
+    }
+    if (cfg->async_mutex != NULL) apr_thread_mutex_unlock(cfg->async_mutex);
+    if (data != NULL && rv == APR_SUCCESS)
+        q2_rest_async_collect(b, name, data, &o);
+    else if (taken)
+        q2_rest_async_pending(cfg, -1);
+}
+
+//! Recovery sweep: files missed by the watcher, left while the executor
+//! was busy or written when there is no watcher at all
+static int q2_rest_aysnc_get_proc(q2_rest_cfg_t *cfg, apr_pool_t *mp)
+{
     apr_status_t rv;
     apr_pool_t *pool;
-    apr_pool_t *t_pool;
     apr_dir_t *dir;
     apr_finfo_t dirent;
-    apr_file_t *fh;
-    q2_rest_url_data_t *d;
-    char tmp[256];
-    if (cfg->hostname == NULL || cfg->server_port == 0) goto end;
+    q2_rest_async_batch_t *b;
     if ((rv = apr_pool_create(&pool, mp)) != APR_SUCCESS) goto end;
-    dirpath = apr_pstrdup(pool, cfg->async_path);
-    if ((rv = apr_dir_open(&dir, dirpath, pool)) != APR_SUCCESS) goto release;
-    while ((apr_dir_read(&dirent, Q2_REST_WD_DIROPT, dir)) == APR_SUCCESS) {
-        if (dirent.filetype == APR_REG && dirent.name[0] != '_') {
-            fname = apr_pstrcat(pool, dirpath, "/", dirent.name, NULL);
-            rv = apr_file_open(&fh, fname, APR_FOPEN_READ, APR_OS_DEFAULT, pool);
-            if (rv != APR_SUCCESS) continue;
-            if (apr_pool_create(&t_pool, NULL) == APR_SUCCESS) {
-                d = (q2_rest_url_data_t*)apr_palloc(t_pool,
-                                                    sizeof(q2_rest_url_data_t));
-                if (d != NULL) {
-                    d->pool = t_pool;
-                    d->server = apr_pstrdup(t_pool, cfg->hostname);
-                    d->port = cfg->server_port;
-                    d->async_id = (char*)apr_pstrdup(t_pool, dirent.name);
-                    d->data = apr_array_make(t_pool, 6, sizeof(const char*));
-                    while ((rv = apr_file_eof(fh)) == APR_SUCCESS) {
-                        if ((rv = apr_file_gets(tmp, 256, fh)) == APR_SUCCESS) {
-                            APR_ARRAY_PUSH(d->data, const char*) =
-                                apr_pstrdup(t_pool, tmp);
-                        }
-                    }
-                }
-            }
-            apr_file_close(fh);
-            apr_file_remove(fname, pool);
-            pthread_create(&tid, NULL, q2_rest_thread, (void*)d);
-        }
+    rv = apr_dir_open(&dir, cfg->async_path, pool);
+    if (rv != APR_SUCCESS) goto release;
+    b = q2_rest_async_batch_make(cfg, pool);
+    while (q2_rest_async_ready(cfg) &&
+           (apr_dir_read(&dirent, Q2_REST_WD_DIROPT, dir)) == APR_SUCCESS) {
+        if (dirent.filetype == APR_REG && dirent.name[0] != '_')
+            q2_rest_async_pickup(b, dirent.name);
     }
+    q2_rest_async_flush(b);
     apr_dir_close(dir);
 release:
     apr_pool_destroy(pool);
@@ -4297,20 +7723,486 @@ end:
     return 0;
 }
 
+#ifdef Q2_REST_INOTIFY
+//! Dispatches request files as soon as they are closed by the writer,
+//! instead of waiting for the next watchdog tick
+static void* APR_THREAD_FUNC q2_rest_async_watch(apr_thread_t *t,
+                                                void *t_data)
+{
+    ssize_t n;
+    char *p;
+    apr_pool_t *pool;
+    struct pollfd pfd;
+    const struct inotify_event *ev;
+    q2_rest_async_batch_t *b;
+    union {
+        struct inotify_event ev;
+        char buf[Q2_REST_WD_BUFSIZE];
+    } u;
+    q2_rest_cfg_t *cfg = (q2_rest_cfg_t*)t_data;
+    if (apr_pool_create(&pool, NULL) != APR_SUCCESS) return NULL;
+    pfd.fd = cfg->async_watch_fd;
+    pfd.events = POLLIN;
+    while (!apr_atomic_read32(&(cfg->async_stop))) {
+        if (poll(&pfd, 1, Q2_REST_WATCH_POLL_MS) <= 0) continue;
+        if ((n = read(cfg->async_watch_fd, u.buf, sizeof(u.buf))) <= 0)
+            continue;
+        b = q2_rest_async_batch_make(cfg, pool);
+        for (p = u.buf; p < u.buf + n; p += sizeof(*ev) + ev->len) {
+            ev = (const struct inotify_event*)p;
+            //! queue overflow or a busy executor: left to the sweep
+            if (ev->len == 0 || ev->name[0] == '_' ||
+                !q2_rest_async_ready(cfg))
+                continue;
+            q2_rest_async_pickup(b, ev->name);
+        }
+        q2_rest_async_flush(b);
+        apr_pool_clear(pool);
+    }
+    apr_pool_destroy(pool);
+    return NULL;
+}
+
+static void q2_rest_async_watch_start(server_rec *s,
+                                      q2_rest_cfg_t *cfg,
+                                      apr_pool_t *pool)
+{
+    if (cfg->async_watcher != NULL) return;
+    cfg->async_watch_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if (cfg->async_watch_fd < 0 ||
+        inotify_add_watch(cfg->async_watch_fd, cfg->async_path,
+                          IN_CLOSE_WRITE) < 0) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s,
+                     "q2: unable to watch %s, async requests are picked up "
+                     "by the watchdog", cfg->async_path);
+        goto fail;
+    }
+    apr_atomic_set32(&(cfg->async_stop), 0);
+    if (apr_thread_create(&(cfg->async_watcher), NULL, q2_rest_async_watch,
+                          cfg, pool) == APR_SUCCESS)
+        return;
+    cfg->async_watcher = NULL;
+fail:
+    if (cfg->async_watch_fd >= 0) close(cfg->async_watch_fd);
+    cfg->async_watch_fd = -1;
+}
+
+static void q2_rest_async_watch_stop(q2_rest_cfg_t *cfg)
+{
+    apr_status_t rv;
+    if (cfg->async_watcher == NULL) return;
+    apr_atomic_set32(&(cfg->async_stop), 1);
+    apr_thread_join(&rv, cfg->async_watcher);
+    close(cfg->async_watch_fd);
+    cfg->async_watcher = NULL;
+    cfg->async_watch_fd = -1;
+}
+#endif
+
+//! Done records are written once the job completed, see
+//! q2_rest_journal_complete(): a job still in the ring or running when the
+//! server stops is replayed. Once the ring is empty and no job taken from it
+//! is running the journal has nothing pending and is truncated.
+static int q2_rest_async_ring_drain(q2_rest_cfg_t *cfg, apr_pool_t *mp)
+{
+    int n = 0;
+    char *rec, *data;
+    apr_size_t len;
+    apr_pool_t *pool;
+    apr_file_t *fh;
+    q2_rest_async_batch_t *b;
+    q2_rest_async_origin_t o = {Q2_REST_QUEUE_SHM, 0, 0};
+    if (cfg->async_ring == NULL) return 0;
+    if (apr_pool_create(&pool, mp) != APR_SUCCESS) return 0;
+    b = q2_rest_async_batch_make(cfg, pool);
+    while (q2_rest_async_ready(cfg) &&
+           (rec = q2_shm_ring_pop(cfg->async_ring, pool, &len)) != NULL) {
+        n ++;
+        if ((data = strchr(rec, '\n')) == NULL) {
+            q2_rest_async_pending(cfg, -1);
+            continue;
+        }
+        *data ++ = '\0';
+        if (cfg->journal_mutex != NULL)
+            apr_atomic_inc32(&(cfg->journal_running));
+        q2_rest_async_collect(b, rec, data, &o);
+    }
+    q2_rest_async_flush(b);
+    if (n > 0) cfg->journal_dirty = 1;
+    if (cfg->journal_dirty && cfg->journal_mutex != NULL &&
+        apr_atomic_read32(&(cfg->journal_running)) == 0 &&
+        apr_global_mutex_lock(cfg->journal_mutex) == APR_SUCCESS) {
+        if (q2_shm_ring_count(cfg->async_ring) == 0 &&
+            apr_file_open(&fh, cfg->async_journal, APR_FOPEN_WRITE,
+                          APR_OS_DEFAULT, pool) == APR_SUCCESS) {
+            apr_file_trunc(fh, 0);
+            apr_file_close(fh);
+            cfg->journal_dirty = 0;
+        }
+        apr_global_mutex_unlock(cfg->journal_mutex);
+    }
+    apr_pool_destroy(pool);
+    return n;
+}
+
+//! Reads the frame at the dispatched offset, NULL when there is none on
+//! disk yet. Queued records stay 'Q' until their job completed, see
+//! q2_rest_segment_complete(), voided ones count as completed at once.
+static char* q2_rest_segment_next(q2_rest_cfg_t *cfg, apr_pool_t *mp,
+                                  q2_rest_async_origin_t *o)
+{
+    char head[Q2_REST_SEGMENT_HEAD + 1], *nl, *rec = NULL;
+    apr_off_t off;
+    apr_size_t hlen, len;
+    apr_uint32_t avail;
+    apr_file_t *fh = cfg->segment_fh;
+    q2_rest_segment_t *seg = cfg->segment;
+    off = (apr_off_t)seg->dispatched;
+    avail = apr_atomic_read32(&(seg->synced)) - seg->dispatched;
+    hlen = avail < Q2_REST_SEGMENT_HEAD ? avail : Q2_REST_SEGMENT_HEAD;
+    if (hlen < 4 || apr_file_seek(fh, APR_SET, &off) != APR_SUCCESS ||
+        apr_file_read_full(fh, head, hlen, NULL) != APR_SUCCESS)
+        return NULL;
+    head[hlen] = '\0';
+    len = (apr_size_t)strtoul(head + 2, &nl, 10);
+    if ((head[0] != 'Q' && head[0] != 'D') || head[1] != ' ' || *nl != '\n')
+        return NULL;
+    hlen = (apr_size_t)(nl + 1 - head);
+    if (hlen + len + 1 > avail) return NULL;
+    o->queue = Q2_REST_QUEUE_JOURNAL;
+    o->off = seg->dispatched;
+    o->len = (apr_uint32_t)(hlen + len + 1);
+    if (head[0] == 'Q') {
+        rec = (char*)apr_palloc(mp, len + 1);
+        off = (apr_off_t)seg->dispatched + (apr_off_t)hlen;
+        if (apr_file_seek(fh, APR_SET, &off) != APR_SUCCESS ||
+            apr_file_read_full(fh, rec, len, NULL) != APR_SUCCESS)
+            return NULL;
+        rec[len] = '\0';
+    } else {
+        apr_atomic_add32(&(seg->completed), o->len);
+    }
+    apr_atomic_set32(&(seg->dispatched), seg->dispatched + o->len);
+    return rec == NULL ? "" : rec;
+}
+
+//! Hands the durable records to the executor. Once the jobs of all the
+//! appended records completed the segment is truncated.
+static int q2_rest_segment_drain(q2_rest_cfg_t *cfg, apr_pool_t *mp)
+{
+    int n = 0;
+    char *rec, *data;
+    apr_pool_t *pool;
+    q2_rest_async_batch_t *b;
+    q2_rest_async_origin_t o;
+    q2_rest_segment_t *seg = cfg->segment;
+    if (seg == NULL) return 0;
+    if (apr_pool_create(&pool, mp) != APR_SUCCESS) return 0;
+    b = q2_rest_async_batch_make(cfg, pool);
+    while (q2_rest_async_ready(cfg)) {
+        if (apr_global_mutex_lock(cfg->journal_mutex) != APR_SUCCESS) break;
+        rec = q2_rest_segment_next(cfg, pool, &o);
+        apr_global_mutex_unlock(cfg->journal_mutex);
+        if (rec == NULL) break;
+        if (*rec == '\0') continue;
+        if ((data = strchr(rec, '\n')) == NULL) {
+            q2_rest_segment_complete(cfg, &o);
+            q2_rest_async_pending(cfg, -1);
+            continue;
+        }
+        *data ++ = '\0';
+        q2_rest_async_collect(b, rec, data, &o);
+        n ++;
+    }
+    q2_rest_async_flush(b);
+    if (seg->dispatched > 0 &&
+        apr_global_mutex_lock(cfg->journal_mutex) == APR_SUCCESS) {
+        if (apr_atomic_read32(&(seg->completed)) ==
+            apr_atomic_read32(&(seg->end))) {
+            if (q2_rest_segment_reset(cfg->segment_fh, cfg->segment_size)
+                    != APR_SUCCESS)
+                ap_log_error(APLOG_MARK, APLOG_ERR, 0, cfg->async_server,
+                             "q2: unable to truncate the async journal");
+            apr_atomic_set32(&(seg->end), 0);
+            apr_atomic_set32(&(seg->synced), 0);
+            apr_atomic_set32(&(seg->dispatched), 0);
+            apr_atomic_set32(&(seg->completed), 0);
+            apr_atomic_inc32(&(seg->gen));
+        }
+        apr_global_mutex_unlock(cfg->journal_mutex);
+    }
+    apr_pool_destroy(pool);
+    return n;
+}
+
+//! Parent process: the records not marked done are written again at the
+//! start of a fresh segment, a torn record at the end is dropped
+static int q2_rest_segment_replay(q2_rest_cfg_t *cfg, apr_pool_t *mp)
+{
+    char *buf, *p, *end, *nl;
+    const char *queued;
+    apr_size_t len, flen;
+    apr_off_t off = 0;
+    apr_finfo_t finfo;
+    apr_array_header_t *frames;
+    apr_file_t *fh = cfg->segment_fh;
+    if (apr_file_info_get(&finfo, APR_FINFO_SIZE, fh) != APR_SUCCESS ||
+        apr_file_seek(fh, APR_SET, &off) != APR_SUCCESS ||
+        (buf = (char*)apr_pcalloc(mp, (apr_size_t)finfo.size + 1)) == NULL ||
+        apr_file_read_full(fh, buf, (apr_size_t)finfo.size, NULL)
+            != APR_SUCCESS)
+        buf = "";
+    frames = apr_array_make(mp, 16, sizeof(char*));
+    end = buf + strlen(buf);
+    for (p = buf; p + 2 < end && (p[0] == 'Q' || p[0] == 'D') && p[1] == ' ';
+         p += flen) {
+        len = (apr_size_t)strtoul(p + 2, &nl, 10);
+        if (*nl != '\n' || nl + 1 + len >= end || nl[1 + len] != '\n') break;
+        flen = (apr_size_t)(nl + 2 + len - p);
+        if (p[0] == 'Q')
+            APR_ARRAY_PUSH(frames, char*) = apr_pstrndup(mp, p, flen);
+    }
+    queued = apr_array_pstrcat(mp, frames, 0);
+    len = strlen(queued);
+    if (len >= cfg->segment_size) len = 0;
+    if (q2_rest_segment_reset(fh, cfg->segment_size) != APR_SUCCESS ||
+        apr_file_seek(fh, APR_SET, &off) != APR_SUCCESS ||
+        apr_file_write_full(fh, queued, len, NULL) != APR_SUCCESS ||
+        apr_file_datasync(fh) != APR_SUCCESS)
+        return 1;
+    cfg->segment->end = cfg->segment->synced = (apr_uint32_t)len;
+    if (len > 0) q2_rest_async_pending(cfg, frames->nelts);
+    return 0;
+}
+
+//! Parent process, before the children start: the queued records without a
+//! done record go back into the new ring, or to request files when it is
+//! full, and the journal is rewritten with the ones in the ring.
+static int q2_rest_journal_replay(q2_rest_cfg_t *cfg, apr_pool_t *mp)
+{
+    char *buf, *p, *end, *nl, *rec, *data;
+    apr_size_t len;
+    apr_file_t *fh;
+    apr_finfo_t finfo;
+    apr_hash_t *done;
+    apr_array_header_t *queued;
+    if (apr_file_open(&fh, cfg->async_journal, APR_FOPEN_READ,
+                      APR_OS_DEFAULT, mp) != APR_SUCCESS)
+        return 0;
+    if (apr_file_info_get(&finfo, APR_FINFO_SIZE, fh) != APR_SUCCESS ||
+        (buf = (char*)apr_pcalloc(mp, (apr_size_t)finfo.size + 1)) == NULL ||
+        apr_file_read_full(fh, buf, (apr_size_t)finfo.size, NULL)
+            != APR_SUCCESS) {
+        apr_file_close(fh);
+        return 1;
+    }
+    apr_file_close(fh);
+    done = apr_hash_make(mp);
+    queued = apr_array_make(mp, 16, sizeof(char*));
+    //! a torn record at the end is an interrupted append, it is dropped
+    for (p = buf, end = buf + finfo.size; p + 2 < end;) {
+        if (p[0] == 'Q' && p[1] == ' ') {
+            len = (apr_size_t)strtoul(p + 2, &nl, 10);
+            if (*nl != '\n' || nl + 1 + len >= end) break;
+            APR_ARRAY_PUSH(queued, char*) = apr_pstrndup(mp, nl + 1, len);
+            p = nl + 1 + len + 1;
+        } else if (p[0] == 'D' && p[1] == ' ') {
+            if ((nl = memchr(p, '\n', end - p)) == NULL) break;
+            apr_hash_set(done, apr_pstrndup(mp, p + 2, nl - p - 2),
+                         APR_HASH_KEY_STRING, "");
+            p = nl + 1;
+        } else {
+            break;
+        }
+    }
+    if (apr_file_open(&fh, cfg->async_journal,
+                      APR_FOPEN_WRITE|APR_FOPEN_CREATE|APR_FOPEN_TRUNCATE,
+                      APR_OS_DEFAULT, mp) != APR_SUCCESS)
+        return 1;
+    apr_file_close(fh);
+    for (int i = 0; i < queued->nelts; i++) {
+        rec = APR_ARRAY_IDX(queued, i, char*);
+        if ((data = strchr(rec, '\n')) == NULL) continue;
+        if (apr_hash_get(done, rec, data - rec) != NULL) continue;
+        q2_rest_async_pending(cfg, 1);
+        len = strlen(rec);
+        if (!q2_shm_ring_push(cfg->async_ring, rec, len)) {
+            q2_rest_journal_append(mp, cfg,
+                                   apr_psprintf(mp, Q2_REST_JOURNAL_QUEUED,
+                                                len, rec));
+            continue;
+        }
+        if (cfg->async_path != NULL)
+            q2_rest_write_file(mp, apr_psprintf(mp, Q2_REST_ASYNC_FREQUEST,
+                                                cfg->async_path,
+                                                apr_pstrndup(mp, rec,
+                                                             data - rec)),
+                               data + 1);
+    }
+    return 0;
+}
+
+typedef struct q2_rest_gc_entry_t {
+    const char *fname;
+    apr_time_t mtime;
+} q2_rest_gc_entry_t;
+
+static int q2_rest_gc_cmp(const void *a, const void *b)
+{
+    apr_time_t x = ((const q2_rest_gc_entry_t*)a)->mtime;
+    apr_time_t y = ((const q2_rest_gc_entry_t*)b)->mtime;
+    return x < y ? -1 : x > y;
+}
+
+//! "_<id>" and "_<id>.json", the other files are not the GC's business
+static int q2_rest_gc_name(const char *name, int *result)
+{
+    const char *ext = name + 1 + Q2_REST_ASYNC_ID_LEN;
+    if (name[0] != '_' || strlen(name) < Q2_REST_ASYNC_ID_LEN + 1 ||
+        strspn(name + 1, "0123456789abcdef") != Q2_REST_ASYNC_ID_LEN)
+        return FALSE;
+    *result = strcmp(ext, ".json") == 0;
+    return *ext == '\0' || *result;
+}
+
+//! Removes the status and result files past their TTL, then the oldest
+//! ones over the share of Q2AsyncMaxEntries of the directory. Returns the
+//! number of files left.
+static apr_uint32_t q2_rest_gc_dir(q2_rest_cfg_t *cfg,
+                                   apr_pool_t *mp,
+                                   const char *path,
+                                   int cap)
+{
+    int result, ttl;
+    apr_dir_t *dir;
+    apr_finfo_t dirent;
+    apr_array_header_t *live;
+    q2_rest_gc_entry_t *e;
+    apr_time_t now = apr_time_now();
+    apr_uint32_t expired = 0, evicted = 0;
+    const apr_int32_t wanted = Q2_REST_WD_DIROPT|APR_FINFO_MTIME;
+    if (apr_dir_open(&dir, path, mp) != APR_SUCCESS) return 0;
+    live = apr_array_make(mp, 64, sizeof(q2_rest_gc_entry_t));
+    while (apr_dir_read(&dirent, wanted, dir) == APR_SUCCESS) {
+        if (dirent.filetype != APR_REG || dirent.name == NULL ||
+            !q2_rest_gc_name(dirent.name, &result))
+            continue;
+        ttl = result ? cfg->async_result_ttl : cfg->async_status_ttl;
+        if (ttl > 0 && dirent.mtime + apr_time_from_sec(ttl) < now) {
+            if (apr_file_remove(apr_pstrcat(mp, path, "/", dirent.name,
+                                            NULL), mp) == APR_SUCCESS)
+                expired ++;
+            continue;
+        }
+        e = (q2_rest_gc_entry_t*)apr_array_push(live);
+        e->fname = apr_pstrcat(mp, path, "/", dirent.name, NULL);
+        e->mtime = dirent.mtime;
+    }
+    apr_dir_close(dir);
+    if (cap > 0 && live->nelts > cap) {
+        qsort(live->elts, live->nelts, sizeof(q2_rest_gc_entry_t),
+              q2_rest_gc_cmp);
+        for (int i = 0; i < live->nelts - cap; i++) {
+            e = &APR_ARRAY_IDX(live, i, q2_rest_gc_entry_t);
+            if (apr_file_remove(e->fname, mp) == APR_SUCCESS) evicted ++;
+        }
+        live->nelts = cap;
+    }
+    apr_atomic_add32(&(cfg->async_stats->expired), expired);
+    apr_atomic_add32(&(cfg->async_stats->evicted), evicted);
+    return (apr_uint32_t)live->nelts;
+}
+
+//! Visits one shard per step, a whole pass takes Q2_REST_GC_PERIOD seconds.
+//! Files left in Q2AsyncPath by older versions are expired with the first
+//! shard.
+static void q2_rest_async_gc(q2_rest_cfg_t *cfg, apr_pool_t *mp)
+{
+    int cap = 0, shard;
+    apr_pool_t *pool;
+    apr_uint32_t total = 0;
+    apr_time_t now = apr_time_now();
+    if (cfg->async_stats == NULL || now < cfg->async_gc_next) return;
+    if (apr_pool_create(&pool, mp) != APR_SUCCESS) return;
+    cfg->async_gc_next = now + apr_time_from_sec(Q2_REST_GC_PERIOD) /
+                               Q2_REST_GC_SHARDS;
+    shard = cfg->async_gc_shard;
+    if (cfg->async_max_entries > 0)
+        cap = cfg->async_max_entries / Q2_REST_GC_SHARDS + 1;
+    if (shard == 0) q2_rest_gc_dir(cfg, pool, cfg->async_path, 0);
+    cfg->async_gc_entries[shard] =
+        q2_rest_gc_dir(cfg, pool,
+                       apr_psprintf(pool, "%s/%02x", cfg->async_path, shard),
+                       cap);
+    cfg->async_gc_shard = (shard + 1) % Q2_REST_GC_SHARDS;
+    if (cfg->async_gc_shard == 0) {
+        for (int i = 0; i < Q2_REST_GC_SHARDS; i++)
+            total += cfg->async_gc_entries[i];
+        apr_atomic_set32(&(cfg->async_stats->entries), total);
+        ap_log_error(APLOG_MARK, APLOG_INFO, 0, cfg->async_server,
+                     "q2: async gc: %u entries, %u expired, %u evicted",
+                     total, apr_atomic_read32(&(cfg->async_stats->expired)),
+                     apr_atomic_read32(&(cfg->async_stats->evicted)));
+    }
+    apr_pool_destroy(pool);
+}
+
 static int q2_rest_async_monitor(q2_rest_cfg_t *cfg, apr_pool_t *p)
 {
+    q2_rest_async_ring_drain(cfg, p);
+    q2_rest_segment_drain(cfg, p);
     q2_rest_aysnc_get_proc(cfg, p);
+    q2_rest_async_gc(cfg, p);
     return OK;
 }
 
 static int q2_rest_async_init(server_rec *s, const char *name, apr_pool_t *pool)
 {
     q2_rest_cfg_t *cfg = ap_get_module_config(s->module_config, &q2_module);
+    if (cfg->async_path == NULL || strcmp(name, AP_WATCHDOG_SINGLETON))
+        return OK;
+    cfg->async_server = s;
+    //! jobs taken by an executor that died are no longer counted, only the
+    //! journal segment runs them again
+    if (cfg->async_stats != NULL && cfg->async_tp == NULL)
+        q2_rest_async_pending(cfg,
+                              -(int)apr_atomic_xchg32(
+                                  &(cfg->async_stats->running), 0));
+    //! the records it did not complete are handed out again
+    if (cfg->segment != NULL && cfg->async_tp == NULL &&
+        apr_global_mutex_lock(cfg->journal_mutex) == APR_SUCCESS) {
+        apr_atomic_set32(&(cfg->segment->dispatched), 0);
+        apr_atomic_set32(&(cfg->segment->completed), 0);
+        apr_global_mutex_unlock(cfg->journal_mutex);
+    }
+    if (cfg->async_tp == NULL &&
+        apr_thread_pool_create(&(cfg->async_tp), 0, cfg->async_threads,
+                               pool) != APR_SUCCESS) {
+        cfg->async_tp = NULL;
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                     "q2: unable to create the async executor");
+        return OK;
+    }
+    if (cfg->async_mutex == NULL &&
+        apr_thread_mutex_create(&(cfg->async_mutex), APR_THREAD_MUTEX_DEFAULT,
+                                pool) != APR_SUCCESS)
+        return OK;
+#ifdef Q2_REST_INOTIFY
+    q2_rest_async_watch_start(s, cfg, pool);
+#endif
     return OK;
 }
 
 static int q2_rest_async_exit(server_rec *s, const char *name, apr_pool_t *pool)
 {
+    q2_rest_cfg_t *cfg = ap_get_module_config(s->module_config, &q2_module);
+    if (cfg->async_tp == NULL || strcmp(name, AP_WATCHDOG_SINGLETON))
+        return OK;
+#ifdef Q2_REST_INOTIFY
+    q2_rest_async_watch_stop(cfg);
+#endif
+    apr_thread_pool_destroy(cfg->async_tp);
+    cfg->async_tp = NULL;
     return OK;
 }
 
@@ -4333,8 +8225,193 @@ static int q2_rest_async_need(server_rec *s,
     return DECLINED;
 }
 
+static int q2_rest_post_config(apr_pool_t *pconf,
+                               apr_pool_t *plog,
+                               apr_pool_t *ptemp,
+                               server_rec *s)
+{
+    q2_rest_cfg_t *cfg;
+    if (ap_state_query(AP_SQ_MAIN_STATE) == AP_SQ_MS_CREATE_PRE_CONFIG)
+        return OK;
+    for (; s != NULL; s = s->next) {
+        cfg = ap_get_module_config(s->module_config, &q2_module);
+        if ((cfg->response_cache_ttl > 0 || cfg->version_etag) &&
+            cfg->gens == NULL) {
+            if (apr_shm_create(&(cfg->gens_shm), (Q2_REST_RCACHE_GENS + 1) *
+                               sizeof(apr_uint32_t), NULL, pconf)
+                    != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                             "q2: unable to create the table generations");
+                return HTTP_INTERNAL_SERVER_ERROR;
+            }
+            cfg->gens = (apr_uint32_t*)apr_shm_baseaddr_get(cfg->gens_shm);
+            memset(cfg->gens, 0,
+                   (Q2_REST_RCACHE_GENS + 1) * sizeof(apr_uint32_t));
+            cfg->gens_boot = apr_time_now();
+        }
+        if (cfg->token_ttl > 0 && cfg->token_key == NULL) {
+            cfg->token_key = (char*)apr_palloc(pconf, Q2_REST_TOKEN_KEY_LEN);
+            cfg->token_key_len = Q2_REST_TOKEN_KEY_LEN;
+            if (apr_generate_random_bytes((unsigned char*)cfg->token_key,
+                                          cfg->token_key_len)
+                    != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                             "q2: unable to create the token key");
+                return HTTP_INTERNAL_SERVER_ERROR;
+            }
+        }
+        if (cfg->async_path != NULL && cfg->async_stats == NULL) {
+            if (apr_shm_create(&(cfg->async_shm),
+                               sizeof(q2_rest_async_stats_t), NULL, pconf)
+                    != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                             "q2: unable to create the async counters");
+                return HTTP_INTERNAL_SERVER_ERROR;
+            }
+            cfg->async_stats =
+                (q2_rest_async_stats_t*)apr_shm_baseaddr_get(cfg->async_shm);
+            memset(cfg->async_stats, 0, sizeof(q2_rest_async_stats_t));
+        }
+        if (cfg->async_path != NULL && cfg->async_queue == Q2_REST_QUEUE_SHM &&
+            cfg->async_ring == NULL) {
+            cfg->async_ring = q2_shm_ring_create(pconf, cfg->async_queue_size,
+                                                 Q2_REST_QUEUE_SLOT_SIZE);
+            if (cfg->async_ring == NULL ||
+                (cfg->async_journal != NULL &&
+                 apr_global_mutex_create(&(cfg->journal_mutex), NULL,
+                                         APR_LOCK_DEFAULT, pconf)
+                     != APR_SUCCESS)) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                             "q2: unable to create the async queue");
+                return HTTP_INTERNAL_SERVER_ERROR;
+            }
+            if (cfg->async_journal != NULL &&
+                q2_rest_journal_replay(cfg, ptemp))
+                ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s,
+                             "q2: unable to replay the async journal");
+        }
+        if (cfg->async_path != NULL &&
+            cfg->async_queue == Q2_REST_QUEUE_JOURNAL &&
+            cfg->segment == NULL) {
+            if (cfg->async_journal == NULL)
+                cfg->async_journal = apr_psprintf(pconf, Q2_REST_SEGMENT_FILE,
+                                                  cfg->async_path);
+            if (apr_shm_create(&(cfg->segment_shm),
+                               sizeof(q2_rest_segment_t), NULL, pconf)
+                    != APR_SUCCESS ||
+                apr_global_mutex_create(&(cfg->journal_mutex), NULL,
+                                        APR_LOCK_DEFAULT, pconf)
+                    != APR_SUCCESS ||
+                apr_file_open(&(cfg->segment_fh), cfg->async_journal,
+                              APR_FOPEN_READ|APR_FOPEN_WRITE|
+                              APR_FOPEN_CREATE|APR_FOPEN_BINARY,
+                              APR_OS_DEFAULT, pconf) != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                             "q2: unable to create the async journal");
+                return HTTP_INTERNAL_SERVER_ERROR;
+            }
+            cfg->segment =
+                (q2_rest_segment_t*)apr_shm_baseaddr_get(cfg->segment_shm);
+            memset(cfg->segment, 0, sizeof(q2_rest_segment_t));
+            if (q2_rest_segment_replay(cfg, ptemp)) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                             "q2: unable to replay the async journal");
+                return HTTP_INTERNAL_SERVER_ERROR;
+            }
+        }
+        if (cfg->async_path != NULL && cfg->async_result_ttl > 0 &&
+            cfg->async_results == NULL) {
+            cfg->async_results =
+                q2_shm_cache_create(pconf, cfg->async_result_size,
+                                    Q2_REST_RESULT_SLOT_SIZE);
+            if (cfg->async_results == NULL) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                             "q2: unable to create the async result store");
+                return HTTP_INTERNAL_SERVER_ERROR;
+            }
+        }
+        if (cfg->auth_cache_ttl > 0 && cfg->auth_cache == NULL) {
+            cfg->auth_cache = q2_shm_cache_create(pconf, cfg->auth_cache_size,
+                                                  Q2_REST_AUTH_SLOT_SIZE);
+            if (cfg->auth_cache == NULL) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                             "q2: unable to create the credential cache");
+                return HTTP_INTERNAL_SERVER_ERROR;
+            }
+        }
+        if (cfg->response_cache_ttl > 0 && cfg->response_cache == NULL) {
+            cfg->response_cache =
+                q2_shm_cache_create(pconf, cfg->response_cache_size,
+                                    Q2_REST_RCACHE_SLOT_SIZE);
+            if (cfg->response_cache == NULL) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                             "q2: unable to create the response cache");
+                return HTTP_INTERNAL_SERVER_ERROR;
+            }
+        }
+        if (cfg->schema_cache_ttl <= 0 || cfg->schema_cache != NULL) continue;
+        cfg->schema_cache = q2_shm_cache_create(pconf,
+                                                cfg->schema_cache_size,
+                                                (apr_size_t)
+                                                cfg->schema_cache_slot * 1024);
+        if (cfg->schema_cache == NULL) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                         "q2: unable to create the schema cache");
+            return HTTP_INTERNAL_SERVER_ERROR;
+        }
+    }
+    return OK;
+}
+
+static void q2_rest_child_init(apr_pool_t *p, server_rec *s)
+{
+    q2_rest_cfg_t *cfg;
+    ap_dbd_t *dbd;
+    ap_dbd_t* (*open_fn)(apr_pool_t*, server_rec*);
+    void (*close_fn)(server_rec*, ap_dbd_t*);
+    open_fn = APR_RETRIEVE_OPTIONAL_FN(ap_dbd_open);
+    close_fn = APR_RETRIEVE_OPTIONAL_FN(ap_dbd_close);
+    for (; s != NULL; s = s->next) {
+        cfg = ap_get_module_config(s->module_config, &q2_module);
+        if (cfg->schema_cache != NULL)
+            q2_shm_cache_child_init(cfg->schema_cache, p);
+        if (cfg->response_cache != NULL)
+            q2_shm_cache_child_init(cfg->response_cache, p);
+        if (cfg->auth_cache != NULL)
+            q2_shm_cache_child_init(cfg->auth_cache, p);
+        if (cfg->async_results != NULL)
+            q2_shm_cache_child_init(cfg->async_results, p);
+        if (cfg->journal_mutex != NULL)
+            apr_global_mutex_child_init(&(cfg->journal_mutex),
+                                        apr_global_mutex_lockfile(
+                                            cfg->journal_mutex), p);
+        if (!cfg->relation_graph || cfg->graph_pool != NULL) continue;
+        if (apr_pool_create(&(cfg->graph_pool), p) != APR_SUCCESS) {
+            cfg->graph_pool = NULL;
+            continue;
+        }
+        if (apr_thread_mutex_create(&(cfg->graph_mutex),
+                                    APR_THREAD_MUTEX_DEFAULT, p)
+            != APR_SUCCESS) {
+            cfg->graph_mutex = NULL;
+            continue;
+        }
+        if (open_fn == NULL || close_fn == NULL) continue;
+        if ((dbd = open_fn(p, s)) == NULL) continue;
+        q2_rest_graph_build(cfg, dbd);
+        close_fn(s, dbd);
+        if (cfg->graph == NULL)
+            ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s,
+                         "q2: unable to build the relation graph");
+    }
+}
+
 static void q2_rest_register_hooks(apr_pool_t *p)
 {
+    static const char * const q2_rest_dbd[] = {"mod_dbd.c", NULL};
+    ap_hook_post_config(q2_rest_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_child_init(q2_rest_child_init, q2_rest_dbd, NULL, APR_HOOK_MIDDLE);
+
     ap_hook_watchdog_need(q2_rest_async_need, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_watchdog_init(q2_rest_async_init, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_watchdog_step(q2_rest_async_step, NULL, NULL, APR_HOOK_MIDDLE);
@@ -4346,17 +8423,81 @@ static void q2_rest_register_hooks(apr_pool_t *p)
 static void *q2_rest_create_config(apr_pool_t *p, server_rec *s)
 {
     q2_rest_cfg_t *cfg = (q2_rest_cfg_t*)apr_pcalloc(p, sizeof(q2_rest_cfg_t));
-    cfg->hostname = NULL;
-    cfg->server_port = 0;
     cfg->async_path = NULL;
     cfg->auth_params = NULL;
     cfg->pagination_ppg = 0;
+    cfg->schema_cache_ttl = 0;
+    cfg->schema_cache_size = Q2_SCHEMA_CACHE_SLOTS;
+    cfg->schema_cache_slot = Q2_SCHEMA_CACHE_SLOT_SIZE / 1024;
+    cfg->schema_cache = NULL;
+    cfg->relation_graph = 0;
+    cfg->graph = NULL;
+    cfg->graph_pool = NULL;
+    cfg->graph_next = 0;
+    cfg->graph_mutex = NULL;
+    cfg->count_mode = Q2_COUNT_EXACT;
+    cfg->pagination_mode = Q2_PAGINATE_OFFSET;
+    cfg->stream_results = 0;
+    cfg->response_cache_ttl = 0;
+    cfg->response_cache_size = Q2_REST_RCACHE_SLOTS;
+    cfg->response_cache = NULL;
+    cfg->gens_shm = NULL;
+    cfg->gens = NULL;
+    cfg->gens_boot = 0;
+    cfg->version_etag = 0;
+    cfg->version_column = NULL;
+    cfg->auth_cache_ttl = 0;
+    cfg->auth_cache_size = Q2_REST_AUTH_SLOTS;
+    cfg->auth_cache = NULL;
+    cfg->token_ttl = 0;
+    cfg->token_key = NULL;
+    cfg->token_key_len = 0;
+    cfg->async_queue = Q2_REST_QUEUE_FILE;
+    cfg->async_queue_size = Q2_REST_QUEUE_SLOTS;
+    cfg->async_ring = NULL;
+    cfg->async_journal = NULL;
+    cfg->journal_mutex = NULL;
+    cfg->async_threads = Q2_REST_WD_MAX_THREADS;
+    cfg->async_backlog = Q2_REST_ASYNC_BACKLOG;
+    cfg->async_wait_max = Q2_REST_WAIT_MAX;
+    cfg->async_status_ttl = Q2_REST_STATUS_TTL;
+    cfg->async_max_entries = Q2_REST_MAX_ENTRIES;
+    cfg->async_batch = Q2_REST_ASYNC_BATCH;
+    cfg->async_tp = NULL;
+    cfg->async_server = NULL;
+    cfg->async_mutex = NULL;
+    cfg->async_watcher = NULL;
+    cfg->async_watch_fd = -1;
+    cfg->async_stop = 0;
+    cfg->async_shm = NULL;
+    cfg->async_stats = NULL;
+    cfg->async_result_ttl = Q2_REST_RESULT_TTL;
+    cfg->async_result_size = Q2_REST_RESULT_SLOTS;
+    cfg->async_results = NULL;
+    cfg->segment_size = Q2_REST_SEGMENT_SIZE * 1024 * 1024;
+    cfg->sync_window = Q2_REST_SYNC_WINDOW * 1000;
+    cfg->segment_fh = NULL;
+    cfg->segment_shm = NULL;
+    cfg->segment = NULL;
     return cfg;
 }
 
-static const char *q2_rest_cmd_server_name(cmd_parms *cmd,
-                                           void *dconf,
-                                           const char *server_name)
+//! Q2ServerName and Q2ServerPort are still accepted so that old
+//! configurations load, queued requests no longer go through the server
+static const char *q2_rest_cmd_deprecated(cmd_parms *cmd,
+                                          void *dconf,
+                                          const char *arg)
+{
+    const char *er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    ap_log_error(APLOG_MARK, APLOG_WARNING, 0, cmd->server,
+                 "q2: %s is deprecated and ignored", cmd->cmd->name);
+    return NULL;
+}
+
+static const char *q2_rest_cmd_auth(cmd_parms *cmd,
+                                    void *dconf,
+                                    const char *auth)
 {
     q2_rest_cfg_t *cfg;
     const char *er;
@@ -4364,13 +8505,13 @@ static const char *q2_rest_cmd_server_name(cmd_parms *cmd,
                                                &q2_module);
     er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
     if (er != NULL) return er;
-    if (cfg->hostname == NULL) cfg->hostname = server_name;
+    if (cfg->auth_params == NULL) cfg->auth_params = auth;
     return NULL;
 }
 
-static const char *q2_rest_cmd_server_port(cmd_parms *cmd,
-                                           void *dconf,
-                                           const char *server_port)
+static const char *q2_rest_cmd_auth_ttl(cmd_parms *cmd,
+                                        void *dconf,
+                                        const char *ttl)
 {
     q2_rest_cfg_t *cfg;
     const char *er;
@@ -4378,13 +8519,13 @@ static const char *q2_rest_cmd_server_port(cmd_parms *cmd,
                                                &q2_module);
     er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
     if (er != NULL) return er;
-    if (cfg->server_port == 0) cfg->server_port = atoi(server_port);
+    cfg->auth_cache_ttl = atoi(ttl);
     return NULL;
 }
 
-static const char *q2_rest_cmd_auth(cmd_parms *cmd,
-                                    void *dconf,
-                                    const char *auth)
+static const char *q2_rest_cmd_auth_size(cmd_parms *cmd,
+                                         void *dconf,
+                                         const char *size)
 {
     q2_rest_cfg_t *cfg;
     const char *er;
@@ -4392,7 +8533,39 @@ static const char *q2_rest_cmd_auth(cmd_parms *cmd,
                                                &q2_module);
     er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
     if (er != NULL) return er;
-    if (cfg->auth_params == NULL) cfg->auth_params = auth;
+    if (atoi(size) <= 0) return "Q2AuthCacheSize must be a positive number";
+    cfg->auth_cache_size = atoi(size);
+    return NULL;
+}
+
+static const char *q2_rest_cmd_token_ttl(cmd_parms *cmd,
+                                         void *dconf,
+                                         const char *ttl)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    cfg->token_ttl = atoi(ttl);
+    return NULL;
+}
+
+static const char *q2_rest_cmd_token_key(cmd_parms *cmd,
+                                         void *dconf,
+                                         const char *key)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    if (strlen(key) < Q2_REST_TOKEN_KEY_LEN)
+        return "Q2TokenKey must be at least 32 characters long";
+    cfg->token_key = apr_pstrdup(cmd->pool, key);
+    cfg->token_key_len = strlen(key);
     return NULL;
 }
 
@@ -4410,6 +8583,203 @@ static const char *q2_rest_cmd_async(cmd_parms *cmd,
     return NULL;
 }
 
+static const char *q2_rest_cmd_async_queue(cmd_parms *cmd,
+                                           void *dconf,
+                                           const char *queue)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    if (strcasecmp(queue, "file") == 0)
+        cfg->async_queue = Q2_REST_QUEUE_FILE;
+    else if (strcasecmp(queue, "shm") == 0)
+        cfg->async_queue = Q2_REST_QUEUE_SHM;
+    else if (strcasecmp(queue, "journal") == 0)
+        cfg->async_queue = Q2_REST_QUEUE_JOURNAL;
+    else
+        return "Q2AsyncQueue must be file, shm or journal";
+    return NULL;
+}
+
+static const char *q2_rest_cmd_async_queue_size(cmd_parms *cmd,
+                                                void *dconf,
+                                                const char *size)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    if (atoi(size) <= 0) return "Q2AsyncQueueSize must be a positive number";
+    cfg->async_queue_size = atoi(size);
+    return NULL;
+}
+
+static const char *q2_rest_cmd_async_journal(cmd_parms *cmd,
+                                             void *dconf,
+                                             const char *path)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    cfg->async_journal = path;
+    return NULL;
+}
+
+static const char *q2_rest_cmd_async_journal_size(cmd_parms *cmd,
+                                                  void *dconf,
+                                                  const char *size)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    if (atoi(size) <= 0 || atoi(size) >= 4096)
+        return "Q2AsyncJournalSize must be between 1 and 4095";
+    cfg->segment_size = (apr_uint32_t)atoi(size) * 1024 * 1024;
+    return NULL;
+}
+
+static const char *q2_rest_cmd_async_sync_window(cmd_parms *cmd,
+                                                 void *dconf,
+                                                 const char *window)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    if (atoi(window) < 0) return "Q2AsyncSyncWindow must not be negative";
+    cfg->sync_window = (apr_interval_time_t)atoi(window) * 1000;
+    return NULL;
+}
+
+static const char *q2_rest_cmd_async_threads(cmd_parms *cmd,
+                                             void *dconf,
+                                             const char *threads)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    if (atoi(threads) <= 0) return "Q2AsyncThreads must be a positive number";
+    cfg->async_threads = atoi(threads);
+    return NULL;
+}
+
+static const char *q2_rest_cmd_async_backlog(cmd_parms *cmd,
+                                             void *dconf,
+                                             const char *backlog)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    if (atoi(backlog) <= 0) return "Q2AsyncBacklog must be a positive number";
+    cfg->async_backlog = atoi(backlog);
+    return NULL;
+}
+
+static const char *q2_rest_cmd_async_batch(cmd_parms *cmd,
+                                           void *dconf,
+                                           const char *batch)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    if (atoi(batch) <= 0) return "Q2AsyncBatch must be a positive number";
+    cfg->async_batch = atoi(batch);
+    return NULL;
+}
+
+static const char *q2_rest_cmd_async_wait_max(cmd_parms *cmd,
+                                              void *dconf,
+                                              const char *wait)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    cfg->async_wait_max = atoi(wait);
+    return NULL;
+}
+
+static const char *q2_rest_cmd_async_status_ttl(cmd_parms *cmd,
+                                                void *dconf,
+                                                const char *ttl)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    cfg->async_status_ttl = atoi(ttl);
+    return NULL;
+}
+
+static const char *q2_rest_cmd_async_max_entries(cmd_parms *cmd,
+                                                 void *dconf,
+                                                 const char *max)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    cfg->async_max_entries = atoi(max);
+    return NULL;
+}
+
+static const char *q2_rest_cmd_async_result_ttl(cmd_parms *cmd,
+                                                void *dconf,
+                                                const char *ttl)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    cfg->async_result_ttl = atoi(ttl);
+    return NULL;
+}
+
+static const char *q2_rest_cmd_async_result_size(cmd_parms *cmd,
+                                                 void *dconf,
+                                                 const char *size)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    if (atoi(size) <= 0) return "Q2AsyncResultSize must be a positive number";
+    cfg->async_result_size = atoi(size);
+    return NULL;
+}
+
 static const char *q2_rest_cmd_ppg(cmd_parms *cmd,
                                    void *dconf,
                                    const char *ppg)
@@ -4424,17 +8794,243 @@ static const char *q2_rest_cmd_ppg(cmd_parms *cmd,
     return NULL;
 }
 
+static const char *q2_rest_cmd_schema_ttl(cmd_parms *cmd,
+                                          void *dconf,
+                                          const char *ttl)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    cfg->schema_cache_ttl = atoi(ttl);
+    return NULL;
+}
+
+static const char *q2_rest_cmd_schema_size(cmd_parms *cmd,
+                                           void *dconf,
+                                           const char *size)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    if (atoi(size) <= 0) return "Q2SchemaCacheSize must be a positive number";
+    cfg->schema_cache_size = atoi(size);
+    return NULL;
+}
+
+static const char *q2_rest_cmd_schema_slot(cmd_parms *cmd,
+                                           void *dconf,
+                                           const char *size)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    if (atoi(size) <= 0)
+        return "Q2SchemaCacheSlotSize must be a positive number";
+    cfg->schema_cache_slot = atoi(size);
+    return NULL;
+}
+
+static const char *q2_rest_cmd_response_ttl(cmd_parms *cmd,
+                                            void *dconf,
+                                            const char *ttl)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    cfg->response_cache_ttl = atoi(ttl);
+    return NULL;
+}
+
+static const char *q2_rest_cmd_response_size(cmd_parms *cmd,
+                                             void *dconf,
+                                             const char *size)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    if (atoi(size) <= 0)
+        return "Q2ResponseCacheSize must be a positive number";
+    cfg->response_cache_size = atoi(size);
+    return NULL;
+}
+
+static const char *q2_rest_cmd_version_etag(cmd_parms *cmd,
+                                            void *dconf,
+                                            const char *version)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    cfg->version_etag = atoi(version);
+    return NULL;
+}
+
+static const char *q2_rest_cmd_version_column(cmd_parms *cmd,
+                                              void *dconf,
+                                              const char *column)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    for (const char *c = column; *c; c++)
+        if (!isalnum((unsigned char)*c) && *c != '_')
+            return "Q2VersionColumn must be a column name";
+    cfg->version_column = apr_pstrdup(cmd->pool, column);
+    return NULL;
+}
+
+static const char *q2_rest_cmd_graph(cmd_parms *cmd,
+                                     void *dconf,
+                                     const char *graph)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    cfg->relation_graph = atoi(graph);
+    return NULL;
+}
+
+static const char *q2_rest_cmd_count(cmd_parms *cmd,
+                                     void *dconf,
+                                     const char *mode)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    cfg->count_mode = q2_count_mode_parse(mode);
+    if (!cfg->count_mode)
+        return "Q2PaginationCount must be exact, window, estimated or none";
+    return NULL;
+}
+
+static const char *q2_rest_cmd_paginate(cmd_parms *cmd,
+                                        void *dconf,
+                                        const char *mode)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    if (strcasecmp(mode, "offset") == 0)
+        cfg->pagination_mode = Q2_PAGINATE_OFFSET;
+    else if (strcasecmp(mode, "cursor") == 0)
+        cfg->pagination_mode = Q2_PAGINATE_CURSOR;
+    else
+        return "Q2PaginationMode must be offset or cursor";
+    return NULL;
+}
+
+static const char *q2_rest_cmd_stream(cmd_parms *cmd,
+                                      void *dconf,
+                                      const char *stream)
+{
+    q2_rest_cfg_t *cfg;
+    const char *er;
+    cfg = (q2_rest_cfg_t*)ap_get_module_config(cmd->server->module_config,
+                                               &q2_module);
+    er = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
+    if (er != NULL) return er;
+    cfg->stream_results = atoi(stream);
+    return NULL;
+}
+
 static const command_rec q2_rest_cmds[] = {
-    AP_INIT_TAKE1("Q2ServerName", q2_rest_cmd_server_name, NULL, RSRC_CONF,
-                  "REST server name"),
-    AP_INIT_TAKE1("Q2ServerPort", q2_rest_cmd_server_port, NULL, RSRC_CONF,
-                  "REST server port"),
+    AP_INIT_TAKE1("Q2ServerName", q2_rest_cmd_deprecated, NULL, RSRC_CONF,
+                  "Deprecated, ignored"),
+    AP_INIT_TAKE1("Q2ServerPort", q2_rest_cmd_deprecated, NULL, RSRC_CONF,
+                  "Deprecated, ignored"),
     AP_INIT_TAKE1("Q2DBDAuthParams", q2_rest_cmd_auth, NULL, RSRC_CONF,
                   "Enable HMAC authentication"),
+    AP_INIT_TAKE1("Q2AuthCacheTTL", q2_rest_cmd_auth_ttl, NULL, RSRC_CONF,
+                  "Credential cache TTL in seconds (0=disabled)"),
+    AP_INIT_TAKE1("Q2AuthCacheSize", q2_rest_cmd_auth_size, NULL, RSRC_CONF,
+                  "Number of cached credentials"),
+    AP_INIT_TAKE1("Q2TokenTTL", q2_rest_cmd_token_ttl, NULL, RSRC_CONF,
+                  "Session token lifetime in seconds (0=disabled)"),
+    AP_INIT_TAKE1("Q2TokenKey", q2_rest_cmd_token_key, NULL, RSRC_CONF,
+                  "Session token signing key, random when not set"),
     AP_INIT_TAKE1("Q2AsyncPath", q2_rest_cmd_async, NULL, RSRC_CONF,
                   "Enable/Disable asynchronous operations (0=disabled)"),
+    AP_INIT_TAKE1("Q2AsyncQueue", q2_rest_cmd_async_queue, NULL, RSRC_CONF,
+                  "Async queue backend (file, shm, journal)"),
+    AP_INIT_TAKE1("Q2AsyncQueueSize", q2_rest_cmd_async_queue_size, NULL,
+                  RSRC_CONF, "Number of slots of the shm async queue"),
+    AP_INIT_TAKE1("Q2AsyncJournal", q2_rest_cmd_async_journal, NULL,
+                  RSRC_CONF, "Append-only journal of the shm async queue, "
+                  "segment of the journal queue"),
+    AP_INIT_TAKE1("Q2AsyncJournalSize", q2_rest_cmd_async_journal_size, NULL,
+                  RSRC_CONF, "Journal segment size in MB"),
+    AP_INIT_TAKE1("Q2AsyncSyncWindow", q2_rest_cmd_async_sync_window, NULL,
+                  RSRC_CONF, "Journal group commit window in milliseconds"),
+    AP_INIT_TAKE1("Q2AsyncThreads", q2_rest_cmd_async_threads, NULL,
+                  RSRC_CONF, "Threads executing async requests"),
+    AP_INIT_TAKE1("Q2AsyncBacklog", q2_rest_cmd_async_backlog, NULL,
+                  RSRC_CONF, "Pending async requests before answering 503"),
+    AP_INIT_TAKE1("Q2AsyncBatch", q2_rest_cmd_async_batch, NULL, RSRC_CONF,
+                  "Queued POSTs run together as multi-row INSERTs (1=off)"),
+    AP_INIT_TAKE1("Q2AsyncWaitMax", q2_rest_cmd_async_wait_max, NULL,
+                  RSRC_CONF, "Longest async status wait in seconds (0=off)"),
+    AP_INIT_TAKE1("Q2AsyncStatusTTL", q2_rest_cmd_async_status_ttl, NULL,
+                  RSRC_CONF, "Async status lifetime in seconds (0=forever)"),
+    AP_INIT_TAKE1("Q2AsyncMaxEntries", q2_rest_cmd_async_max_entries, NULL,
+                  RSRC_CONF, "Async status files kept (0=unbounded)"),
+    AP_INIT_TAKE1("Q2AsyncResultTTL", q2_rest_cmd_async_result_ttl, NULL,
+                  RSRC_CONF, "Async result lifetime in seconds (0=disabled)"),
+    AP_INIT_TAKE1("Q2AsyncResultSize", q2_rest_cmd_async_result_size, NULL,
+                  RSRC_CONF, "Number of async results held in memory"),
     AP_INIT_TAKE1("Q2PaginationPPG", q2_rest_cmd_ppg, NULL, RSRC_CONF,
                   "Enable/Disable pagination (0=disabled)"),
+    AP_INIT_TAKE1("Q2PaginationCount", q2_rest_cmd_count, NULL, RSRC_CONF,
+                  "Total rows count: exact, window, estimated or none"),
+    AP_INIT_TAKE1("Q2PaginationMode", q2_rest_cmd_paginate, NULL, RSRC_CONF,
+                  "Pagination links: offset (/next/N) or cursor (/after/C)"),
+    AP_INIT_TAKE1("Q2StreamResults", q2_rest_cmd_stream, NULL, RSRC_CONF,
+                  "Enable/Disable streaming of GET lists (0=disabled)"),
+    AP_INIT_TAKE1("Q2SchemaCacheTTL", q2_rest_cmd_schema_ttl, NULL, RSRC_CONF,
+                  "Schema metadata cache TTL in seconds (0=disabled)"),
+    AP_INIT_TAKE1("Q2SchemaCacheSize", q2_rest_cmd_schema_size, NULL, RSRC_CONF,
+                  "Number of tables held by the schema metadata cache"),
+    AP_INIT_TAKE1("Q2SchemaCacheSlotSize", q2_rest_cmd_schema_slot, NULL,
+                  RSRC_CONF, "Schema metadata cache KB per table"),
+    AP_INIT_TAKE1("Q2ResponseCacheTTL", q2_rest_cmd_response_ttl, NULL,
+                  RSRC_CONF, "GET response cache TTL in seconds (0=disabled)"),
+    AP_INIT_TAKE1("Q2ResponseCacheSize", q2_rest_cmd_response_size, NULL,
+                  RSRC_CONF, "Number of responses held by the cache"),
+    AP_INIT_TAKE1("Q2VersionETag", q2_rest_cmd_version_etag, NULL, RSRC_CONF,
+                  "GET ETags from table generations (0=disabled, 1=enabled)"),
+    AP_INIT_TAKE1("Q2VersionColumn", q2_rest_cmd_version_column, NULL,
+                  RSRC_CONF, "Row version column, e.g. updated_at"),
+    AP_INIT_TAKE1("Q2RelationGraph", q2_rest_cmd_graph, NULL, RSRC_CONF,
+                  "Enable/Disable the in-memory relation graph (0=disabled)"),
     {NULL}
 };
 